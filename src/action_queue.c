@@ -0,0 +1,315 @@
+#include "action_queue.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+static long aq_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t aq_record_crc(struct AQRecord *rec)
+{
+    size_t offset = offsetof(struct AQRecord, seq);
+    return crc32_final(crc32_update(CRC32_INIT, (char*)rec + offset, sizeof(struct AQRecord) - offset));
+}
+
+static long aq_read_records(struct ActionQueue *queue, struct AQRecord **records)
+{
+    /* Read all records of log into an array that must be freed by caller */
+    *records = malloc(sizeof(struct AQRecord) * (queue->nrecords + 1));
+    if (*records == NULL) {
+        ERROR("Failed to allocate %zu action records\n", queue->nrecords);
+        return -1;
+    }
+
+    size_t size = sizeof(struct AQRecord) * queue->nrecords;
+    if (size > 0 && pread(queue->fd, *records, size, 0) != (ssize_t)size) {
+        ERROR("Failed to read action queue: %s: %s\n", queue->path, strerror(errno));
+        free(*records);
+        *records = NULL;
+        return -1;
+    }
+    return queue->nrecords;
+}
+
+static void aq_record_to_action(struct AQRecord *rec, struct EpisodeAction *action)
+{
+    memset(action, 0, sizeof(struct EpisodeAction));
+    action->action = rec->action;
+    action->started = rec->started;
+    action->position = rec->position;
+    action->total = rec->total;
+    strncpy(action->timestamp, rec->timestamp, AQ_MAX_TIMESTAMP - 1);
+    strncpy(action->pod.url, rec->podcast, PODCAST_MAX_URL - 1);
+    strncpy(action->ep.url, rec->episode, PODCAST_MAX_URL - 1);
+    strncpy(action->ep.guid, rec->guid, PODCAST_MAX_GUID - 1);
+    action->ep.podcast = &action->pod;
+}
+
+int aq_open(struct ActionQueue *queue, const char *path)
+{
+    /* Open log and find the last valid record. Anything behind it is a record that was
+     * torn by a crash while it was written, it was never acknowledged and is cut off */
+    struct stat st;
+    struct AQRecord rec;
+
+    queue->fd = -1;
+    queue->nrecords = 0;
+    queue->seq = 0;
+    queue->npending = 0;
+    queue->pending_ms = 0;
+    if (strlen(path) >= sizeof(queue->path)) {
+        ERROR("Action queue path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(queue->path, path);
+
+    queue->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (queue->fd < 0 || fstat(queue->fd, &st) < 0) {
+        ERROR("Failed to open action queue: %s: %s\n", path, strerror(errno));
+        if (queue->fd >= 0)
+            close(queue->fd);
+        queue->fd = -1;
+        return -1;
+    }
+
+    size_t nrecords = st.st_size / sizeof(struct AQRecord);
+    while (queue->nrecords < nrecords) {
+        off_t offset = queue->nrecords * sizeof(struct AQRecord);
+        if (pread(queue->fd, &rec, sizeof(rec), offset) != sizeof(rec) ||
+            rec.magic != AQ_MAGIC || rec.crc != aq_record_crc(&rec))
+            break;
+        queue->seq = rec.seq + 1;
+        queue->nrecords++;
+    }
+
+    off_t size = queue->nrecords * sizeof(struct AQRecord);
+    if (size < st.st_size) {
+        ERROR("Action queue has a torn record at %ld, cutting off %ld bytes: %s\n", size, st.st_size - size, path);
+        if (ftruncate(queue->fd, size) < 0 || fdatasync(queue->fd) < 0) {
+            ERROR("Failed to truncate action queue: %s: %s\n", path, strerror(errno));
+            close(queue->fd);
+            queue->fd = -1;
+            return -1;
+        }
+    }
+    DEBUG("Action queue opened with %zu actions: %s\n", queue->nrecords, path);
+    return 0;
+}
+
+int aq_sync(struct ActionQueue *queue)
+{
+    /* Make all appended actions durable with one sync */
+    if (queue->npending == 0)
+        return 0;
+
+    if (fdatasync(queue->fd) < 0) {
+        ERROR("Failed to sync action queue: %s: %s\n", queue->path, strerror(errno));
+        return -1;
+    }
+    DEBUG("Synced %zu actions\n", queue->npending);
+    queue->npending = 0;
+    return 0;
+}
+
+int aq_close(struct ActionQueue *queue)
+{
+    int ret = aq_sync(queue);
+    if (close(queue->fd) < 0)
+        ret = -1;
+    queue->fd = -1;
+    return ret;
+}
+
+int aq_append(struct ActionQueue *queue, struct EpisodeAction *action)
+{
+    /* Write one record, it is synced together with the rest of its batch */
+    struct AQRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = AQ_MAGIC;
+    rec.seq = queue->seq;
+    rec.action = action->action;
+    rec.started = action->started;
+    rec.position = action->position;
+    rec.total = action->total;
+    strncpy(rec.timestamp, action->timestamp, AQ_MAX_TIMESTAMP - 1);
+    strncpy(rec.podcast, action->pod.url, PODCAST_MAX_URL - 1);
+    strncpy(rec.episode, action->ep.url, PODCAST_MAX_URL - 1);
+    strncpy(rec.guid, action->ep.guid, PODCAST_MAX_GUID - 1);
+    rec.crc = aq_record_crc(&rec);
+
+    ssize_t written = write(queue->fd, &rec, sizeof(rec));
+    if (written != sizeof(rec)) {
+        ERROR("Failed to append to action queue: %s: %s\n", queue->path, strerror(errno));
+
+        // don't leave a partial record in front of the next one
+        if (written > 0 && ftruncate(queue->fd, queue->nrecords * sizeof(struct AQRecord)) < 0)
+            ERROR("Failed to truncate action queue: %s: %s\n", queue->path, strerror(errno));
+        return -1;
+    }
+    queue->seq++;
+    queue->nrecords++;
+
+    long now = aq_now_ms();
+    if (queue->npending++ == 0)
+        queue->pending_ms = now;
+
+    if (queue->npending < AQ_SYNC_COUNT && now - queue->pending_ms < AQ_SYNC_MS)
+        return 0;
+    if (aq_sync(queue) < 0)
+        return -1;
+    return 1;
+}
+
+long aq_read(struct ActionQueue *queue, struct EpisodeAction **actions)
+{
+    struct AQRecord *records;
+    long nrecords = aq_read_records(queue, &records);
+    if (nrecords < 0)
+        return -1;
+
+    *actions = malloc(sizeof(struct EpisodeAction) * (nrecords + 1));
+    if (*actions == NULL) {
+        ERROR("Failed to allocate %ld actions\n", nrecords);
+        free(records);
+        return -1;
+    }
+
+    for (long i=0 ; i<nrecords ; i++)
+        aq_record_to_action(&records[i], &(*actions)[i]);
+
+    free(records);
+    return nrecords;
+}
+
+static size_t aq_slot(size_t *table, size_t table_size, struct AQRecord *records, const char *url)
+{
+    /* Return slot of episode url in table, or the empty slot where it should go */
+    size_t slot = hash_str(url) & (table_size-1);
+
+    while (table[slot] != 0 && strcmp(records[table[slot]-1].episode, url) != 0)
+        slot = (slot + 1) & (table_size-1);
+    return slot;
+}
+
+static int aq_sync_dir(const char *path)
+{
+    /* Sync dir of path, so a rename into it stays after a crash */
+    char dir[AQ_MAX_PATH];
+    strcpy(dir, path);
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else
+        *slash = '\0';
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    int ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+static int aq_replace(struct ActionQueue *queue, struct AQRecord *records, size_t nrecords)
+{
+    /* Write records to a new log that replaces the current one once it is synced.
+     * Dir is synced after rename, otherwise the old log with the dropped records can come back */
+    char tmp_path[sizeof(queue->path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", queue->path);
+
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        ERROR("Failed to create action queue: %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    size_t size = sizeof(struct AQRecord) * nrecords;
+    if ((size > 0 && write(fd, records, size) != (ssize_t)size) || fdatasync(fd) < 0 || rename(tmp_path, queue->path) < 0) {
+        ERROR("Failed to write action queue: %s: %s\n", tmp_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    if (aq_sync_dir(queue->path) < 0)
+        ERROR("Failed to sync dir of action queue: %s: %s\n", queue->path, strerror(errno));
+
+    close(queue->fd);
+    queue->fd = fd;
+    queue->nrecords = nrecords;
+    queue->npending = 0;
+    return 0;
+}
+
+long aq_compact(struct ActionQueue *queue)
+{
+    /* Keep every action except play actions that have a newer play action for the same
+     * episode. Log is walked from newest to oldest, so the first play action seen per
+     * episode is the one that is kept. Order of the kept actions doesn't change */
+    struct AQRecord *records;
+    long nrecords = aq_read_records(queue, &records);
+    if (nrecords < 0)
+        return -1;
+
+    size_t table_size = 16;
+    while (table_size < (size_t)nrecords * 2)
+        table_size *= 2;
+
+    // index+1 of newest play action of episode, 0 is empty
+    size_t *table = calloc(table_size, sizeof(size_t));
+    char *keep = malloc(nrecords + 1);
+    if (table == NULL || keep == NULL) {
+        ERROR("Failed to allocate action table\n");
+        free(table);
+        free(keep);
+        free(records);
+        return -1;
+    }
+
+    size_t nkeep = 0;
+    for (long i=nrecords-1 ; i>=0 ; i--) {
+        keep[i] = 1;
+        if (records[i].action == POD_ACTION_PLAY) {
+            size_t slot = aq_slot(table, table_size, records, records[i].episode);
+            if (table[slot] != 0)
+                keep[i] = 0;
+            else
+                table[slot] = i + 1;
+        }
+        nkeep += keep[i];
+    }
+
+    // move kept records to the front
+    size_t n = 0;
+    for (long i=0 ; i<nrecords ; i++) {
+        if (keep[i])
+            records[n++] = records[i];
+    }
+
+    long ret = nkeep;
+    if (nkeep < (size_t)nrecords) {
+        if (aq_replace(queue, records, nkeep) < 0)
+            ret = -1;
+        else
+            DEBUG("Compacted action queue from %ld to %zu actions\n", nrecords, nkeep);
+    }
+
+    free(table);
+    free(keep);
+    free(records);
+    return ret;
+}
+
+int aq_clear(struct ActionQueue *queue)
+{
+    if (ftruncate(queue->fd, 0) < 0 || fdatasync(queue->fd) < 0) {
+        ERROR("Failed to clear action queue: %s: %s\n", queue->path, strerror(errno));
+        return -1;
+    }
+    queue->nrecords = 0;
+    queue->npending = 0;
+    return 0;
+}
@@ -0,0 +1,87 @@
+#ifndef ACTION_QUEUE_H
+#define ACTION_QUEUE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "podcast.h"
+#include "lib/hash/hash.h"
+#include "lib/hash/crc32.h"
+
+// Durable queue of episode actions that are recorded locally and not uploaded yet.
+// Actions are appended to a write-ahead log of fixed size records, so a torn record at the end
+// of the file is found by its size and CRC and cut off when the queue is opened.
+//
+// Records are written straight away but the log is only synced once per batch (group commit):
+// when AQ_SYNC_COUNT records are waiting or the oldest waiting record is older than AQ_SYNC_MS.
+// An action is acknowledged once it is synced, aq_sync() acknowledges everything appended.
+//
+// Play actions are recorded far more often than they can be uploaded, only the newest play
+// action per episode matters. aq_compact() drops superseded play actions and replaces the log
+// with a new one, so the queue stays small while offline.
+
+#define AQ_MAGIC           0x31515741  // "AWQ1"
+#define AQ_MAX_PATH        256
+#define AQ_MAX_TIMESTAMP   32
+#define AQ_SYNC_COUNT      64
+#define AQ_SYNC_MS         1000
+
+extern int do_debug;
+extern int do_error;
+
+struct AQRecord {
+    uint32_t magic;
+
+    // CRC-32 of all fields after this one
+    uint32_t crc;
+    uint64_t seq;
+
+    int32_t action;
+    int32_t started;
+    int32_t position;
+    int32_t total;
+
+    char timestamp[AQ_MAX_TIMESTAMP];
+    char podcast[PODCAST_MAX_URL];
+    char episode[PODCAST_MAX_URL];
+    char guid[PODCAST_MAX_GUID];
+};
+
+struct ActionQueue {
+    char path[AQ_MAX_PATH];
+    int fd;
+
+    // records in log and sequence number of the next record
+    size_t nrecords;
+    uint64_t seq;
+
+    // records that are written but not synced, and time the oldest of them was written
+    size_t npending;
+    long pending_ms;
+};
+
+int aq_open(struct ActionQueue *queue, const char *path);
+int aq_close(struct ActionQueue *queue);
+
+// Append action, returns 1 if this append synced the batch, 0 if it is waiting for a sync
+int aq_append(struct ActionQueue *queue, struct EpisodeAction *action);
+int aq_sync(struct ActionQueue *queue);
+
+// Read all actions in log order, actions must be freed by caller. Returns amount or -1
+long aq_read(struct ActionQueue *queue, struct EpisodeAction **actions);
+
+// Drop superseded play actions from log, returns amount of actions left or -1
+long aq_compact(struct ActionQueue *queue);
+
+// Remove all actions, eg: after they are uploaded
+int aq_clear(struct ActionQueue *queue);
+
+#endif
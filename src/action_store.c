@@ -0,0 +1,205 @@
+#include "action_store.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+int action_parser_init(struct ActionParser *ap)
+{
+    ap->timestamp = -1;
+    return json_bind_init_growable(&ap->bind, &episode_action_schema);
+}
+
+void action_store_handle_data_cb(struct JSON *json, enum JSONEvent ev, void *user_data)
+{
+    /* Bind actions and catch the top-level timestamp: {object, key, value} */
+    struct ActionParser *ap = user_data;
+    json_bind_handle_data_cb(json, ev, &ap->bind);
+
+    if (ev == JSON_EV_NUMBER && json->stack_pos == 2 && stack_item_is_type(json, 2, JSON_DTYPE_OBJECT) == 1) {
+        struct JSONItem *key = stack_get_from_end(json, 1);
+        if (strcmp(key->data, ACTION_STORE_TIMESTAMP_KEY) == 0)
+            ap->timestamp = strtol(stack_get_from_end(json, 0)->data, NULL, 10);
+    }
+}
+
+int action_store_load(struct ActionStore *store, const char *path)
+{
+    /* Load state from file, a missing file results in an empty store that syncs full history */
+    store->actions = NULL;
+    store->nactions = 0;
+    store->max_actions = 0;
+    store->since = -1;
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        ERROR("Failed to open action store: %s\n", path);
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+
+    char *buf = malloc(size + 1);
+    if (buf == NULL) {
+        ERROR("Failed to allocate action store buffer\n");
+        fclose(fp);
+        return -1;
+    }
+    size_t n = fread(buf, 1, size, fp);
+    buf[n] = '\0';
+    fclose(fp);
+
+    struct ActionParser ap;
+    if (action_parser_init(&ap) < 0) {
+        free(buf);
+        return -1;
+    }
+
+    struct JSON json = json_init(action_store_handle_data_cb);
+    json.user_data = &ap;
+    json.is_complete = 1;
+
+    char *chunks[2] = {buf, NULL};
+    size_t nread = json_parse(&json, chunks, 2);
+    free(buf);
+
+    if (nread == (size_t)-1 || json.stack_pos != -1 || ap.bind.overflow) {
+        ERROR("Failed to parse action store: %s\n", path);
+        json_bind_free(&ap.bind);
+        return -1;
+    }
+
+    // take over records from binder
+    store->actions = ap.bind.records;
+    store->nactions = ap.bind.nrecords;
+    store->max_actions = ap.bind.max_records;
+    store->since = ap.timestamp;
+
+    DEBUG("Loaded %ld actions, since: %ld\n", store->nactions, store->since);
+    return 0;
+}
+
+static int action_store_flush(struct JSONWriter *jw, FILE *fp)
+{
+    char buf[4096];
+    size_t n;
+    while ((n = jw_read(jw, buf, sizeof(buf))) > 0) {
+        if (fwrite(buf, 1, n, fp) != n)
+            return -1;
+    }
+    return 0;
+}
+
+int action_store_save(struct ActionStore *store, const char *path)
+{
+    /* Serialize to temporary file and rename, so state and cursor are replaced together */
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    struct JSONWriter jw;
+    if (jw_init(&jw, 0) < 0)
+        return -1;
+
+    FILE *fp = fopen(tmp_path, "w");
+    if (fp == NULL) {
+        ERROR("Failed to open action store for writing: %s\n", tmp_path);
+        jw_free(&jw);
+        return -1;
+    }
+
+    int ret = 0;
+    jw_object_open(&jw);
+    jw_key(&jw, ACTION_STORE_TIMESTAMP_KEY);
+    jw_int(&jw, store->since);
+    jw_key(&jw, episode_action_schema.array_key);
+    jw_array_open(&jw);
+
+    for (size_t i=0 ; i<store->nactions && ret == 0 ; i++) {
+        if (episode_action_serialize(&jw, &store->actions[i]) < 0 || action_store_flush(&jw, fp) < 0)
+            ret = -1;
+    }
+    jw_array_close(&jw);
+    jw_object_close(&jw);
+
+    if (ret == 0)
+        ret = action_store_flush(&jw, fp);
+
+    jw_free(&jw);
+
+    if (fclose(fp) != 0 || ret < 0 || rename(tmp_path, path) < 0) {
+        ERROR("Failed to write action store: %s\n", path);
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+static size_t action_store_slot(size_t *table, size_t table_size, struct EpisodeAction *actions, const char *url)
+{
+    /* Return slot of episode url in table, or the empty slot where it should go */
+    size_t slot = hash_str(url) & (table_size-1);
+
+    while (table[slot] != 0 && strcmp(actions[table[slot]-1].ep.url, url) != 0)
+        slot = (slot + 1) & (table_size-1);
+    return slot;
+}
+
+int action_store_apply(struct ActionStore *store, struct EpisodeAction *actions, size_t nactions)
+{
+    /* Merge a batch of actions, only the newest action per episode is kept.
+     * Episodes are looked up in a hash table that is built once for the whole batch */
+    size_t max = store->nactions + nactions;
+    size_t table_size = 16;
+    while (table_size < max * 2)
+        table_size *= 2;
+
+    if (max > store->max_actions) {
+        struct EpisodeAction *tmp = realloc(store->actions, sizeof(struct EpisodeAction) * max);
+        if (tmp == NULL) {
+            ERROR("Failed to grow action store to %ld\n", max);
+            return -1;
+        }
+        store->actions = tmp;
+        store->max_actions = max;
+    }
+
+    // index+1 of action in store, 0 is empty
+    size_t *table = calloc(table_size, sizeof(size_t));
+    if (table == NULL) {
+        ERROR("Failed to allocate action table\n");
+        return -1;
+    }
+
+    for (size_t i=0 ; i<store->nactions ; i++) {
+        size_t slot = action_store_slot(table, table_size, store->actions, store->actions[i].ep.url);
+        table[slot] = i + 1;
+    }
+
+    for (size_t i=0 ; i<nactions ; i++) {
+        size_t slot = action_store_slot(table, table_size, store->actions, actions[i].ep.url);
+
+        if (table[slot] == 0) {
+            store->actions[store->nactions++] = actions[i];
+            table[slot] = store->nactions;
+            continue;
+        }
+
+        // ISO 8601 timestamps compare as strings
+        struct EpisodeAction *old = &store->actions[table[slot]-1];
+        if (strcmp(actions[i].timestamp, old->timestamp) >= 0)
+            *old = actions[i];
+    }
+    free(table);
+    return 0;
+}
+
+void action_store_free(struct ActionStore *store)
+{
+    free(store->actions);
+    store->actions = NULL;
+    store->nactions = 0;
+    store->max_actions = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef ACTION_STORE_H
+#define ACTION_STORE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "podcast.h"
+#include "lib/json/json.h"
+#include "lib/json/json_bind.h"
+#include "lib/json/json_writer.h"
+#include "lib/hash/hash.h"
+
+// Local episode state: the latest action for every episode and the timestamp that the
+// server returned on the last successful action sync.
+// Stored in the same format as an episode_action response so the same parser can be used:
+//     {"timestamp": 1666000000, "actions": [{...}, {...}]}
+
+#define ACTION_STORE_TIMESTAMP_KEY "timestamp"
+
+extern int do_debug;
+extern int do_error;
+
+struct ActionStore {
+    struct EpisodeAction *actions;
+    size_t nactions;
+    size_t max_actions;
+
+    // cursor, only actions newer than this are requested from server
+    long since;
+};
+
+// Is passed as user data to action_store_handle_data_cb()
+struct ActionParser {
+    struct JSONBind bind;
+
+    // top-level timestamp, -1 if not found
+    long timestamp;
+};
+
+int action_parser_init(struct ActionParser *ap);
+void action_store_handle_data_cb(struct JSON *json, enum JSONEvent ev, void *user_data);
+
+int action_store_load(struct ActionStore *store, const char *path);
+int action_store_save(struct ActionStore *store, const char *path);
+int action_store_apply(struct ActionStore *store, struct EpisodeAction *actions, size_t nactions);
+void action_store_free(struct ActionStore *store);
+
+#endif
@@ -10,17 +10,16 @@ int bytes_read = 0;
 
 static void ac_unescape(char *str)
 {
-    /* Find backslashes and remove them from string */
-    for (int i=0 ; i<strlen(str) ; i++) {
-        if (str[i] == '\\') {
-            // move everything to the left
-            char *lptr = str + i;
-            char *rptr = str + i + 1;
-            while (*rptr != '\0')
-                *lptr++ = *rptr++;
-            *lptr = '\0';
-        }
+    /* Find backslashes and remove them from string, the character after a backslash is kept.
+     * Done in one pass so whole cached feeds can be unescaped, see ac_reparse_feed() */
+    char *rptr = str;
+    char *wptr = str;
+    while (*rptr != '\0') {
+        if (*rptr == '\\' && *++rptr == '\0')
+            break;
+        *wptr++ = *rptr++;
     }
+    *wptr = '\0';
 }
 
 static char* ac_str_sanitize(char *str)
@@ -46,32 +45,6 @@ static char* ac_str_sanitize(char *str)
     return str;
 }
 
-static int write_to_file(char *path, const char *mode, const char *fmt, ...)
-{
-    va_list ptr;
-    va_start(ptr, fmt);
-
-    int res = mkdir(dirname(path), 0755);
-    if (res < 0 && errno != EEXIST) {
-        ERROR("Failed to create dir\n");
-        perror(NULL);
-        return -1;
-    }
-    path[strlen(path)] = '/';
-
-    FILE *fp = fopen(path, mode);
-    if (fp == NULL) {
-        ERROR("Failed to open file for writing, %s\n", path);
-        return -1;
-    }
-    vfprintf(fp, fmt, ptr);
-    fclose(fp);
-
-    va_end(ptr);
-    return 0;
-}
-
-
 static void episodes_handle_data_cb(struct PP *pp, enum PPDtype dtype, void *user_data)
 {
     /* Callback is passed to json lib to handle incoming data.
@@ -82,7 +55,7 @@ static void episodes_handle_data_cb(struct PP *pp, enum PPDtype dtype, void *use
 
     if (dtype == PP_DTYPE_TAG_OPEN && strcmp(item->data, "enclosure") == 0) {
         for (int i=0 ; i<PP_XML_MAX_PARAM ; i++) {
-            if (strcmp(item->param[i].key, "url") == 0) {
+            if (item->param[i].key != NULL && strcmp(item->param[i].key, "url") == 0) {
                 strncpy(ep->url, item->param[i].value, PODCAST_MAX_URL);
                 //DEBUG("Found url!\n");
                 break;
@@ -90,12 +63,18 @@ static void episodes_handle_data_cb(struct PP *pp, enum PPDtype dtype, void *use
         }
     }
     else if (dtype == PP_DTYPE_TAG_CLOSE && strcmp(item->data, "item") == 0) {
-        char path[256] = "";
-        sprintf(path, "%s/%s/%s.json", API_CLIENT_BASE_DIR, API_CLIENT_POD_DIR, ac_str_sanitize(ep->podcast->title));
-        write_to_file(path, "a", EPISODE_JSON_FMT, ep->title, ep->guid, ep->url);
+        if (data->writer.fd >= 0)
+            episode_writer_add(&data->writer, ep);
+        else
+            DEBUG("Skipping episode, feed has no title: %s\n", ep->podcast->url);
+
+        // appended to store when the transfer succeeded, see ac_transfer_finish()
+        if (data->store != NULL)
+            es_batch_add(data->store, &data->batch, ep->podcast->url, ep);
         ep->url[0] = '\0';
         ep->guid[0] = '\0';
         ep->title[0] = '\0';
+        ep->published = 0;
     }
     else if (dtype == PP_DTYPE_STRING || dtype == PP_DTYPE_CDATA) {
         struct PPToken *item_tag = pp_stack_get_from_end(pp, 1);
@@ -108,10 +87,8 @@ static void episodes_handle_data_cb(struct PP *pp, enum PPDtype dtype, void *use
                 //DEBUG("PODCAST TITLE: %s\n", item->data);
                 printf("   %s\n", item->data);
 
-
-                char path[256] = "";
-                sprintf(path, "%s/%s/%s.json", API_CLIENT_BASE_DIR, API_CLIENT_POD_DIR, ac_str_sanitize(ep->podcast->title));
-                write_to_file(path, "w", "[\n");
+                // podcast file is opened once, episodes are written to it when their item closes
+                episode_writer_open(&data->writer, API_CLIENT_BASE_DIR "/" API_CLIENT_POD_DIR, ac_str_sanitize(ep->podcast->title), ep->podcast->url);
             }
         }
 
@@ -125,23 +102,22 @@ static void episodes_handle_data_cb(struct PP *pp, enum PPDtype dtype, void *use
                 strncpy(ep->guid, item->data, PODCAST_MAX_GUID);
                 //DEBUG("GUID:  %s\n", item->data);
             }
+            else if (strcmp(item_tag->data, "pubDate") == 0) {
+                time_t date = curl_getdate(item->data, NULL);
+                if (date > 0) {
+                    feed_meta_add_pub_date(&data->pub_dates, date);
+                    ep->published = date;
+                }
+            }
         }
     }
 }
 
-static size_t ac_req_json_read_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+static int ac_req_json_parse_slice(struct APIUserData *data, char *ptr, size_t chunksize)
 {
-    struct APIUserData *data = userdata;
+    /* Parse one slice of response data, slice fits in chunk buffer */
     struct JSON *json = data->parser;
 
-    size_t chunksize = size * nmemb;
-
-    // This should never happen
-    if (chunksize > API_CLIENT_MAX_RDATA) {
-        ERROR("Chunksize is too big! %ld > %d\n", chunksize, API_CLIENT_MAX_RDATA);
-        return CURLE_WRITE_ERROR;
-    }
-
     /* copy as much data as possible into the 'ptr' buffer, but no more than
      'size' * 'nmemb' bytes! */
     memcpy(data->chunk, ptr, chunksize);
@@ -164,7 +140,7 @@ static size_t ac_req_json_read_cb(char *ptr, size_t size, size_t nmemb, void *us
 
     int nread = json_parse(json, chunks, sizeof(chunks)/sizeof(*chunks));
     if (nread < 0)
-        return CURLE_WRITE_ERROR;
+        return -1;
 
     DEBUG("read: %s\n", data->chunk);
     bytes_read += nread;
@@ -173,27 +149,41 @@ static size_t ac_req_json_read_cb(char *ptr, size_t size, size_t nmemb, void *us
     // and pass as first chunk next time
     // NOTE if a string is larger than a chunk this will not work because in that
     // case the JSON lib needs more data to find string boundaries.
-    if (nread < chunksize)
-        strcpy(data->unread_chunk, ptr+nread);
-    else
+    // ptr is not terminated at the end of the slice, so copy no more than the slice
+    if (nread < chunksize) {
+        memcpy(data->unread_chunk, ptr+nread, chunksize-nread);
+        data->unread_chunk[chunksize-nread] = '\0';
+    }
+    else {
         data->unread_chunk[0] = '\0';
+    }
 
     DEBUG("Bytes read: %d, total: %d\n", nread, bytes_read);
-    return chunksize;
+    return 0;
 }
 
-static size_t ac_req_xml_read_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+static size_t ac_req_json_read_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
+    /* Decompressed data can be bigger than CURL_MAX_WRITE_SIZE so data is
+     * passed to the parser in slices that fit in the chunk buffers */
     struct APIUserData *data = userdata;
-    struct PP *pp = data->parser;
-
     size_t chunksize = size * nmemb;
 
-    // This should never happen
-    if (chunksize > API_CLIENT_MAX_RDATA) {
-        ERROR("Chunksize is too big! %ld > %d\n", chunksize, API_CLIENT_MAX_RDATA);
-        return CURLE_WRITE_ERROR;
+    for (size_t offset=0 ; offset<chunksize ; offset+=API_CLIENT_MAX_SLICE) {
+        size_t slice = chunksize - offset;
+        if (slice > API_CLIENT_MAX_SLICE)
+            slice = API_CLIENT_MAX_SLICE;
+
+        if (ac_req_json_parse_slice(data, ptr+offset, slice) < 0)
+            return CURLE_WRITE_ERROR;
     }
+    return chunksize;
+}
+
+static int ac_req_xml_parse_slice(struct APIUserData *data, char *ptr, size_t chunksize)
+{
+    /* Parse one slice of response data, slice fits in chunk buffer */
+    struct PP *pp = data->parser;
 
     /* copy as much data as possible into the 'ptr' buffer, but no more than
      'size' * 'nmemb' bytes! */
@@ -217,7 +207,7 @@ static size_t ac_req_xml_read_cb(char *ptr, size_t size, size_t nmemb, void *use
 
     int nread = pp_parse(pp, chunks, sizeof(chunks)/sizeof(*chunks));
     if (nread < 0)
-        return CURLE_WRITE_ERROR;
+        return -1;
 
     //DEBUG("read: %s\n", data->chunk);
     //bytes_read += nread;
@@ -226,43 +216,342 @@ static size_t ac_req_xml_read_cb(char *ptr, size_t size, size_t nmemb, void *use
     // and pass as first chunk next time
     // NOTE if a string is larger than a chunk this will not work because in that
     // case the JSON lib needs more data to find string boundaries.
-    if (nread < chunksize)
-        strcpy(data->unread_chunk, ptr+nread);
-    else
+    // ptr is not terminated at the end of the slice, so copy no more than the slice
+    if (nread < chunksize) {
+        memcpy(data->unread_chunk, ptr+nread, chunksize-nread);
+        data->unread_chunk[chunksize-nread] = '\0';
+    }
+    else {
         data->unread_chunk[0] = '\0';
+    }
 
     //DEBUG("Bytes read/parsed %ld/%d Bytes\n", nmemb*size, nread);
     //DEBUG("Bytes left: %s\n", data->unread_chunk);
+    return 0;
+}
+
+static size_t ac_req_xml_read_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    /* Decompressed data can be bigger than CURL_MAX_WRITE_SIZE so data is
+     * passed to the parser in slices that fit in the chunk buffers */
+    struct APIUserData *data = userdata;
+    size_t chunksize = size * nmemb;
+    data->hash = hash_update(data->hash, ptr, chunksize);
+    rc_tee_write(&data->tee, ptr, chunksize);
+
+    for (size_t offset=0 ; offset<chunksize ; offset+=API_CLIENT_MAX_SLICE) {
+        size_t slice = chunksize - offset;
+        if (slice > API_CLIENT_MAX_SLICE)
+            slice = API_CLIENT_MAX_SLICE;
+
+        if (ac_req_xml_parse_slice(data, ptr+offset, slice) < 0)
+            return CURLE_WRITE_ERROR;
+    }
     return chunksize;
 }
 
-static enum APIClientReqResult ac_req_get(struct APIClient *client, const char* url, struct APIUserData *user_data,  curl_write_cb write_cb, long *status_code)
+static size_t ac_req_upload_read_cb(char *buffer, size_t size, size_t nitems, void *userdata)
 {
-    CURL *curl = curl_easy_init();
-    if (!curl)
-        return API_CLIENT_REQ_CURL_ERROR;
+    /* Serialize actions until curl's buffer can be filled.
+     * The JSON writer buffer is reused, returning 0 ends the upload */
+    struct APIUploadData *data = userdata;
+    size_t bufsize = size * nitems;
+
+    while (jw_unread(&data->jw) < bufsize && data->naction <= data->nactions) {
+        if (data->naction == data->nactions) {
+            if (jw_array_close(&data->jw) < 0)
+                return CURL_READFUNC_ABORT;
+            data->naction++;
+            break;
+        }
+        if (episode_action_serialize(&data->jw, &data->actions[data->naction++]) < 0)
+            return CURL_READFUNC_ABORT;
+    }
+    return jw_read(&data->jw, buffer, bufsize);
+}
+
+static size_t ac_req_discard_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    /* Ignore response body, prevents curl from writing it to stdout */
+    (void)ptr;
+    (void)userdata;
+    return size * nmemb;
+}
 
-    CURLcode res;
+long ac_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void ac_req_setopt(struct APIClient *client, CURL *curl, const char *url)
+{
+    /* Set options that are shared by all requests */
     if (strlen(client->user) > 0)
         curl_easy_setopt(curl, CURLOPT_USERNAME, client->user);
 
     if (strlen(client->key) > 0)
         curl_easy_setopt(curl, CURLOPT_PASSWORD, client->key);
 
+#ifdef TEST_SERVER
+    if (strlen(client->url_prefix) > 0) {
+        char prefixed[API_CLIENT_MAX_SERVER + PODCAST_MAX_URL + 2];
+        snprintf(prefixed, sizeof(prefixed), "%s/%s", client->url_prefix, url);
+        curl_easy_setopt(curl, CURLOPT_URL, prefixed);
+    }
+    else {
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+    }
+#else
     curl_easy_setopt(curl, CURLOPT_URL, url);
+#endif
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, client->timeout);
 
-    // when reading data 
-    if (user_data != NULL) {
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, user_data);
+    // addresses from previous runs go straight into the shared DNS cache
+    if (client->resolve != NULL)
+        curl_easy_setopt(curl, CURLOPT_RESOLVE, client->resolve);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, client->connect_timeout_ms);
+
+    // abort when less than 1 byte per second is received during idle timeout
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, client->idle_timeout);
+
+    // use HTTP/2 when server supports it, over https only. With the multi interface
+    // all transfers to the same host are multiplexed over one connection.
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+
+    // empty string enables all encodings curl is built with (gzip, deflate, br, zstd)
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(curl, CURLOPT_SHARE, client->share);
+}
+
+int ac_init(struct APIClient *client)
+{
+    /* Setup share object and empty handle pool */
+    client->npool = 0;
+    client->nrequests = 0;
+    client->nreused = 0;
+    client->ncoalesced = 0;
+    client->feed_meta = NULL;
+    client->max_per_host = API_CLIENT_DEFAULT_PER_HOST;
+    client->timeout = API_CLIENT_TIMEOUT;
+    client->connect_timeout_ms = API_CLIENT_CONNECT_TIMEOUT_MS;
+    client->first_byte_timeout_ms = API_CLIENT_FIRST_BYTE_TIMEOUT_MS;
+    client->idle_timeout = API_CLIENT_IDLE_TIMEOUT;
+    client->hedge = 0;
+#ifdef TEST_SERVER
+    client->url_prefix[0] = '\0';
+#endif
+    client->cache = NULL;
+    client->net_cache = NULL;
+    client->resolve = NULL;
+    client->store = NULL;
+
+    client->share = curl_share_init();
+    if (client->share == NULL)
+        return -1;
+
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    return 0;
+}
+
+void ac_cleanup(struct APIClient *client)
+{
+    /* Handles use the share object so they are cleaned up first */
+    for (int i=0 ; i<client->npool ; i++)
+        curl_easy_cleanup(client->pool[i]);
+    client->npool = 0;
+
+    if (client->share != NULL)
+        curl_share_cleanup(client->share);
+    client->share = NULL;
+}
+
+int ac_url_normalize(const char *url, char *buf, size_t size)
+{
+    /* Lowercase scheme and host, remove default port and fragment so aliases of a url compare equal.
+     * Url is copied unchanged when it can't be parsed */
+    char *host = NULL;
+    char *normalized = NULL;
+    int ret = -1;
+    snprintf(buf, size, "%s", url);
+
+    CURLU *h = curl_url();
+    if (h == NULL)
+        return -1;
+
+    if (curl_url_set(h, CURLUPART_URL, url, 0) == CURLUE_OK && curl_url_get(h, CURLUPART_HOST, &host, 0) == CURLUE_OK) {
+        for (char *c=host ; *c!='\0' ; c++)
+            *c = tolower(*c);
+        curl_url_set(h, CURLUPART_HOST, host, 0);
+        curl_url_set(h, CURLUPART_FRAGMENT, NULL, 0);
+
+        if (curl_url_get(h, CURLUPART_URL, &normalized, CURLU_NO_DEFAULT_PORT) == CURLUE_OK && strlen(normalized) < size) {
+            strcpy(buf, normalized);
+            ret = 0;
+        }
     }
+    curl_free(host);
+    curl_free(normalized);
+    curl_url_cleanup(h);
+    return ret;
+}
 
-    res = curl_easy_perform(curl);
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, status_code);
+static const char* ac_url_key(const char *url)
+{
+    /* Url without scheme, so http and https aliases of a feed compare equal */
+    const char *sep = strstr(url, "://");
+    return (sep != NULL) ? sep + 3 : url;
+}
+
+static const char* ac_feed_url(struct APIClient *client, struct Podcast *pod)
+{
+    /* Url a feed is fetched from, feeds that moved permanently are fetched from their new location */
+    struct FeedMeta *meta = (client->feed_meta) ? feed_meta_get(client->feed_meta, pod->url) : NULL;
+    if (meta != NULL && strlen(meta->location) > 0)
+        return meta->location;
+    return pod->url;
+}
+
+static CURL* ac_handle_get(struct APIClient *client)
+{
+    /* Get an idle handle from the pool or create a new one */
+    if (client->npool > 0)
+        return client->pool[--client->npool];
+    return curl_easy_init();
+}
+
+static void ac_host_name(const char *url, char *name, size_t size)
+{
+    /* Get lowercase host part of url, empty string when url can't be parsed */
+    char *host = NULL;
+    name[0] = '\0';
+
+    CURLU *u = curl_url();
+    if (u == NULL)
+        return;
+
+    if (curl_url_set(u, CURLUPART_URL, url, 0) == CURLUE_OK && curl_url_get(u, CURLUPART_HOST, &host, 0) == CURLUE_OK) {
+        size_t i;
+        for (i=0 ; host[i] != '\0' && i<size-1 ; i++)
+            name[i] = tolower(host[i]);
+        name[i] = '\0';
+        curl_free(host);
+    }
+    curl_url_cleanup(u);
+}
+
+static void ac_net_cache_add(struct APIClient *client, CURL *curl)
+{
+    /* Remember address the handle connected to */
+    char *url = NULL;
+    char *ip = NULL;
+    long port = 0;
+    char host[API_CLIENT_MAX_HOST];
+
+    if (curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url) != CURLE_OK || url == NULL)
+        return;
+    if (curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &ip) != CURLE_OK || ip == NULL)
+        return;
+    if (curl_easy_getinfo(curl, CURLINFO_PRIMARY_PORT, &port) != CURLE_OK || port <= 0)
+        return;
+
+    ac_host_name(url, host, sizeof(host));
+    nc_add_address(client->net_cache, host, port, ip, time(NULL));
+}
+
+static void ac_net_cache_forget(struct APIClient *client, CURL *curl)
+{
+    /* Request failed without a response, the address may be stale. Remove it from the cache and from the
+     * shared DNS cache so it is resolved again on retry */
+    char *url = NULL;
+    char *port = NULL;
+    char host[API_CLIENT_MAX_HOST];
+
+    if (curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url) != CURLE_OK || url == NULL)
+        return;
+
+    CURLU *h = curl_url();
+    if (h == NULL)
+        return;
+    if (curl_url_set(h, CURLUPART_URL, url, 0) == CURLUE_OK && curl_url_get(h, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT) == CURLUE_OK) {
+        ac_host_name(url, host, sizeof(host));
+        if (nc_remove_address(client->net_cache, host, atol(port))) {
+            // entries are handled in order, so this undoes the entry that was loaded from cache
+            char entry[API_CLIENT_MAX_HOST + 16];
+            snprintf(entry, sizeof(entry), "-%s:%s", host, port);
+            DEBUG("Forgetting address: %s:%s\n", host, port);
+            struct curl_slist *tmp = curl_slist_append(client->resolve, entry);
+            if (tmp != NULL)
+                client->resolve = tmp;
+        }
+    }
+    curl_free(port);
+    curl_url_cleanup(h);
+}
+
+void ac_net_cache_open(struct APIClient *client, struct NetCache *nc)
+{
+    /* Use addresses and TLS sessions from a previous run, sessions are imported
+     * through a handle that uses the share object */
+    client->net_cache = nc;
+    client->resolve = nc_resolve_list(nc);
+
+    CURL *curl = curl_easy_init();
+    if (curl == NULL)
+        return;
+    curl_easy_setopt(curl, CURLOPT_SHARE, client->share);
+    nc_import_sessions(nc, curl);
     curl_easy_cleanup(curl);
+}
+
+void ac_net_cache_close(struct APIClient *client)
+{
+    /* Copy TLS sessions into cache, addresses were added when handles were put back in pool */
+    if (client->net_cache == NULL)
+        return;
+
+    CURL *curl = curl_easy_init();
+    if (curl != NULL) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, client->share);
+        nc_export_sessions(client->net_cache, curl);
+        curl_easy_cleanup(curl);
+    }
+
+    curl_slist_free_all(client->resolve);
+    client->resolve = NULL;
+    client->net_cache = NULL;
+}
+
+static void ac_handle_put(struct APIClient *client, CURL *curl)
+{
+    /* Count connection reuse and put handle back in pool.
+     * Reset clears options but keeps the handle's caches */
+    long nconnects = 0;
+    if (client->net_cache != NULL)
+        ac_net_cache_add(client, curl);
+
+    if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &nconnects) == CURLE_OK) {
+        client->nrequests++;
+        if (nconnects == 0)
+            client->nreused++;
+    }
+
+    if (client->npool >= API_CLIENT_MAX_POOL) {
+        curl_easy_cleanup(curl);
+        return;
+    }
+    curl_easy_reset(curl);
+    client->pool[client->npool++] = curl;
+}
 
+static enum APIClientReqResult ac_req_result(CURLcode res)
+{
+    /* Translate curl result code to our own result */
     if (res == CURLE_OPERATION_TIMEDOUT) {
         ERROR("Timeout occured\n");
         return API_CLIENT_REQ_CURL_ERROR;
@@ -271,6 +560,10 @@ static enum APIClientReqResult ac_req_get(struct APIClient *client, const char*
     else if (res == CURLE_WRITE_ERROR) {
         return API_CLIENT_REQ_PARSE_ERROR;
     }
+    // checks for serialize error from ac_req_upload_read_cb()
+    else if (res == CURLE_ABORTED_BY_CALLBACK) {
+        return API_CLIENT_REQ_SERIALIZE_ERROR;
+    }
     else if (res != CURLE_OK) {
         ERROR("CURL error: %d\n", res);
         return API_CLIENT_REQ_CURL_ERROR;
@@ -281,56 +574,82 @@ static enum APIClientReqResult ac_req_get(struct APIClient *client, const char*
     return API_CLIENT_REQ_SUCCESS;
 }
 
-static void ac_subscripions_handle_data_cb(struct JSON *json, enum JSONEvent ev, void *user_data)
+static enum APIClientReqResult ac_req_perform(CURL *curl, long *status_code)
 {
-    /* Callback is passed to json lib to handle incoming data.
-     * Data is saved in podcast struct */
-    struct JSONItem *ji = stack_get_from_end(json, 0);
-    struct APIUserData *data = user_data;
-    struct Podcast *pods = data->data;
+    CURLcode res = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, status_code);
+    return ac_req_result(res);
+}
 
-    if (data->npod >= data->data_length) {
-        ERROR("Failed to save podcast data, data limit reached: %d\n", data->data_length);
-        return;
-    }
+static enum APIClientReqResult ac_req_get(struct APIClient *client, const char* url, struct APIUserData *user_data,  curl_write_cb write_cb, long *status_code)
+{
+    CURL *curl = ac_handle_get(client);
+    if (!curl)
+        return API_CLIENT_REQ_CURL_ERROR;
 
-    if (ev == JSON_EV_STRING) {
-        struct JSONItem *ji_prev = stack_get_from_end(json, 1);
-        if (ji_prev != NULL && ji_prev->dtype == JSON_DTYPE_ARRAY) {
-            struct Podcast *pod = &(pods[data->npod]);
-            strcpy(pod->url, ji->data);
-            //DEBUG("Found xml: %s\n", ji->data); 
-            data->npod++;
-        }
+    ac_req_setopt(client, curl, url);
+
+    // when reading data 
+    if (user_data != NULL) {
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, user_data);
     }
+
+    enum APIClientReqResult res = ac_req_perform(curl, status_code);
+    ac_handle_put(client, curl);
+    return res;
 }
 
-enum APIClientReqResult ac_get_subscriptions(struct APIClient *client, struct Podcast *pods, size_t pods_length, size_t *pods_found)
+static enum APIClientReqResult ac_req_post(struct APIClient *client, const char* url, void *read_data, curl_read_cb read_cb, long *status_code)
 {
+    /* POST data that is produced by read_cb.
+     * Size is not known beforehand so curl uses chunked transfer encoding */
+    CURL *curl = ac_handle_get(client);
+    if (!curl)
+        return API_CLIENT_REQ_CURL_ERROR;
+
+    struct curl_slist *headers = curl_slist_append(NULL, "Content-Type: application/json");
+
+    ac_req_setopt(client, curl, url);
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_cb);
+    curl_easy_setopt(curl, CURLOPT_READDATA, read_data);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ac_req_discard_cb);
+
+    enum APIClientReqResult res = ac_req_perform(curl, status_code);
+    ac_handle_put(client, curl);
+    curl_slist_free_all(headers);
+    return res;
+}
+
+enum APIClientReqResult ac_get_subscriptions(struct APIClient *client, long since, struct SubscriptionParser *sp)
+{
+    /* Get subscriptions that were added and removed since timestamp, or all subscriptions when since < 0.
+     * Urls are bound into sp, sp->timestamp holds the cursor for the next request */
     long status_code;
     char url[512] = "";
-    sprintf(url, API_CLIENT_URL_FMT, client->server, API_CLIENT_SUBSCRIPTIONS);
+    char param[128] = "";
 
-    struct APIUserData user_data;
-    struct JSON json = json_init(ac_subscripions_handle_data_cb);
+    sprintf(url, API_CLIENT_URL_FMT, client->server, API_CLIENT_SUBSCRIPTIONS);
 
-    // set data that is passed to our handler callback
-    json.user_data = &user_data;
+    if (since >= 0)
+        sprintf(param, "?since=%ld", since);
 
-    memset(pods, 0, sizeof(struct Podcast) * pods_length);
+    strncat(url, param, sizeof(url)-strlen(url)-1);
 
-    user_data.data = pods;
-    user_data.npod = 0;
-    user_data.data_length = pods_length;
+    struct APIUserData user_data;
+    struct JSON json = json_init(subscription_store_handle_data_cb);
+    json.user_data = sp;
 
     user_data.parser = &json;
     user_data.chunk[0] = '\0';
     user_data.unread_chunk[0] = '\0';
-    *pods_found = 0;
 
-    if (ac_req_get(client, url, &user_data, ac_req_json_read_cb, &status_code) < 0) {
+    enum APIClientReqResult res;
+    if ((res = ac_req_get(client, url, &user_data, ac_req_json_read_cb, &status_code)) < API_CLIENT_REQ_SUCCESS) {
         ERROR("Failed to make request\n");
-        return API_CLIENT_REQ_UNKNOWN_ERROR;
+        return res;
     }
 
     if (status_code == 401) {
@@ -343,43 +662,312 @@ enum APIClientReqResult ac_get_subscriptions(struct APIClient *client, struct Po
         return API_CLIENT_REQ_UNKNOWN_ERROR;
     }
 
-    *pods_found = user_data.npod;
+    // without a timestamp the next sync can't be incremental
+    if (sp->timestamp < 0 || sp->add.overflow || sp->remove.overflow) {
+        ERROR("Failed to parse subscriptions\n");
+        return API_CLIENT_REQ_PARSE_ERROR;
+    }
+
+    // same feed can be subscribed with differently written urls
+    struct JSONBind *binds[2] = { &sp->add, &sp->remove };
+    for (int b=0 ; b<2 ; b++) {
+        struct Podcast *pods = binds[b]->records;
+        for (size_t i=0 ; i<binds[b]->nrecords ; i++) {
+            char normalized[PODCAST_MAX_URL];
+            ac_url_normalize(pods[i].url, normalized, sizeof(normalized));
+            strcpy(pods[i].url, normalized);
+        }
+    }
 
     DEBUG("status_code: %ld\n", status_code);
     return API_CLIENT_REQ_SUCCESS;
 }
 
-enum APIClientReqResult get_episodes(struct APIClient *client, struct Podcast *pod)
+static size_t ac_req_jw_read_cb(char *buffer, size_t size, size_t nitems, void *userdata)
 {
-    struct APIUserData user_data;
+    /* Upload what is in the JSON writer, returning 0 ends the upload */
+    return jw_read(userdata, buffer, size * nitems);
+}
+
+enum APIClientReqResult ac_upload_subscription_changes(struct APIClient *client, struct SubscriptionSet *add, struct SubscriptionSet *remove)
+{
+    /* Upload added and removed subscriptions in one POST request */
+    long status_code;
+    char url[512] = "";
+    sprintf(url, API_CLIENT_URL_FMT, client->server, API_CLIENT_SUBSCRIPTION_CHANGE_CREATE);
+
+    struct JSONWriter jw;
+    if (jw_init(&jw, 0) < 0)
+        return API_CLIENT_REQ_OUT_OF_MEMORY;
+
+    if (jw_object_open(&jw) < 0 ||
+        subscription_set_serialize(&jw, podcast_schema.array_key, add) < 0 ||
+        subscription_set_serialize(&jw, podcast_remove_schema.array_key, remove) < 0 ||
+        jw_object_close(&jw) < 0) {
+        jw_free(&jw);
+        return API_CLIENT_REQ_SERIALIZE_ERROR;
+    }
+
+    enum APIClientReqResult res = ac_req_post(client, url, &jw, ac_req_jw_read_cb, &status_code);
+    jw_free(&jw);
+
+    if (res < API_CLIENT_REQ_SUCCESS) {
+        ERROR("Failed to upload subscription changes\n");
+        return res;
+    }
+
+    if (status_code == 401) {
+        ERROR("Server returned 401, NOT FOUND!\n");
+        return API_CLIENT_REQ_NOTFOUND;
+    }
+
+    if (status_code != 200) {
+        ERROR("Server returned unhandled error, %ld!\n", status_code);
+        return API_CLIENT_REQ_UNKNOWN_ERROR;
+    }
+
+    DEBUG("Uploaded subscription changes: +%ld -%ld\n", add->length, remove->length);
+    return API_CLIENT_REQ_SUCCESS;
+}
+
+static void ac_header_value(char *dest, const char *value, size_t value_size, size_t size)
+{
+    /* Copy header value without leading spaces and trailing CRLF */
+    while (value_size > 0 && *value == ' ') {
+        value++;
+        value_size--;
+    }
+    while (value_size > 0 && (value[value_size-1] == '\n' || value[value_size-1] == '\r' || value[value_size-1] == ' '))
+        value_size--;
+
+    if (value_size >= size)
+        value_size = size - 1;
+    memcpy(dest, value, value_size);
+    dest[value_size] = '\0';
+}
+
+static long ac_retry_after(const char *value)
+{
+    /* Parse Retry-After header, value is either seconds or a HTTP date */
+    char *endptr;
+    long seconds = strtol(value, &endptr, 10);
+    if (endptr != value && *endptr == '\0')
+        return (seconds > 0) ? seconds : 0;
+
+    time_t date = curl_getdate(value, NULL);
+    if (date < 0)
+        return -1;
+
+    time_t now = time(NULL);
+    return (date > now) ? date - now : 0;
+}
+
+static size_t ac_transfer_header_cb(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    /* Save validators from response headers.
+     * On redirects headers of every response are passed, so reset on status line.
+     * A rate limited response is stopped before the body reaches the parser */
+    struct APITransfer *tr = userdata;
+    size_t bufsize = size * nitems;
+
+    if (bufsize > 5 && strncmp(buffer, "HTTP/", 5) == 0) {
+        // hedged request, other transfer already got a response
+        if (!tr->responded && tr->hedge != NULL && tr->hedge->responded) {
+            tr->lost = 1;
+            return 0;
+        }
+        tr->responded = 1;
+        tr->etag[0] = '\0';
+        tr->last_modified[0] = '\0';
+        tr->retry_after = -1;
+        if (sscanf(buffer, "%*s %ld", &tr->status_code) != 1)
+            tr->status_code = 0;
+
+        // curl follows redirects, a temporary one anywhere in the chain means the feed didn't move
+        if (tr->status_code >= 300 && tr->status_code < 400 && tr->status_code != 301 && tr->status_code != 308 && tr->status_code != 304)
+            tr->permanent = 0;
+    }
+    else if (bufsize > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+        ac_header_value(tr->etag, buffer+5, bufsize-5, FEED_META_MAX_ETAG);
+    }
+    else if (bufsize > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0) {
+        ac_header_value(tr->last_modified, buffer+14, bufsize-14, FEED_META_MAX_DATE);
+    }
+    else if (bufsize > 12 && strncasecmp(buffer, "Retry-After:", 12) == 0) {
+        char value[64];
+        ac_header_value(value, buffer+12, bufsize-12, sizeof(value));
+        tr->retry_after = ac_retry_after(value);
+    }
+    else if ((bufsize == 2 && buffer[0] == '\r') || (bufsize == 1 && buffer[0] == '\n')) {
+        if (tr->status_code == 429 || tr->status_code == 503)
+            return 0;
+    }
+    return bufsize;
+}
+
+static int ac_transfer_progress_cb(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    /* Abort transfer when there is no response before the first byte deadline */
+    struct APITransfer *tr = clientp;
+    (void)dltotal; (void)dlnow; (void)ultotal; (void)ulnow;
+
+    if (!tr->responded && ac_now_ms() > tr->deadline_ms) {
+        tr->stalled = 1;
+        return 1;
+    }
+    return 0;
+}
+
+static int ac_transfer_init(struct APIClient *client, struct APITransfer *tr, struct Podcast *pod)
+{
+    /* Setup parser and curl handle for fetching one feed.
+     * tr should not move in memory until transfer is finished because
+     * parser and curl hold pointers into it */
+    memset(&tr->ep, 0, sizeof(struct Episode));
+    tr->ep.podcast = pod;
+    tr->pod = pod;
+    tr->headers = NULL;
+    tr->etag[0] = '\0';
+    tr->last_modified[0] = '\0';
+    tr->status_code = 0;
+    tr->retry_after = -1;
+    tr->start_ms = ac_now_ms();
+    tr->deadline_ms = tr->start_ms + client->first_byte_timeout_ms;
+    tr->responded = 0;
+    tr->stalled = 0;
+    tr->cres = CURLE_OK;
+    tr->hedge = NULL;
+    tr->hedged = 0;
+    tr->lost = 0;
+    tr->permanent = 1;
+    tr->location[0] = '\0';
+    tr->replaced_hash = 0;
 
     // callback will be called on new parsed xml data
-    struct PP pp = pp_xml_init(pp_xml_handle_data_cb);
-    //struct PP pp = pp_xml_init(episodes_handle_data_cb);
+    tr->pp = pp_xml_init(episodes_handle_data_cb);
+    tr->pp.user_data = &tr->user_data;
+
+    tr->user_data.data = &tr->ep;
+    tr->user_data.parser = &tr->pp;
+    tr->user_data.chunk[0] = '\0';
+    tr->user_data.unread_chunk[0] = '\0';
+    tr->user_data.hash = HASH_INIT;
+    tr->user_data.pub_dates.length = 0;
+    rc_tee_init(&tr->user_data.tee);
+    episode_writer_init(&tr->user_data.writer);
+    tr->user_data.store = client->store;
+    es_batch_init(&tr->user_data.batch);
+
+    tr->curl = ac_handle_get(client);
+    if (!tr->curl)
+        return -1;
+
+    if (client->cache != NULL)
+        rc_tee_open(client->cache, &tr->user_data.tee);
+
+    ac_req_setopt(client, tr->curl, ac_feed_url(client, pod));
+    curl_easy_setopt(tr->curl, CURLOPT_WRITEFUNCTION, ac_req_xml_read_cb);
+    curl_easy_setopt(tr->curl, CURLOPT_WRITEDATA, &tr->user_data);
+    curl_easy_setopt(tr->curl, CURLOPT_HEADERFUNCTION, ac_transfer_header_cb);
+    curl_easy_setopt(tr->curl, CURLOPT_HEADERDATA, tr);
+    curl_easy_setopt(tr->curl, CURLOPT_PRIVATE, tr);
+    curl_easy_setopt(tr->curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(tr->curl, CURLOPT_XFERINFOFUNCTION, ac_transfer_progress_cb);
+    curl_easy_setopt(tr->curl, CURLOPT_XFERINFODATA, tr);
+
+    // ask server to only send feed when it changed since last sync
+    struct FeedMeta *meta = (client->feed_meta) ? feed_meta_get(client->feed_meta, pod->url) : NULL;
+    if (meta != NULL) {
+        char header[FEED_META_MAX_ETAG + 32];
+        if (strlen(meta->etag) > 0) {
+            snprintf(header, sizeof(header), "If-None-Match: %s", meta->etag);
+            tr->headers = curl_slist_append(tr->headers, header);
+        }
+        if (strlen(meta->last_modified) > 0) {
+            snprintf(header, sizeof(header), "If-Modified-Since: %s", meta->last_modified);
+            tr->headers = curl_slist_append(tr->headers, header);
+        }
+        curl_easy_setopt(tr->curl, CURLOPT_HTTPHEADER, tr->headers);
+    }
+    return 0;
+}
 
-    pp.user_data = &user_data;
-    struct Episode ep;
-    memset(&ep, 0, sizeof(struct Episode));
-    ep.podcast = pod;
+static void ac_transfer_location(struct APIClient *client, struct APITransfer *tr)
+{
+    /* Remember where the feed was found when it was only redirected permanently */
+    long nredirects = 0;
+    char *url = NULL;
+    if (curl_easy_getinfo(tr->curl, CURLINFO_REDIRECT_COUNT, &nredirects) != CURLE_OK || nredirects == 0 || !tr->permanent)
+        return;
+    if (curl_easy_getinfo(tr->curl, CURLINFO_EFFECTIVE_URL, &url) != CURLE_OK || url == NULL)
+        return;
 
-    user_data.data = &ep;
-    user_data.parser = &pp;
-    user_data.chunk[0] = '\0';
-    user_data.unread_chunk[0] = '\0';
+#ifdef TEST_SERVER
+    // effective url contains the test server prefix, see ac_req_setopt()
+    size_t len = strlen(client->url_prefix);
+    if (len > 0 && strncmp(url, client->url_prefix, len) == 0 && url[len] == '/')
+        url += len + 1;
+#else
+    (void)client;
+#endif
+
+    // curl puts the login in the effective url, see ac_req_setopt()
+    CURLU *h = curl_url();
+    char *stripped = NULL;
+    if (h != NULL && curl_url_set(h, CURLUPART_URL, url, 0) == CURLUE_OK) {
+        curl_url_set(h, CURLUPART_USER, NULL, 0);
+        curl_url_set(h, CURLUPART_PASSWORD, NULL, 0);
+        if (curl_url_get(h, CURLUPART_URL, &stripped, 0) == CURLUE_OK)
+            url = stripped;
+    }
+    ac_url_normalize(url, tr->location, sizeof(tr->location));
+    curl_free(stripped);
+    curl_url_cleanup(h);
+}
 
-    long status_code;
+static enum APIClientReqResult ac_transfer_result(struct APIClient *client, struct APITransfer *tr, CURLcode cres)
+{
+    /* Return curl handle to pool and return result of transfer */
+    long status_code = 0;
+    curl_off_t ttfb = 0;
+    curl_easy_getinfo(tr->curl, CURLINFO_RESPONSE_CODE, &status_code);
+    curl_easy_getinfo(tr->curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+    ac_transfer_location(client, tr);
+    if (cres != CURLE_OK && !tr->responded && client->net_cache != NULL)
+        ac_net_cache_forget(client, tr->curl);
+    ac_handle_put(client, tr->curl);
+    tr->curl = NULL;
+    curl_slist_free_all(tr->headers);
+    tr->headers = NULL;
+    tr->cres = cres;
+    tr->ttfb = ttfb / 1000;
+
+    if (tr->stalled) {
+        ERROR("No response within %ldms: %s\n", tr->deadline_ms - tr->start_ms, tr->pod->url);
+        return API_CLIENT_REQ_CURL_ERROR;
+    }
 
-    enum APIClientReqResult res = ac_req_get(client, pod->url, &user_data, ac_req_xml_read_cb, &status_code);
+    // transfer was stopped by header callback
+    if (tr->status_code == 429 || tr->status_code == 503) {
+        DEBUG("Rate limited (%ld), retry after %lds: %s\n", tr->status_code, tr->retry_after, tr->pod->url);
+        return API_CLIENT_REQ_RATE_LIMITED;
+    }
 
-    if (res == API_CLIENT_REQ_SUCCESS)
-        assert(pp.stack.pos == -1);  // not all tags were parsed
+    enum APIClientReqResult res = ac_req_result(cres);
+    if (res < API_CLIENT_REQ_SUCCESS)
+        return res;
+    tr->status_code = status_code;
 
+    // body is empty, parser was never called
+    if (status_code == 304) {
+        DEBUG("Not modified: %s\n", tr->pod->url);
+        return API_CLIENT_REQ_NOT_MODIFIED;
+    }
 
-    // callback will be called when curl read new data from stream
-    //if (res < 0) {
-    //    ERROR("Failed to make request\n");
-    //    return API_CLIENT_REQ_UNKNOWN_ERROR;
-    //}
+    if (tr->pp.stack.pos != -1) {
+        ERROR("Not all tags were closed: %s\n", tr->pod->url);
+        return API_CLIENT_REQ_PARSE_ERROR;
+    }
 
     if (status_code == 401) {
         ERROR("Server returned 401, NOT FOUND!\n");
@@ -390,22 +978,706 @@ enum APIClientReqResult get_episodes(struct APIClient *client, struct Podcast *p
         ERROR("Server returned unhandled error, %ld!\n", status_code);
         return API_CLIENT_REQ_UNKNOWN_ERROR;
     }
+    return API_CLIENT_REQ_SUCCESS;
+}
+
+static void ac_transfer_update_meta(struct APIClient *client, struct APITransfer *tr, enum APIClientReqResult res)
+{
+    /* Save validators and schedule of response. Only called when the podcast file and new episodes
+     * are written, otherwise the next request would get a 304 for a feed that was never stored */
+    if (client->feed_meta == NULL)
+        return;
+
+    if (res == API_CLIENT_REQ_NOT_MODIFIED) {
+        struct FeedMeta *meta = feed_meta_get(client->feed_meta, tr->pod->url);
+        if (meta != NULL) {
+            feed_meta_update(meta, NULL, 0, time(NULL));
+            feed_meta_update_ttfb(meta, tr->ttfb);
+        }
+        return;
+    }
+
+    // feed is gone from its new location, next sync starts from the subscribed url again
+    if (tr->status_code == 404 || tr->status_code == 410) {
+        struct FeedMeta *meta = feed_meta_get(client->feed_meta, tr->pod->url);
+        if (meta != NULL && strlen(meta->location) > 0) {
+            DEBUG("Forgetting location: %s\n", meta->location);
+            meta->location[0] = '\0';
+        }
+        return;
+    }
+
+    if (res != API_CLIENT_REQ_SUCCESS)
+        return;
+
+    struct FeedMeta *meta = feed_meta_set(client->feed_meta, tr->pod->url);
+    if (meta == NULL)
+        return;
+
+    int changed = meta->hash != tr->user_data.hash;
+    if (!changed) {
+        DEBUG("Feed content didn't change: %s\n", tr->pod->url);
+    }
+    else {
+        tr->replaced_hash = meta->hash;
+    }
+    strcpy(meta->etag, tr->etag);
+    strcpy(meta->last_modified, tr->last_modified);
+    if (feed_meta_set_hash(client->feed_meta, meta, tr->user_data.hash) < 0)
+        ERROR("Failed to count cached body of: %s\n", tr->pod->url);
+    if (strlen(tr->location) > 0 && strcmp(tr->location, tr->pod->url) != 0 && strcmp(tr->location, meta->location) != 0) {
+        DEBUG("Moved permanently: %s -> %s\n", tr->pod->url, tr->location);
+        strcpy(meta->location, tr->location);
+    }
+    feed_meta_update(meta, &tr->user_data.pub_dates, changed, time(NULL));
+    feed_meta_update_ttfb(meta, tr->ttfb);
+}
+
+static int ac_cache_unused(struct APIClient *client, uint64_t hash)
+{
+    /* Bodies are stored once per content, another feed may still point to the same body */
+    if (hash == 0 || client->feed_meta == NULL)
+        return 0;
+    return !feed_meta_hash_used(client->feed_meta, hash);
+}
+
+static enum APIClientReqResult ac_transfer_finish(struct APIClient *client, struct APITransfer *tr, CURLcode cres)
+{
+    /* Get result, podcast file is only replaced, new episodes stored and body kept in cache
+     * when it was parsed successfully. Feed meta is updated last, so a feed that failed to be
+     * written keeps its old validators and is fetched again on next sync */
+    enum APIClientReqResult res = ac_transfer_result(client, tr, cres);
+    if (res != API_CLIENT_REQ_SUCCESS) {
+        episode_writer_abort(&tr->user_data.writer);
+    }
+    else if (episode_writer_commit(&tr->user_data.writer) < 0) {
+        res = API_CLIENT_REQ_ERROR;
+    }
+    else if (tr->user_data.store != NULL && es_batch_commit(tr->user_data.store, &tr->user_data.batch, tr->pod->url) < 0) {
+        ERROR("Failed to store new episodes: %s\n", tr->pod->url);
+        res = API_CLIENT_REQ_ERROR;
+    }
+    es_batch_abort(&tr->user_data.batch);
+
+    ac_transfer_update_meta(client, tr, res);
+
+    if (res == API_CLIENT_REQ_SUCCESS && client->cache != NULL) {
+        if (rc_tee_commit(client->cache, &tr->user_data.tee, tr->user_data.hash) == 0 && ac_cache_unused(client, tr->replaced_hash))
+            rc_remove(client->cache, tr->replaced_hash);
+    }
+    else {
+        rc_tee_abort(&tr->user_data.tee);
+    }
+    return res;
+}
+
+static int ac_transfer_retryable(struct APITransfer *tr)
+{
+    /* Errors that are likely to go away when trying again */
+    if (tr->stalled || tr->status_code == 500 || tr->status_code == 502 || tr->status_code == 504)
+        return 1;
+
+    switch (tr->cres) {
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+enum APIClientReqResult get_episodes(struct APIClient *client, struct Podcast *pod)
+{
+    /* Fetch one feed, transient errors are retried with exponential backoff */
+    struct APITransfer *tr = malloc(sizeof(struct APITransfer));
+    if (tr == NULL)
+        return API_CLIENT_REQ_OUT_OF_MEMORY;
+
+    enum APIClientReqResult res = API_CLIENT_REQ_CURL_ERROR;
+    for (int nretry=0 ; nretry<=API_CLIENT_MAX_RETRIES ; nretry++) {
+        if (nretry > 0) {
+            DEBUG("Retrying in %ds: %s\n", API_CLIENT_RETRY_BACKOFF << (nretry-1), pod->url);
+            sleep(API_CLIENT_RETRY_BACKOFF << (nretry-1));
+        }
+
+        if (ac_transfer_init(client, tr, pod) < 0) {
+            res = API_CLIENT_REQ_CURL_ERROR;
+            break;
+        }
+
+        res = ac_transfer_finish(client, tr, curl_easy_perform(tr->curl));
+        if (res >= API_CLIENT_REQ_SUCCESS || !ac_transfer_retryable(tr))
+            break;
+    }
+    free(tr);
+    return res;
+}
+
+static void ac_sched_push(struct APIScheduler *sched, size_t npod)
+{
+    /* Add pod to the end of its host queue */
+    struct APIHost *h = &sched->hosts[sched->host[npod]];
+    sched->next[npod] = SIZE_MAX;
+
+    if (h->nqueued == 0)
+        h->head = npod;
+    else
+        sched->next[h->tail] = npod;
+    h->tail = npod;
+    h->nqueued++;
+}
+
+static void ac_sched_free(struct APIScheduler *sched)
+{
+    free(sched->hosts);
+    free(sched->host);
+    free(sched->next);
+    free(sched->nretries);
+    free(sched->not_before);
+}
+
+static int ac_sched_init(struct APIScheduler *sched, struct APIClient *client, struct Podcast *pods, size_t npods, const size_t *primary)
+{
+    /* Group pods by host and queue them in original order, only pods that are their own primary are queued */
+    sched->nhosts = 0;
+    sched->max_per_host = (client->max_per_host > 0) ? client->max_per_host : API_CLIENT_DEFAULT_PER_HOST;
+    sched->hosts = malloc(sizeof(struct APIHost) * npods);
+    sched->host = malloc(sizeof(size_t) * npods);
+    sched->next = malloc(sizeof(size_t) * npods);
+    sched->nretries = calloc(npods, sizeof(int));
+    sched->not_before = calloc(npods, sizeof(time_t));
+
+    if (!sched->hosts || !sched->host || !sched->next || !sched->nretries || !sched->not_before) {
+        ac_sched_free(sched);
+        return -1;
+    }
+
+    for (size_t i=0 ; i<npods ; i++) {
+        char name[API_CLIENT_MAX_HOST];
+        ac_host_name(ac_feed_url(client, &pods[i]), name, sizeof(name));
+
+        size_t nhost;
+        for (nhost=0 ; nhost<sched->nhosts ; nhost++) {
+            if (strcmp(sched->hosts[nhost].name, name) == 0)
+                break;
+        }
+
+        if (nhost == sched->nhosts) {
+            struct APIHost *h = &sched->hosts[sched->nhosts++];
+            strcpy(h->name, name);
+            h->nrunning = 0;
+            h->nqueued = 0;
+            h->retry_at = 0;
+        }
+        sched->host[i] = nhost;
+        if (primary[i] == i)
+            ac_sched_push(sched, i);
+    }
+    DEBUG("Scheduling %ld feeds on %ld hosts, max %d per host\n", npods, sched->nhosts, sched->max_per_host);
+    return 0;
+}
+
+static int ac_sched_pop(struct APIScheduler *sched, time_t now, size_t *npod)
+{
+    /* Take next pod from the host with the most queued feeds that may start a transfer.
+     * Serving the longest queue first prevents one big host from being the last one running.
+     * Returns 0 when no host can start a transfer right now */
+    struct APIHost *best = NULL;
+
+    for (size_t i=0 ; i<sched->nhosts ; i++) {
+        struct APIHost *h = &sched->hosts[i];
+        if (h->nqueued == 0 || h->nrunning >= sched->max_per_host || h->retry_at > now || sched->not_before[h->head] > now)
+            continue;
+        if (best == NULL || h->nqueued > best->nqueued || (h->nqueued == best->nqueued && h->nrunning < best->nrunning))
+            best = h;
+    }
+
+    if (best == NULL)
+        return 0;
+
+    *npod = best->head;
+    best->head = sched->next[best->head];
+    best->nqueued--;
+    best->nrunning++;
+    return 1;
+}
+
+static long ac_sched_wait(struct APIScheduler *sched, time_t now)
+{
+    /* Return ms until the first paused host or feed in backoff can start again, -1 if there is none */
+    long wait = -1;
+    for (size_t i=0 ; i<sched->nhosts ; i++) {
+        struct APIHost *h = &sched->hosts[i];
+        if (h->nqueued == 0)
+            continue;
+
+        time_t start = (h->retry_at > sched->not_before[h->head]) ? h->retry_at : sched->not_before[h->head];
+        if (start <= now)
+            continue;
+        if (wait < 0 || (start - now) * 1000 < wait)
+            wait = (start - now) * 1000;
+    }
+    return wait;
+}
+
+static int ac_sched_retry(struct APIScheduler *sched, size_t npod, long retry_after, time_t now)
+{
+    /* Pause host of rate limited pod and queue pod again.
+     * Returns -1 when pod should not be retried */
+    struct APIHost *h = &sched->hosts[sched->host[npod]];
+
+    if (retry_after < 0)
+        retry_after = API_CLIENT_DEFAULT_RETRY_AFTER;
+
+    if (retry_after > API_CLIENT_MAX_RETRY_AFTER || sched->nretries[npod]++ >= API_CLIENT_MAX_RETRIES)
+        return -1;
+
+    if (now + retry_after > h->retry_at) {
+        h->retry_at = now + retry_after;
+        INFO("Host %s is rate limited, pausing for %lds\n", h->name, retry_after);
+    }
+    ac_sched_push(sched, npod);
+    return 0;
+}
+
+static int ac_sched_backoff(struct APIScheduler *sched, size_t npod, time_t now)
+{
+    /* Queue pod again after a transient error, wait time doubles for every retry.
+     * Returns -1 when pod should not be retried */
+    if (sched->nretries[npod] >= API_CLIENT_MAX_RETRIES)
+        return -1;
+
+    long wait = API_CLIENT_RETRY_BACKOFF << sched->nretries[npod]++;
+    sched->not_before[npod] = now + wait;
+    DEBUG("Retry %d in %lds\n", sched->nretries[npod], wait);
+    ac_sched_push(sched, npod);
+    return 0;
+}
+
+static void ac_transfer_cancel(struct APIClient *client, CURLM *multi, struct APITransfer *tr)
+{
+    /* Stop transfer without a result, eg: the hedged request that lost */
+    curl_multi_remove_handle(multi, tr->curl);
+    ac_handle_put(client, tr->curl);
+    tr->curl = NULL;
+    curl_slist_free_all(tr->headers);
+    tr->headers = NULL;
+    tr->hedge = NULL;
+    rc_tee_abort(&tr->user_data.tee);
+    episode_writer_abort(&tr->user_data.writer);
+    es_batch_abort(&tr->user_data.batch);
+}
+
+static struct APITransfer* ac_transfer_hedge(struct APIClient *client, struct APIScheduler *sched, struct APITransfer *slots, int nslots, struct APITransfer *tr)
+{
+    /* Start a second request for the feed of tr when tr has no response after its usual first byte time.
+     * Returns new transfer or NULL */
+    struct APIHost *h = &sched->hosts[sched->host[tr->npod]];
+    if (tr->hedged || tr->responded || h->nrunning >= sched->max_per_host)
+        return NULL;
+
+    long hedge_ms = feed_meta_hedge_ms(feed_meta_get(client->feed_meta, tr->pod->url));
+    if (hedge_ms < 0)
+        return NULL;
+    if (hedge_ms < API_CLIENT_MIN_HEDGE_MS)
+        hedge_ms = API_CLIENT_MIN_HEDGE_MS;
+    if (ac_now_ms() - tr->start_ms < hedge_ms)
+        return NULL;
+
+    for (int i=0 ; i<nslots ; i++) {
+        struct APITransfer *hedge = &slots[i];
+        if (hedge->curl != NULL)
+            continue;
+
+        hedge->npod = tr->npod;
+        if (ac_transfer_init(client, hedge, tr->pod) < 0)
+            return NULL;
+
+        DEBUG("No response after %ldms, hedging: %s\n", hedge_ms, tr->pod->url);
+        tr->hedge = hedge;
+        tr->hedged = 1;
+        hedge->hedge = tr;
+        hedge->hedged = 1;
+        h->nrunning++;
+        return hedge;
+    }
+    return NULL;
+}
+
+static size_t ac_coalesce(struct APIClient *client, struct Podcast *pods, size_t npods, size_t *primary)
+{
+    /* Find feeds that are fetched from the same url, primary[i] is the index of the feed that is
+     * fetched for feed i. Scheme is ignored so http and https aliases are merged, https is preferred.
+     * Returns amount of feeds that don't need their own request */
+    size_t nmerged = 0;
+    for (size_t i=0 ; i<npods ; i++) {
+        const char *url = ac_feed_url(client, &pods[i]);
+        primary[i] = i;
+
+        for (size_t j=0 ; j<i ; j++) {
+            const char *other = ac_feed_url(client, &pods[j]);
+            if (primary[j] != j || strcmp(ac_url_key(url), ac_url_key(other)) != 0)
+                continue;
+
+            if (strncmp(url, "https:", 6) == 0 && strncmp(other, "https:", 6) != 0) {
+                for (size_t k=0 ; k<i ; k++) {
+                    if (primary[k] == j)
+                        primary[k] = i;
+                }
+            }
+            else {
+                primary[i] = j;
+            }
+            DEBUG("Coalescing: %s == %s\n", pods[i].url, pods[j].url);
+            nmerged++;
+            break;
+        }
+    }
+    return nmerged;
+}
+
+long ac_feeds_due(struct APIClient *client, struct Podcast *pods, size_t npods, time_t now)
+{
+    /* Only the feed that is fetched for a group of coalesced subscriptions has feed meta,
+     * so the whole group follows its schedule. Otherwise an alias without meta would always
+     * be due and fetched on its own while the feed isn't due */
+    if (client->feed_meta == NULL || npods == 0)
+        return npods;
+
+    size_t *primary = malloc(sizeof(size_t) * npods);
+    char *due = malloc(npods);
+    if (primary == NULL || due == NULL) {
+        free(primary);
+        free(due);
+        return -1;
+    }
+    ac_coalesce(client, pods, npods, primary);
+
+    for (size_t i=0 ; i<npods ; i++)
+        due[i] = feed_meta_is_due(client->feed_meta, pods[primary[i]].url, now);
+
+    size_t ndue = 0;
+    for (size_t i=0 ; i<npods ; i++) {
+        if (due[i])
+            pods[ndue++] = pods[i];
+    }
+    free(primary);
+    free(due);
+    return ndue;
+}
+
+enum APIClientReqResult ac_sync_episodes(struct APIClient *client, struct Podcast *pods, size_t npods, enum APIClientReqResult *results)
+{
+    /* Fetch and parse all feeds in pods using the curl multi interface.
+     * At most client->max_concurrent transfers are in flight and at most
+     * client->max_per_host transfers per host. A new transfer is started as soon as one finishes.
+     * Rate limited feeds are retried when their host is allowed again.
+     * Result per feed is written to results, returns first error or success */
+    int nslots = client->max_concurrent;
+    if (nslots <= 0)
+        nslots = API_CLIENT_DEFAULT_CONCURRENT;
+    if (nslots > API_CLIENT_MAX_CONCURRENT)
+        nslots = API_CLIENT_MAX_CONCURRENT;
+    if ((size_t)nslots > npods)
+        nslots = npods;
+
+    enum APIClientReqResult ret = API_CLIENT_REQ_SUCCESS;
+    if (npods == 0)
+        return ret;
+
+    // duplicate subscriptions are fetched once and share the result
+    size_t *primary = malloc(sizeof(size_t) * npods);
+    if (primary == NULL)
+        return API_CLIENT_REQ_OUT_OF_MEMORY;
+    client->ncoalesced += ac_coalesce(client, pods, npods, primary);
+
+    struct APIScheduler sched;
+    if (ac_sched_init(&sched, client, pods, npods, primary) < 0) {
+        free(primary);
+        return API_CLIENT_REQ_OUT_OF_MEMORY;
+    }
+
+    struct APITransfer *slots = malloc(sizeof(struct APITransfer) * nslots);
+    if (slots == NULL) {
+        ac_sched_free(&sched);
+        free(primary);
+        return API_CLIENT_REQ_OUT_OF_MEMORY;
+    }
+
+    CURLM *multi = curl_multi_init();
+    if (multi == NULL) {
+        free(slots);
+        ac_sched_free(&sched);
+        free(primary);
+        return API_CLIENT_REQ_CURL_ERROR;
+    }
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    int running = 0;
+
+    // a slot is free when it has no curl handle
+    for (int i=0 ; i<nslots ; i++) {
+        slots[i].curl = NULL;
+    }
+
+    // every pod is either queued, running or has a result
+    for (size_t i=0 ; i<npods ; i++) {
+        results[i] = API_CLIENT_REQ_CURL_ERROR;
+    }
+
+    while (1) {
+        time_t now = time(NULL);
 
-    //DEBUG("status_code: %ld\n", status_code);
-    //return API_CLIENT_REQ_SUCCESS;
+        // start new transfers in free slots
+        for (int i=0 ; i<nslots ; i++) {
+            size_t npod;
+            if (slots[i].curl != NULL)
+                continue;
+            if (!ac_sched_pop(&sched, now, &npod))
+                break;
+
+            slots[i].npod = npod;
+            if (ac_transfer_init(client, &slots[i], &pods[npod]) < 0) {
+                results[npod] = API_CLIENT_REQ_CURL_ERROR;
+                sched.hosts[sched.host[npod]].nrunning--;
+                continue;
+            }
+            DEBUG("Start: %s\n", pods[npod].url);
+            curl_multi_add_handle(multi, slots[i].curl);
+            running++;
+        }
+
+        // wait for transfers, or for a paused host when nothing is running
+        long timeout = ac_sched_wait(&sched, now);
+        if (running == 0 && timeout < 0)
+            break;
+        if (timeout < 0 || timeout > 1000)
+            timeout = 1000;
+
+        // wake up often enough to start hedged requests in time
+        if (client->hedge && client->feed_meta != NULL && timeout > API_CLIENT_MIN_HEDGE_MS / 2)
+            timeout = API_CLIENT_MIN_HEDGE_MS / 2;
+
+        int still_running;
+        CURLMcode mc = curl_multi_perform(multi, &still_running);
+        if (mc == CURLM_OK)
+            mc = curl_multi_poll(multi, NULL, 0, timeout, NULL);
+
+        if (mc != CURLM_OK) {
+            ERROR("CURL multi error: %s\n", curl_multi_strerror(mc));
+            ret = API_CLIENT_REQ_CURL_ERROR;
+            break;
+        }
+
+        for (int i=0 ; i<nslots ; i++) {
+            struct APITransfer *tr = &slots[i];
+            if (tr->curl == NULL)
+                continue;
+
+            // first response of a hedged pair wins, stop the other one
+            if (tr->responded && tr->hedge != NULL && tr->hedge->curl != NULL) {
+                DEBUG("Hedged request lost: %s\n", tr->pod->url);
+                sched.hosts[sched.host[tr->npod]].nrunning--;
+                running--;
+                ac_transfer_cancel(client, multi, tr->hedge);
+                tr->hedge = NULL;
+                continue;
+            }
+
+            if (client->hedge && client->feed_meta != NULL) {
+                struct APITransfer *hedge = ac_transfer_hedge(client, &sched, slots, nslots, tr);
+                if (hedge != NULL) {
+                    curl_multi_add_handle(multi, hedge->curl);
+                    running++;
+                }
+            }
+        }
+
+        CURLMsg *msg;
+        int msgs_left;
+        while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            struct APITransfer *tr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&tr);
+            curl_multi_remove_handle(multi, tr->curl);
+            sched.hosts[sched.host[tr->npod]].nrunning--;
+            running--;
+
+            enum APIClientReqResult res = ac_transfer_finish(client, tr, msg->data.result);
+
+            // hedged pair, result of the transfer without a response doesn't matter while the other runs
+            struct APITransfer *other = tr->hedge;
+            tr->hedge = NULL;
+            if (other != NULL && other->curl != NULL) {
+                if (!tr->responded || tr->lost) {
+                    other->hedge = NULL;
+                    continue;
+                }
+                sched.hosts[sched.host[other->npod]].nrunning--;
+                running--;
+                ac_transfer_cancel(client, multi, other);
+            }
+
+            results[tr->npod] = res;
+            if (res == API_CLIENT_REQ_RATE_LIMITED && ac_sched_retry(&sched, tr->npod, tr->retry_after, time(NULL)) == 0)
+                continue;
+            if (res < API_CLIENT_REQ_SUCCESS && res != API_CLIENT_REQ_RATE_LIMITED && ac_transfer_retryable(tr) && ac_sched_backoff(&sched, tr->npod, time(NULL)) == 0)
+                continue;
+
+            if (results[tr->npod] < API_CLIENT_REQ_SUCCESS && ret == API_CLIENT_REQ_SUCCESS)
+                ret = results[tr->npod];
+        }
+    }
+
+    // only on multi errors, cleanup transfers that are still in flight, queued pods keep their error result
+    for (int i=0 ; i<nslots ; i++) {
+        if (slots[i].curl == NULL)
+            continue;
+        curl_multi_remove_handle(multi, slots[i].curl);
+        ac_handle_put(client, slots[i].curl);
+        curl_slist_free_all(slots[i].headers);
+        rc_tee_abort(&slots[i].user_data.tee);
+        episode_writer_abort(&slots[i].user_data.writer);
+        es_batch_abort(&slots[i].user_data.batch);
+        results[slots[i].npod] = API_CLIENT_REQ_CURL_ERROR;
+    }
+
+    for (size_t i=0 ; i<npods ; i++)
+        results[i] = results[primary[i]];
+
+    curl_multi_cleanup(multi);
+    free(slots);
+    ac_sched_free(&sched);
+    free(primary);
+    return ret;
+}
+
+enum APIClientReqResult ac_reparse_feed(struct APIClient *client, struct Podcast *pod, uint64_t hash)
+{
+    /* Parse a feed body from the response cache without network.
+     * Cached body is mapped and passed to the parser in one call instead of in slices */
+    if (client->cache == NULL)
+        return API_CLIENT_REQ_ERROR;
+
+    struct APITransfer *tr = malloc(sizeof(struct APITransfer));
+    if (tr == NULL)
+        return API_CLIENT_REQ_OUT_OF_MEMORY;
+
+    // callbacks read buffers and state that the network path sets up, see ac_transfer_init()
+    memset(tr, 0, sizeof(struct APITransfer));
+    tr->ep.podcast = pod;
+    tr->pod = pod;
+    tr->pp = pp_xml_init(episodes_handle_data_cb);
+    tr->pp.user_data = &tr->user_data;
+    tr->user_data.data = &tr->ep;
+    tr->user_data.parser = &tr->pp;
+    tr->user_data.pub_dates.length = 0;
+    tr->user_data.hash = HASH_INIT;
+    rc_tee_init(&tr->user_data.tee);
+    episode_writer_init(&tr->user_data.writer);
+    tr->user_data.store = client->store;
+    es_batch_init(&tr->user_data.batch);
+
+    size_t size;
+    char *data = rc_map(client->cache, hash, &size);
+    if (data == NULL) {
+        free(tr);
+        return API_CLIENT_REQ_NOTFOUND;
+    }
+
+    // a truncated or corrupt body would replace the podcast file with part of the episodes
+    size_t err_offset;
+    enum PPValidateResult valid = pp_validate(PP_GRAMMAR_XML, data, size, &err_offset);
+    if (valid != PP_VALIDATE_SUCCESS) {
+        ERROR("Cached feed is %s at %ld, not parsing: %s\n", (valid == PP_VALIDATE_INCOMPLETE) ? "truncated" : "invalid", err_offset, pod->url);
+        rc_unmap(data, size);
+        free(tr);
+        return API_CLIENT_REQ_PARSE_ERROR;
+    }
+
+    // mapping is private so unescaping in place doesn't change the cached file
+    ac_unescape(data);
+
+    enum APIClientReqResult res = API_CLIENT_REQ_SUCCESS;
+    char *chunks[2] = { data, NULL };
+    pp_parse(&tr->pp, chunks, sizeof(chunks)/sizeof(*chunks));
+
+    if (tr->pp.stack.pos != -1) {
+        ERROR("Not all tags were closed: %s\n", pod->url);
+        res = API_CLIENT_REQ_PARSE_ERROR;
+        episode_writer_abort(&tr->user_data.writer);
+    }
+    else if (episode_writer_commit(&tr->user_data.writer) < 0) {
+        res = API_CLIENT_REQ_ERROR;
+    }
+
+    if (res == API_CLIENT_REQ_SUCCESS && tr->user_data.store != NULL &&
+        es_batch_commit(tr->user_data.store, &tr->user_data.batch, pod->url) < 0) {
+        ERROR("Failed to store new episodes: %s\n", pod->url);
+        res = API_CLIENT_REQ_ERROR;
+    }
+    es_batch_abort(&tr->user_data.batch);
+
+    rc_unmap(data, size);
+    free(tr);
     return res;
+}
 
+enum APIClientReqResult ac_upload_actions(struct APIClient *client, struct EpisodeAction *actions, size_t nactions)
+{
+    /* Upload all actions in one POST request */
+    long status_code;
+    char url[512] = "";
+    sprintf(url, API_CLIENT_URL_FMT, client->server, API_CLIENT_EPISODE_ACTION_CREATE);
+
+    struct APIUploadData upload_data;
+    upload_data.actions = actions;
+    upload_data.nactions = nactions;
+    upload_data.naction = 0;
+
+    if (jw_init(&upload_data.jw, 0) < 0)
+        return API_CLIENT_REQ_OUT_OF_MEMORY;
+
+    jw_array_open(&upload_data.jw);
+
+    enum APIClientReqResult res = ac_req_post(client, url, &upload_data, ac_req_upload_read_cb, &status_code);
+    jw_free(&upload_data.jw);
+
+    if (res < API_CLIENT_REQ_SUCCESS) {
+        ERROR("Failed to upload %ld actions\n", nactions);
+        return res;
+    }
+
+    if (status_code == 401) {
+        ERROR("Server returned 401, NOT FOUND!\n");
+        return API_CLIENT_REQ_NOTFOUND;
+    }
+
+    if (status_code != 200) {
+        ERROR("Server returned unhandled error, %ld!\n", status_code);
+        return API_CLIENT_REQ_UNKNOWN_ERROR;
+    }
+
+    DEBUG("Uploaded %ld actions\n", nactions);
+    return API_CLIENT_REQ_SUCCESS;
 }
 
-/*
-enum APIClientReqResult ac_get_actions(struct APIClient *client, time_t since)
+enum APIClientReqResult ac_get_actions(struct APIClient *client, long since, struct ActionParser *ap)
 {
+    /* Get actions newer than since, or full history when since < 0.
+     * Actions are bound into ap, ap->timestamp holds the cursor for the next request */
     long status_code;
     char url[512] = "";
     char param[128] = "";
 
-    json = json_init(json_handle_data_cb);
-
     sprintf(url, API_CLIENT_URL_FMT, client->server, API_CLIENT_EPISODE_ACTION);
 
     if (since >= 0)
@@ -415,13 +1687,16 @@ enum APIClientReqResult ac_get_actions(struct APIClient *client, time_t since)
 
     DEBUG("url: %s\n", url);
 
-    struct APIClientRData rdata;
-    rdata.data[0] = '\0';
-    rdata.unread_data[0] = '\0';
-    rdata.size = 0;
+    struct APIUserData user_data;
+    struct JSON json = json_init(action_store_handle_data_cb);
+    json.user_data = ap;
+
+    user_data.parser = &json;
+    user_data.chunk[0] = '\0';
+    user_data.unread_chunk[0] = '\0';
 
     enum APIClientReqResult res;
-    if ((res = ac_req_get(client, url, &rdata, NULL, &status_code)) < API_CLIENT_REQ_SUCCESS) {
+    if ((res = ac_req_get(client, url, &user_data, ac_req_json_read_cb, &status_code)) < API_CLIENT_REQ_SUCCESS) {
         ERROR("Failed to make request\n");
         return res;
     }
@@ -436,9 +1711,12 @@ enum APIClientReqResult ac_get_actions(struct APIClient *client, time_t since)
         return API_CLIENT_REQ_UNKNOWN_ERROR;
     }
 
+    // without a timestamp the next sync can't be incremental
+    if (ap->timestamp < 0 || ap->bind.overflow) {
+        ERROR("Failed to parse episode actions\n");
+        return API_CLIENT_REQ_PARSE_ERROR;
+    }
+
     DEBUG("status_code: %ld\n", status_code);
-    
     return API_CLIENT_REQ_SUCCESS;
 }
-*/
-
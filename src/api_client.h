@@ -8,33 +8,84 @@
 #include <stdint.h>
 #include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #include <libgen.h>    // basename, dirname
 #include <sys/stat.h>  // mkdir
 #include <errno.h>
+#include <time.h>
 
 #include <curl/curl.h>
 
 //#include "utils.h"
 #include "podcast.h"
+#include "feed_meta.h"
+#include "action_store.h"
+#include "subscription_store.h"
+#include "response_cache.h"
+#include "net_cache.h"
+#include "episode_store.h"
 #include "lib/json/json.h"
+#include "lib/hash/hash.h"
 
 #include "lib/potato_parser/potato_xml.h"
+#include "lib/potato_parser/potato_validate.h"
 
 #include "podcast.h"
 
 #define API_CLIENT_BASE_DIR "test"
 #define API_CLIENT_POD_DIR  "podcasts"
+#define API_CLIENT_FEED_META_PATH API_CLIENT_BASE_DIR "/feeds.tsv"
+#define API_CLIENT_ACTIONS_PATH   API_CLIENT_BASE_DIR "/actions.json"
+#define API_CLIENT_ACTION_QUEUE_PATH API_CLIENT_BASE_DIR "/actions.wal"
+#define API_CLIENT_SUBSCRIPTIONS_PATH API_CLIENT_BASE_DIR "/subscriptions.json"
+#define API_CLIENT_CACHE_DIR      API_CLIENT_BASE_DIR "/cache"
+#define API_CLIENT_NET_CACHE_PATH API_CLIENT_BASE_DIR "/net.tsv"
 
 #define API_CLIENT_MAX_SERVER 64
 #define API_CLIENT_MAX_USER   64
 #define API_CLIENT_MAX_KEY    64
 #define API_CLIENT_MAX_RDATA  17 * 1024
-#define API_CLIENT_MAX_SUBSCRIPTIONS 64
 #define API_CLIENT_MAX_PODCAST 256
 
+// amount of feeds that are fetched at the same time when syncing
+#define API_CLIENT_DEFAULT_CONCURRENT 8
+#define API_CLIENT_MAX_CONCURRENT    64
+
+// feeds on the same host are queued so a single host never gets more than max_per_host transfers
+#define API_CLIENT_DEFAULT_PER_HOST 2
+#define API_CLIENT_MAX_HOST         256
+
+// on 429 and 503 a feed is queued again and its host is paused for the time in Retry-After.
+// Longer waits are not worth it for a sync, the feed fails instead
+#define API_CLIENT_MAX_RETRIES       3
+#define API_CLIENT_DEFAULT_RETRY_AFTER 5
+#define API_CLIENT_MAX_RETRY_AFTER   120
+
+// Overall timeout in seconds per request. The deadlines below catch stalled requests, this only
+// bounds a transfer that keeps trickling data, eg: a huge feed on a slow server
+#define API_CLIENT_TIMEOUT 100
+
+// Deadlines per request, a stalled request fails fast instead of waiting for the overall timeout.
+// Idle is the time no data is received while transferring
+#define API_CLIENT_CONNECT_TIMEOUT_MS    5000
+#define API_CLIENT_FIRST_BYTE_TIMEOUT_MS 10000
+#define API_CLIENT_IDLE_TIMEOUT          15
+
+// Transient errors are retried after API_CLIENT_RETRY_BACKOFF seconds, doubled for every retry
+#define API_CLIENT_RETRY_BACKOFF 1
+
+// A second request for a feed is started when the first gets no response within its usual
+// first byte time plus 4 deviations, see feed_meta_update_ttfb()
+#define API_CLIENT_MIN_HEDGE_MS 250
+
+// amount of idle curl easy handles that are kept around for reuse
+#define API_CLIENT_MAX_POOL API_CLIENT_MAX_CONCURRENT
+
 #define API_CLIENT_URL_FMT    "%s/index.php/apps/gpoddersync/%s"
 #define API_CLIENT_SUBSCRIPTIONS "subscriptions"
+#define API_CLIENT_SUBSCRIPTION_CHANGE_CREATE "subscription_change/create"
 #define API_CLIENT_EPISODE_ACTION "episode_action"
+#define API_CLIENT_EPISODE_ACTION_CREATE "episode_action/create"
 
 
 #define API_CLIENT_SANITIZE_REMOVE_CHARS "\t\r\n'\"/\\<>"
@@ -43,11 +94,16 @@
 
 #define JSON_READ_CHUNK_SIZE CURL_MAX_WRITE_SIZE
 
+// write callbacks pass data to parsers in slices of this size.
+// Decompressed data isn't limited by CURL_MAX_WRITE_SIZE
+#define API_CLIENT_MAX_SLICE CURL_MAX_WRITE_SIZE
+
 extern int do_debug;
 extern int do_info;
 extern int do_error;
 
 typedef size_t(*curl_write_cb)(char*, size_t, size_t, void*);
+typedef size_t(*curl_read_cb)(char*, size_t, size_t, void*);
 
 enum APIClientReqResult {
     API_CLIENT_REQ_OUT_OF_MEMORY,
@@ -57,7 +113,11 @@ enum APIClientReqResult {
     API_CLIENT_REQ_CURL_ERROR,
     API_CLIENT_REQ_UNKNOWN_ERROR,
     API_CLIENT_REQ_NOTFOUND,
-    API_CLIENT_REQ_SUCCESS
+    API_CLIENT_REQ_RATE_LIMITED,
+    API_CLIENT_REQ_SUCCESS,
+
+    // not an error, server returned 304 so there was nothing to parse
+    API_CLIENT_REQ_NOT_MODIFIED
 };
 
 struct APIClientRData {
@@ -79,7 +139,52 @@ struct APIClient {
     char key[API_CLIENT_MAX_KEY];
     int  port;
 
+    // overall timeout in seconds and deadlines, see API_CLIENT_*_TIMEOUT
     long  timeout;
+    long  connect_timeout_ms;
+    long  first_byte_timeout_ms;
+    long  idle_timeout;
+
+    // start hedged requests for feeds that are slower than usual
+    int   hedge;
+
+    // max amount of transfers in flight, see ac_sync_episodes()
+    int  max_concurrent;
+    int  max_per_host;
+
+    // DNS cache, TLS sessions and connections are shared between all handles
+    CURLSH *share;
+
+    // idle easy handles, see ac_handle_get() and ac_handle_put()
+    CURL *pool[API_CLIENT_MAX_POOL];
+    int   npool;
+
+    // finished transfers and transfers that didn't need a new connection
+    long  nrequests;
+    long  nreused;
+
+    // feeds that were not fetched because another subscription has the same url, see ac_sync_episodes()
+    long  ncoalesced;
+
+    // validators for conditional feed requests, NULL disables conditional requests
+    struct FeedMetaStore *feed_meta;
+
+#ifdef TEST_SERVER
+    // when set, every request goes to url_prefix + "/" + url, eg: to record or replay a session
+    // with the test server, see test_server.h
+    char url_prefix[API_CLIENT_MAX_SERVER];
+#endif
+
+    // feed bodies are written to cache while they are parsed, NULL disables caching.
+    // Cached feeds can be parsed again with ac_reparse_feed()
+    struct ResponseCache *cache;
+
+    // addresses and TLS sessions of previous runs, NULL disables, see ac_net_cache_open()
+    struct NetCache *net_cache;
+    struct curl_slist *resolve;
+
+    // new episodes of a feed are appended to store when its transfer succeeded, NULL disables
+    struct EpisodeStore *store;
 };
 
 // Is passed to curl callback as user data.
@@ -98,13 +203,131 @@ struct APIUserData {
     // holds current chunk and unread data from previous chunk
     char chunk[API_CLIENT_MAX_RDATA+1];
     char unread_chunk[API_CLIENT_MAX_RDATA+1];
+
+    // hash of received body, updated for every chunk
+    uint64_t hash;
+
+    // item publication dates, used to learn the poll schedule of a feed
+    struct FeedPubDates pub_dates;
+
+    // raw body is written to response cache, see APIClient.cache
+    struct RCTee tee;
+
+    // episodes are written to podcast file of the feed while parsing
+    struct EpisodeWriter writer;
+
+    // see APIClient.store, known episodes are dropped from batch while parsing
+    struct EpisodeStore *store;
+    struct ESBatch batch;
+};
+
+// State of one feed transfer.
+// Every transfer has its own parser and buffers so feeds can be parsed while
+// other transfers are still receiving data.
+struct APITransfer {
+    CURL *curl;
+    struct Podcast *pod;
+    struct Episode ep;
+    struct PP pp;
+    struct APIUserData user_data;
+
+    // index in pods array passed to ac_sync_episodes()
+    size_t npod;
+
+    // conditional request headers and validators from response
+    struct curl_slist *headers;
+    char etag[FEED_META_MAX_ETAG];
+    char last_modified[FEED_META_MAX_DATE];
+
+    // status of last response and seconds from Retry-After header, -1 if not sent
+    long status_code;
+    long retry_after;
+
+    // all redirects were permanent (301 or 308) and the url the feed was found at
+    int  permanent;
+    char location[PODCAST_MAX_URL];
+
+    // time until first byte of response in ms
+    long ttfb;
+
+    // start of transfer and first byte deadline in ms, response received and deadline passed
+    long start_ms;
+    long deadline_ms;
+    int  responded;
+    int  stalled;
+    CURLcode cres;
+
+    // cached body of the previous response when the body changed, removed when the new one is cached
+    uint64_t replaced_hash;
+
+    // other transfer of same feed when request is hedged, the first one to respond wins
+    struct APITransfer *hedge;
+    int  hedged;
+    int  lost;
+};
+
+// Feeds on one host waiting to be fetched, see ac_sync_episodes()
+struct APIHost {
+    char name[API_CLIENT_MAX_HOST];
+    int nrunning;
+
+    // queue of indexes in pods array, linked by APIScheduler.next
+    size_t head;
+    size_t tail;
+    size_t nqueued;
+
+    // no new transfers are started before this time
+    time_t retry_at;
 };
 
+struct APIScheduler {
+    struct APIHost *hosts;
+    size_t nhosts;
 
+    // per pod: host index, next pod in host queue, amount of retries and backoff time
+    size_t *host;
+    size_t *next;
+    int *nretries;
+    time_t *not_before;
+
+    int max_per_host;
+};
 
-enum APIClientReqResult ac_get_subscriptions(struct APIClient *client, struct Podcast *pods, size_t pods_length, size_t *pods_found);
-enum APIClientReqResult ac_get_actions(struct APIClient *client, time_t since);
+// Is passed to curl read callback when uploading episode actions.
+// Actions are serialized on demand while curl is sending, so memory usage doesn't
+// depend on the amount of actions that are uploaded.
+struct APIUploadData {
+    struct EpisodeAction *actions;
+    size_t nactions;
+
+    // index of next action to serialize
+    size_t naction;
+
+    struct JSONWriter jw;
+};
+
+
+
+int ac_init(struct APIClient *client);
+void ac_cleanup(struct APIClient *client);
+int ac_url_normalize(const char *url, char *buf, size_t size);
+
+// Monotonic clock in ms, for deadlines and timing
+long ac_now_ms();
+void ac_net_cache_open(struct APIClient *client, struct NetCache *nc);
+void ac_net_cache_close(struct APIClient *client);
+
+enum APIClientReqResult ac_get_subscriptions(struct APIClient *client, long since, struct SubscriptionParser *sp);
+enum APIClientReqResult ac_upload_subscription_changes(struct APIClient *client, struct SubscriptionSet *add, struct SubscriptionSet *remove);
+enum APIClientReqResult ac_get_actions(struct APIClient *client, long since, struct ActionParser *ap);
 enum APIClientReqResult get_episodes(struct APIClient *client, struct Podcast *pod);
+enum APIClientReqResult ac_sync_episodes(struct APIClient *client, struct Podcast *pods, size_t npods, enum APIClientReqResult *results);
+
+// Keep feeds that are due in pods, subscriptions that are fetched from the same url are due
+// together. Returns amount of feeds left or -1 on error
+long ac_feeds_due(struct APIClient *client, struct Podcast *pods, size_t npods, time_t now);
+enum APIClientReqResult ac_reparse_feed(struct APIClient *client, struct Podcast *pod, uint64_t hash);
+enum APIClientReqResult ac_upload_actions(struct APIClient *client, struct EpisodeAction *actions, size_t nactions);
 
 
 #endif
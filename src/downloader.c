@@ -0,0 +1,717 @@
+#define _GNU_SOURCE     // fallocate
+#include "downloader.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define INFO(M, ...) if(do_info){fprintf(stdout, M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+
+int dl_init(struct Downloader *dl, int max_concurrent, int nsegments)
+{
+    dl->njobs = 0;
+    dl->max_jobs = DL_INIT_JOBS;
+    dl->max_concurrent = (max_concurrent > 0) ? max_concurrent : DL_DEFAULT_CONCURRENT;
+    if (dl->max_concurrent > DL_MAX_CONCURRENT)
+        dl->max_concurrent = DL_MAX_CONCURRENT;
+    dl->connect_timeout = 30L;
+    dl->share = NULL;
+    dl->nsegments = (nsegments > 0) ? nsegments : 1;
+    if (dl->nsegments > DL_MAX_SEGMENTS)
+        dl->nsegments = DL_MAX_SEGMENTS;
+
+    dl->jobs = malloc(sizeof(struct DLJob) * dl->max_jobs);
+    if (dl->jobs == NULL) {
+        ERROR("Failed to allocate download jobs\n");
+        return -1;
+    }
+    return 0;
+}
+
+void dl_free(struct Downloader *dl)
+{
+    free(dl->jobs);
+    dl->jobs = NULL;
+    dl->njobs = 0;
+    dl->max_jobs = 0;
+}
+
+int dl_add(struct Downloader *dl, const char *url, const char *path)
+{
+    if (strlen(url) >= PODCAST_MAX_URL || strlen(path) + strlen(DL_PART_EXT) >= DL_MAX_PATH) {
+        ERROR("Failed to add download, url or path too long: %s\n", url);
+        return -1;
+    }
+
+    if (dl->njobs >= dl->max_jobs) {
+        struct DLJob *tmp = realloc(dl->jobs, sizeof(struct DLJob) * dl->max_jobs * 2);
+        if (tmp == NULL) {
+            ERROR("Failed to grow download jobs to %ld\n", dl->max_jobs * 2);
+            return -1;
+        }
+        dl->jobs = tmp;
+        dl->max_jobs *= 2;
+    }
+
+    struct DLJob *job = &dl->jobs[dl->njobs++];
+    memset(job, 0, sizeof(struct DLJob));
+    strcpy(job->url, url);
+    strcpy(job->path, path);
+    job->result = DL_RESULT_PENDING;
+    job->size = -1;
+    job->fd = -1;
+    return 0;
+}
+
+static int dl_mkdirs(const char *path)
+{
+    /* Create all parent directories of path */
+    char buf[DL_MAX_PATH];
+    strncpy(buf, path, sizeof(buf)-1);
+    buf[sizeof(buf)-1] = '\0';
+
+    for (char *c=buf+1 ; *c != '\0' ; c++) {
+        if (*c != '/')
+            continue;
+        *c = '\0';
+        if (mkdir(buf, 0755) < 0 && errno != EEXIST) {
+            ERROR("Failed to create dir: %s\n", buf);
+            return -1;
+        }
+        *c = '/';
+    }
+    return 0;
+}
+
+static int dl_flush(struct DLTransfer *tr)
+{
+    /* Write block to file and start a new block at the next offset */
+    size_t written = 0;
+    while (written < tr->block_len) {
+        ssize_t n = pwrite(tr->job->fd, tr->block + written, tr->block_len - written, tr->offset + written);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ERROR("Failed to write to: %s: %s\n", tr->job->path, strerror(errno));
+            return -1;
+        }
+        written += n;
+    }
+    tr->offset += tr->block_len;
+    tr->block_len = 0;
+    return 0;
+}
+
+static int dl_content_range(CURL *curl, curl_off_t *start, curl_off_t *size)
+{
+    /* Parse Content-Range header, eg: "bytes 100-199/1000". A 416 response only has
+     * the size with a '*' for the range. start or size is -1 when it isn't in the header */
+    struct curl_header *h;
+    *start = -1;
+    *size = -1;
+
+    if (curl_easy_header(curl, "Content-Range", 0, CURLH_HEADER, -1, &h) != CURLHE_OK || strncmp(h->value, "bytes ", 6) != 0)
+        return -1;
+
+    char *c = h->value + 6;
+    if (*c != '*')
+        *start = strtoll(c, NULL, 10);
+
+    c = strchr(c, '/');
+    if (c != NULL && *(c+1) != '*')
+        *size = strtoll(c+1, NULL, 10);
+    return 0;
+}
+
+static int dl_transfer_start(struct DLTransfer *tr)
+{
+    /* Called on first data of a transfer. Ranged transfers must get the range they asked
+     * for, curl doesn't fail when a server answers with the whole file.
+     * For the transfer that opened the file, preallocate file when size is known and check
+     * if file can be split in segments */
+    struct DLJob *job = tr->job;
+    curl_off_t length = -1;
+    long status_code = 0;
+    struct curl_header *h;
+    tr->started = 1;
+
+    curl_easy_getinfo(tr->curl, CURLINFO_RESPONSE_CODE, &status_code);
+    if (tr->start > 0 || tr->end >= 0) {
+        curl_off_t range_start, size;
+        if (status_code != 206 || dl_content_range(tr->curl, &range_start, &size) < 0 || range_start != tr->start) {
+            DEBUG("Server didn't send range at %ld, status %ld: %s\n", tr->start, status_code, job->url);
+            tr->range_error = 1;
+            return -1;
+        }
+    }
+
+    // segments write their own range, file is already preallocated
+    if (tr->start != job->resumed || tr->end >= 0)
+        return 0;
+
+    curl_easy_getinfo(tr->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+    if (length <= 0)
+        return 0;
+
+    job->size = tr->start + length;
+
+    // keep file size so size of part file still tells how much data is written
+    if (fallocate(job->fd, FALLOC_FL_KEEP_SIZE, tr->start, length) < 0 && errno != EOPNOTSUPP)
+        DEBUG("Failed to preallocate %ld bytes for: %s\n", length, job->path);
+
+    // a partial response or Accept-Ranges header means we can request ranges
+    if (!job->no_ranges && (status_code == 206 ||
+        (curl_easy_header(tr->curl, "Accept-Ranges", 0, CURLH_HEADER, -1, &h) == CURLHE_OK && strcmp(h->value, "bytes") == 0)))
+        job->want_split = 1;
+    return 0;
+}
+
+static size_t dl_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    /* Checksum data and copy into block, write block when full.
+     * Transfer is stopped when the end of its range is reached */
+    struct DLTransfer *tr = userdata;
+    size_t chunksize = size * nmemb;
+    size_t copied = 0;
+
+    // returning 0 stops the transfer before anything is written
+    if (!tr->started && dl_transfer_start(tr) < 0)
+        return 0;
+
+    curl_off_t pos = tr->offset + tr->block_len;
+    size_t n_range = chunksize;
+    if (tr->end >= 0 && pos + (curl_off_t)chunksize >= tr->end) {
+        n_range = (pos < tr->end) ? tr->end - pos : 0;
+        tr->reached_end = 1;
+    }
+
+    tr->crc = crc32_update(tr->crc, ptr, n_range);
+
+    while (copied < n_range) {
+        size_t n = DL_BLOCK_SIZE - tr->block_len;
+        if (n > n_range - copied)
+            n = n_range - copied;
+
+        memcpy(tr->block + tr->block_len, ptr + copied, n);
+        tr->block_len += n;
+        copied += n;
+
+        // returning 0 makes curl fail the transfer with CURLE_WRITE_ERROR
+        if (tr->block_len == DL_BLOCK_SIZE && dl_flush(tr) < 0) {
+            tr->write_error = 1;
+            return 0;
+        }
+    }
+
+    // returning less than chunksize stops the transfer
+    if (tr->reached_end)
+        return (n_range < chunksize) ? n_range : chunksize;
+    return chunksize;
+}
+
+static int dl_part_checksum(struct DLTransfer *tr, curl_off_t size)
+{
+    /* Checksum data that is already in part file, only happens once when resuming */
+    struct DLJob *job = tr->job;
+    curl_off_t offset = 0;
+    uint32_t crc = CRC32_INIT;
+
+    while (offset < size) {
+        size_t n = (size - offset > DL_BLOCK_SIZE) ? DL_BLOCK_SIZE : size - offset;
+        ssize_t nread = pread(job->fd, tr->block, n, offset);
+        if (nread <= 0) {
+            ERROR("Failed to read part file: %s\n", job->path);
+            return -1;
+        }
+        crc = crc32_update(crc, tr->block, nread);
+        offset += nread;
+    }
+
+    if (size > 0) {
+        job->pieces[0].start = 0;
+        job->pieces[0].length = size;
+        job->pieces[0].crc = crc32_final(crc);
+        job->npieces = 1;
+    }
+    return 0;
+}
+
+static int dl_transfer_setup(struct Downloader *dl, struct DLTransfer *tr, struct DLJob *job, curl_off_t start, curl_off_t end)
+{
+    /* Setup curl handle for range start-end of job, end -1 is until end of file */
+    tr->job = job;
+    tr->start = start;
+    tr->end = end;
+    tr->offset = start;
+    tr->crc = CRC32_INIT;
+    tr->block_len = 0;
+    tr->started = 0;
+    tr->write_error = 0;
+    tr->range_error = 0;
+    tr->reached_end = 0;
+
+    if (tr->block == NULL && posix_memalign((void**)&tr->block, DL_ALIGN, DL_BLOCK_SIZE) != 0) {
+        ERROR("Failed to allocate block buffer\n");
+        tr->block = NULL;
+        return -1;
+    }
+
+    tr->curl = curl_easy_init();
+    if (tr->curl == NULL)
+        return -1;
+
+    curl_easy_setopt(tr->curl, CURLOPT_URL, job->url);
+    curl_easy_setopt(tr->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(tr->curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(tr->curl, CURLOPT_CONNECTTIMEOUT, dl->connect_timeout);
+    curl_easy_setopt(tr->curl, CURLOPT_WRITEFUNCTION, dl_write_cb);
+    curl_easy_setopt(tr->curl, CURLOPT_WRITEDATA, tr);
+    curl_easy_setopt(tr->curl, CURLOPT_PRIVATE, tr);
+    if (dl->share != NULL)
+        curl_easy_setopt(tr->curl, CURLOPT_SHARE, dl->share);
+
+    if (end >= 0) {
+        char range[64];
+        snprintf(range, sizeof(range), "%ld-%ld", start, end - 1);
+        curl_easy_setopt(tr->curl, CURLOPT_RANGE, range);
+    }
+    else if (start > 0) {
+        curl_easy_setopt(tr->curl, CURLOPT_RESUME_FROM_LARGE, start);
+    }
+
+    job->ntransfers++;
+    return 0;
+}
+
+static int dl_job_open(struct Downloader *dl, struct DLTransfer *tr, struct DLJob *job)
+{
+    /* Open part file and start first transfer, resume when part file exists.
+     * Returns 1 when there is nothing to download, result of job is set then */
+    char part_path[DL_MAX_PATH + sizeof(DL_PART_EXT)];
+    struct stat st;
+
+    job->npieces = 0;
+    job->ntransfers = 0;
+    job->failed = 0;
+    job->want_split = 0;
+    job->segmented = 0;
+
+    if (stat(job->path, &st) == 0) {
+        job->result = DL_RESULT_EXISTS;
+        return 1;
+    }
+
+    if (dl_mkdirs(job->path) < 0)
+        return -1;
+
+    if (tr->block == NULL && posix_memalign((void**)&tr->block, DL_ALIGN, DL_BLOCK_SIZE) != 0) {
+        ERROR("Failed to allocate block buffer\n");
+        tr->block = NULL;
+        return -1;
+    }
+
+    snprintf(part_path, sizeof(part_path), "%s%s", job->path, DL_PART_EXT);
+    job->fd = open(part_path, O_RDWR | O_CREAT, 0644);
+    if (job->fd < 0 || fstat(job->fd, &st) < 0) {
+        ERROR("Failed to open: %s: %s\n", part_path, strerror(errno));
+        return -1;
+    }
+
+    // cut back to aligned size so all block writes are aligned
+    curl_off_t offset = (job->restarted) ? 0 : st.st_size & ~((curl_off_t)DL_ALIGN - 1);
+
+    // interrupted segmented download, data in part file is not contiguous
+    char seg_path[DL_MAX_PATH + sizeof(DL_SEG_EXT)];
+    snprintf(seg_path, sizeof(seg_path), "%s%s", job->path, DL_SEG_EXT);
+    if (unlink(seg_path) == 0) {
+        DEBUG("Part file has holes, restarting: %s\n", job->url);
+        offset = 0;
+    }
+
+    tr->job = job;
+    if (ftruncate(job->fd, offset) < 0 || dl_part_checksum(tr, offset) < 0 || dl_transfer_setup(dl, tr, job, offset, -1) < 0) {
+        close(job->fd);
+        job->fd = -1;
+        return -1;
+    }
+    job->resumed = offset;
+
+    if (offset > 0)
+        DEBUG("Resuming at %ld: %s\n", offset, job->url);
+    return 0;
+}
+
+static int dl_piece_cmp(const void *a, const void *b)
+{
+    const struct DLPiece *pa = a;
+    const struct DLPiece *pb = b;
+    return (pa->start > pb->start) - (pa->start < pb->start);
+}
+
+static curl_off_t dl_job_combine(struct DLJob *job, uint32_t *crc)
+{
+    /* Sort pieces and combine checksums of the contiguous data from the start of the file.
+     * Returns length of contiguous data */
+    curl_off_t length = 0;
+    *crc = 0;
+
+    qsort(job->pieces, job->npieces, sizeof(struct DLPiece), dl_piece_cmp);
+
+    for (int i=0 ; i<job->npieces ; i++) {
+        if (job->pieces[i].start != length)
+            break;
+        *crc = crc32_combine(*crc, job->pieces[i].crc, job->pieces[i].length);
+        length += job->pieces[i].length;
+    }
+    return length;
+}
+
+static void dl_job_finish(struct DLJob *job)
+{
+    /* All transfers are done, move part file into place.
+     * On failure the part file is cut back to the data that can be resumed */
+    char part_path[DL_MAX_PATH + sizeof(DL_PART_EXT)];
+    snprintf(part_path, sizeof(part_path), "%s%s", job->path, DL_PART_EXT);
+
+    uint32_t crc;
+    curl_off_t length = dl_job_combine(job, &crc);
+
+    if (!job->failed && job->size >= 0 && length != job->size) {
+        ERROR("Failed to download: %s: size mismatch %ld != %ld\n", job->url, length, job->size);
+        job->failed = 1;
+    }
+
+    if (job->failed) {
+        if (ftruncate(job->fd, length & ~((curl_off_t)DL_ALIGN - 1)) < 0)
+            ERROR("Failed to truncate part file: %s\n", part_path);
+        job->result = DL_RESULT_ERROR;
+    }
+    else if (rename(part_path, job->path) < 0) {
+        ERROR("Failed to rename: %s\n", part_path);
+        job->result = DL_RESULT_ERROR;
+    }
+    else {
+        job->size = length;
+        job->crc = crc;
+        job->result = DL_RESULT_SUCCESS;
+    }
+
+    if (job->segmented) {
+        char seg_path[DL_MAX_PATH + sizeof(DL_SEG_EXT)];
+        snprintf(seg_path, sizeof(seg_path), "%s%s", job->path, DL_SEG_EXT);
+        unlink(seg_path);
+    }
+
+    close(job->fd);
+    job->fd = -1;
+}
+
+static int dl_job_mark_segmented(struct DLJob *job)
+{
+    /* Create marker file so an interrupted download isn't resumed from a part file with holes */
+    char seg_path[DL_MAX_PATH + sizeof(DL_SEG_EXT)];
+    snprintf(seg_path, sizeof(seg_path), "%s%s", job->path, DL_SEG_EXT);
+
+    int fd = open(seg_path, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        ERROR("Failed to create: %s: %s\n", seg_path, strerror(errno));
+        return -1;
+    }
+    close(fd);
+    job->segmented = 1;
+    return 0;
+}
+
+static int dl_transfer_finish(struct DLTransfer *tr, CURLcode res)
+{
+    /* Flush last block and save range as a piece of the file.
+     * Returns 1 when the job should be restarted from the beginning in one stream,
+     * the other transfers of the job must be cancelled then, see dl_job_cancel() */
+    struct DLJob *job = tr->job;
+    long status_code = 0;
+    curl_off_t range_start, size;
+
+    curl_easy_getinfo(tr->curl, CURLINFO_RESPONSE_CODE, &status_code);
+
+    // part file already holds the whole file, range starts at the end of the file
+    if (status_code == 416 && tr->start == job->resumed && tr->start > 0 && tr->end < 0 &&
+        dl_content_range(tr->curl, &range_start, &size) == 0 && size == tr->start) {
+        DEBUG("Part file is complete: %s\n", job->url);
+        job->size = size;
+        res = CURLE_OK;
+    }
+    curl_easy_cleanup(tr->curl);
+    tr->curl = NULL;
+    job->ntransfers--;
+
+    // write callback stopped transfer at end of range
+    if (tr->reached_end && res == CURLE_WRITE_ERROR && !tr->write_error)
+        res = CURLE_OK;
+
+    // also on errors, so received data is kept for resuming
+    if (dl_flush(tr) < 0 && res == CURLE_OK)
+        res = CURLE_WRITE_ERROR;
+
+    if (tr->offset > tr->start) {
+        if (job->npieces < DL_MAX_PIECES) {
+            struct DLPiece *p = &job->pieces[job->npieces++];
+            p->start = tr->start;
+            p->length = tr->offset - tr->start;
+            p->crc = crc32_final(tr->crc);
+        }
+        else {
+            job->failed = 1;
+        }
+    }
+
+    // range didn't end up where it should, eg: server sent less
+    if (res == CURLE_OK && tr->end >= 0 && tr->offset != tr->end)
+        res = CURLE_PARTIAL_FILE;
+
+    // server ignored range, download whole file in one stream
+    if (tr->range_error && !job->no_ranges) {
+        DEBUG("Server ignored range request, restarting without ranges: %s\n", job->url);
+        job->restarted = 1;
+        job->no_ranges = 1;
+        return 1;
+    }
+
+    // part file is bigger than remote file
+    if (res != CURLE_OK && job->resumed > 0 && !job->restarted && tr->start == job->resumed && tr->end < 0 &&
+        (res == CURLE_RANGE_ERROR || status_code == 416)) {
+        DEBUG("Can't resume, restarting: %s\n", job->url);
+        job->restarted = 1;
+        job->no_ranges = (res == CURLE_RANGE_ERROR);
+        return 1;
+    }
+
+    if (res != CURLE_OK) {
+        ERROR("Failed to download: %s: %s\n", job->url, curl_easy_strerror(res));
+        job->failed = 1;
+    }
+    return 0;
+}
+
+static void dl_job_cancel(CURLM *multi, struct DLTransfer *slots, int nslots, struct DLJob *job)
+{
+    /* Stop all running transfers of job and close part file, job is restarted from scratch
+     * so received data doesn't need to be kept */
+    for (int i=0 ; i<nslots ; i++) {
+        struct DLTransfer *tr = &slots[i];
+        if (tr->curl == NULL || tr->job != job)
+            continue;
+        curl_multi_remove_handle(multi, tr->curl);
+        curl_easy_cleanup(tr->curl);
+        tr->curl = NULL;
+        job->ntransfers--;
+    }
+    close(job->fd);
+    job->fd = -1;
+}
+
+static struct DLTransfer* dl_free_slot(struct DLTransfer *slots, int nslots)
+{
+    for (int i=0 ; i<nslots ; i++) {
+        if (slots[i].curl == NULL)
+            return &slots[i];
+    }
+    return NULL;
+}
+
+static int dl_split(struct Downloader *dl, CURLM *multi, struct DLTransfer *slots, int nslots, struct DLTransfer *tr, int nparts)
+{
+    /* Split remaining range of tr in nparts, tr keeps the first part.
+     * Returns amount of new transfers */
+    struct DLJob *job = tr->job;
+    curl_off_t end = (tr->end >= 0) ? tr->end : job->size;
+    curl_off_t pos = tr->offset + tr->block_len;
+    int nstarted = 0;
+
+    if (end < 0 || tr->reached_end)
+        return 0;
+
+    // new segments start at aligned offsets so their blocks are written aligned
+    curl_off_t base = (pos + DL_ALIGN - 1) & ~((curl_off_t)DL_ALIGN - 1);
+    if (base >= end)
+        return 0;
+
+    curl_off_t seg = (end - base) / nparts;
+    seg &= ~((curl_off_t)DL_ALIGN - 1);
+    if (seg < DL_MIN_SEGMENT)
+        return 0;
+
+    if (!job->segmented && dl_job_mark_segmented(job) < 0)
+        return 0;
+
+    // new transfers take the ranges at the end, tr stops at the first one
+    curl_off_t seg_end = end;
+    for (int i=nparts-1 ; i>0 ; i--) {
+        curl_off_t seg_start = base + seg * i;
+        struct DLTransfer *new_tr = dl_free_slot(slots, nslots);
+        if (new_tr == NULL || dl_transfer_setup(dl, new_tr, job, seg_start, seg_end) < 0)
+            break;
+
+        curl_multi_add_handle(multi, new_tr->curl);
+        tr->end = seg_start;
+        seg_end = seg_start;
+        nstarted++;
+    }
+    if (nstarted > 0)
+        DEBUG("Split %s in %d segments at %ld\n", job->url, nstarted+1, pos);
+    return nstarted;
+}
+
+static struct DLTransfer* dl_slowest(struct DLTransfer *slots, int nslots, struct DLJob *job)
+{
+    /* Return running transfer of job with the most bytes left */
+    struct DLTransfer *slowest = NULL;
+    curl_off_t max_left = 0;
+
+    for (int i=0 ; i<nslots ; i++) {
+        struct DLTransfer *tr = &slots[i];
+        if (tr->curl == NULL || tr->job != job)
+            continue;
+
+        curl_off_t end = (tr->end >= 0) ? tr->end : job->size;
+        curl_off_t left = end - (tr->offset + tr->block_len);
+        if (left > max_left) {
+            max_left = left;
+            slowest = tr;
+        }
+    }
+    return slowest;
+}
+
+int dl_run(struct Downloader *dl)
+{
+    /* Keep max_concurrent jobs running until all jobs are done.
+     * Every job can use nsegments transfers */
+    int nslots = dl->max_concurrent * dl->nsegments;
+    if (nslots == 0 || dl->njobs == 0)
+        return 0;
+
+    struct DLTransfer *slots = calloc(nslots, sizeof(struct DLTransfer));
+    if (slots == NULL) {
+        ERROR("Failed to allocate transfers\n");
+        return -1;
+    }
+
+    CURLM *multi = curl_multi_init();
+    if (multi == NULL) {
+        free(slots);
+        return -1;
+    }
+
+    int ret = 0;
+    size_t njob = 0;
+    int nrunning_jobs = 0;
+    int running = 0;
+
+    while (ret == 0) {
+        // start new jobs in free slots
+        struct DLTransfer *tr;
+        while (njob < dl->njobs && nrunning_jobs < dl->max_concurrent && (tr = dl_free_slot(slots, nslots)) != NULL) {
+            struct DLJob *job = &dl->jobs[njob++];
+            int res = dl_job_open(dl, tr, job);
+            if (res < 0)
+                job->result = DL_RESULT_ERROR;
+            if (res != 0)
+                continue;
+
+            curl_multi_add_handle(multi, tr->curl);
+            nrunning_jobs++;
+        }
+
+        running = 0;
+        for (int i=0 ; i<nslots ; i++) {
+            if (slots[i].curl != NULL)
+                running++;
+        }
+        if (running == 0)
+            break;
+
+        int still_running;
+        CURLMcode mc = curl_multi_perform(multi, &still_running);
+        if (mc == CURLM_OK)
+            mc = curl_multi_poll(multi, NULL, 0, 1000, NULL);
+
+        if (mc != CURLM_OK) {
+            ERROR("CURL multi error: %s\n", curl_multi_strerror(mc));
+            ret = -1;
+            break;
+        }
+
+        // first response of a job allows ranges, split in segments
+        if (dl->nsegments > 1) {
+            for (int i=0 ; i<nslots ; i++) {
+                tr = &slots[i];
+                if (tr->curl != NULL && tr->job->want_split) {
+                    tr->job->want_split = 0;
+                    dl_split(dl, multi, slots, nslots, tr, dl->nsegments);
+                }
+            }
+        }
+
+        CURLMsg *msg;
+        int msgs_left;
+        while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&tr);
+            curl_multi_remove_handle(multi, tr->curl);
+            struct DLJob *job = tr->job;
+
+            if (dl_transfer_finish(tr, msg->data.result) == 1) {
+                dl_job_cancel(multi, slots, nslots, job);
+                int res = dl_job_open(dl, tr, job);
+                if (res == 0) {
+                    curl_multi_add_handle(multi, tr->curl);
+                    continue;
+                }
+                if (res < 0)
+                    job->result = DL_RESULT_ERROR;
+                nrunning_jobs--;
+                continue;
+            }
+
+            // help the slowest segment of this job
+            if (!job->failed && job->ntransfers > 0) {
+                struct DLTransfer *slowest = dl_slowest(slots, nslots, job);
+                if (slowest != NULL)
+                    dl_split(dl, multi, slots, nslots, slowest, 2);
+                continue;
+            }
+
+            if (job->ntransfers > 0)
+                continue;
+
+            dl_job_finish(job);
+            nrunning_jobs--;
+
+            if (job->result == DL_RESULT_SUCCESS)
+                INFO("Downloaded: %s, %ld bytes, crc32: %08x\n", job->path, job->size, job->crc);
+        }
+    }
+
+    // only on errors, cleanup transfers that are still running, part files are kept for resuming
+    for (int i=0 ; i<nslots ; i++) {
+        if (slots[i].curl != NULL) {
+            curl_multi_remove_handle(multi, slots[i].curl);
+            dl_transfer_finish(&slots[i], CURLE_ABORTED_BY_CALLBACK);
+            if (slots[i].job->ntransfers == 0)
+                dl_job_finish(slots[i].job);
+        }
+        free(slots[i].block);
+    }
+    curl_multi_cleanup(multi);
+    free(slots);
+
+    if (ret < 0)
+        return ret;
+
+    for (size_t i=0 ; i<dl->njobs ; i++) {
+        if (dl->jobs[i].result == DL_RESULT_ERROR || dl->jobs[i].result == DL_RESULT_PENDING)
+            ret++;
+    }
+    return ret;
+}
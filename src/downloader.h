@@ -0,0 +1,157 @@
+#ifndef DOWNLOADER_H
+#define DOWNLOADER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#include <curl/curl.h>
+
+#include "podcast.h"
+#include "lib/hash/crc32.h"
+
+// Media downloader, runs several transfers at the same time using the curl multi interface.
+// Data is written to "<path>.part" which is renamed to path when the download is complete.
+// An existing part file is resumed with a range request.
+//
+// Large files can be split into segments that are fetched over parallel connections, every
+// transfer writes its byte range at its own offset. When a segment is done, the segment of the
+// same file with the most bytes left is split in two so a slow connection gets help.
+// Every transfer checksums its own range, checksums are combined when the file is complete.
+
+#define DL_MAX_PATH 512
+#define DL_PART_EXT ".part"
+
+// Exists while a part file is written by several transfers. Part file may have holes when the
+// process was killed, so it can't be resumed.
+#define DL_SEG_EXT ".part.seg"
+
+// Data is collected in a block buffer and written in one go when the block is full.
+// Blocks are written at offsets that are a multiple of DL_ALIGN, a resumed part file
+// is cut back to an aligned size to keep it that way.
+#define DL_ALIGN      4096
+#define DL_BLOCK_SIZE (1024 * 1024)
+
+#define DL_DEFAULT_CONCURRENT 4
+#define DL_MAX_CONCURRENT     32
+#define DL_INIT_JOBS          32
+
+// Segmented downloads, a segment is never smaller than DL_MIN_SEGMENT
+#define DL_MAX_SEGMENTS  16
+#define DL_MIN_SEGMENT   (4 * DL_BLOCK_SIZE)
+
+// Max amount of transfers per job, including resumed data and transfers of rebalanced segments
+#define DL_MAX_PIECES 64
+
+extern int do_debug;
+extern int do_info;
+extern int do_error;
+
+enum DLResult {
+    DL_RESULT_ERROR,
+    DL_RESULT_PENDING,
+    DL_RESULT_SUCCESS,
+    DL_RESULT_EXISTS        // file was already downloaded
+};
+
+// Range of file that is downloaded by one transfer
+struct DLPiece {
+    curl_off_t start;
+    curl_off_t length;
+    uint32_t crc;
+};
+
+struct DLJob {
+    char url[PODCAST_MAX_URL];
+    char path[DL_MAX_PATH];
+    enum DLResult result;
+
+    // total size, -1 if server didn't tell
+    curl_off_t size;
+
+    // bytes that were already in part file when download started
+    curl_off_t resumed;
+
+    // CRC-32 of complete file, combined from checksums of pieces
+    uint32_t crc;
+
+    // set when download was restarted from the beginning, eg: server doesn't support ranges
+    int restarted;
+    int fd;
+
+    // server ignored a range request, file is downloaded in one stream
+    int no_ranges;
+
+    // finished ranges, sorted when job is done
+    struct DLPiece pieces[DL_MAX_PIECES];
+    int npieces;
+
+    // running transfers that write to fd
+    int ntransfers;
+    int failed;
+
+    // first response allows ranges, file can be split in segments
+    int want_split;
+    int segmented;
+};
+
+struct DLTransfer {
+    CURL *curl;
+    struct DLJob *job;
+
+    // range of transfer, end is exclusive and -1 when range runs until end of file
+    // end can be lowered while running when segment is split
+    curl_off_t start;
+    curl_off_t end;
+
+    // file offset of first byte in block
+    curl_off_t offset;
+
+    // running CRC of range
+    uint32_t crc;
+
+    // aligned write buffer of DL_BLOCK_SIZE bytes
+    char *block;
+    size_t block_len;
+
+    // first write, response headers are available
+    int started;
+    int write_error;
+
+    // response to range request is not the requested range, nothing was written
+    int range_error;
+
+    // all data in range is received, transfer is stopped by write callback
+    int reached_end;
+};
+
+struct Downloader {
+    struct DLJob *jobs;
+    size_t njobs;
+    size_t max_jobs;
+
+    // max amount of files downloaded at the same time
+    int max_concurrent;
+    long connect_timeout;
+
+    // amount of connections per file, 1 disables segmented downloads
+    int nsegments;
+
+    // optional, shares DNS and TLS cache with API client
+    CURLSH *share;
+};
+
+int dl_init(struct Downloader *dl, int max_concurrent, int nsegments);
+void dl_free(struct Downloader *dl);
+int dl_add(struct Downloader *dl, const char *url, const char *path);
+
+// Download all jobs, returns amount of failed jobs or -1 on error
+int dl_run(struct Downloader *dl);
+
+#endif
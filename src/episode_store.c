@@ -0,0 +1,478 @@
+#include "episode_store.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+uint64_t es_pod_id(const char *podcast)
+{
+    return hash_str(podcast);
+}
+
+uint64_t es_guid_hash(struct Episode *ep)
+{
+    /* Not all feeds have guids, url is the next best thing to identify an episode */
+    return hash_str((strlen(ep->guid) > 0) ? ep->guid : ep->url);
+}
+
+static uint64_t es_key(uint64_t pod_id, uint64_t guid_hash)
+{
+    return hash_update(hash_data(&pod_id, sizeof(pod_id)), &guid_hash, sizeof(guid_hash));
+}
+
+static int es_pread(int fd, void *buf, size_t size, uint64_t offset)
+{
+    /* Read exactly size bytes, returns -1 on errors and when file is too short */
+    size_t nread = 0;
+    while (nread < size) {
+        ssize_t n = pread(fd, (char*)buf + nread, size - nread, offset + nread);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        nread += n;
+    }
+    return 0;
+}
+
+static int es_pwrite(int fd, const void *buf, size_t size, uint64_t offset)
+{
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = pwrite(fd, (const char*)buf + written, size - written, offset + written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        written += n;
+    }
+    return 0;
+}
+
+static int es_read_record(struct EpisodeStore *store, uint64_t offset, uint64_t log_size, struct ESRecordHeader *hdr, char *payload)
+{
+    /* Read and check record at offset, payload holds at least ES_MAX_RECORD bytes */
+    if (offset + sizeof(struct ESRecordHeader) > log_size || es_pread(store->log_fd, hdr, sizeof(struct ESRecordHeader), offset) < 0)
+        return -1;
+
+    if (hdr->magic != ES_MAGIC || hdr->length == 0 || hdr->length > ES_MAX_RECORD)
+        return -1;
+    if (offset + sizeof(struct ESRecordHeader) + hdr->length > log_size)
+        return -1;
+    if (es_pread(store->log_fd, payload, hdr->length, offset + sizeof(struct ESRecordHeader)) < 0)
+        return -1;
+
+    if (crc32_final(crc32_update(CRC32_INIT, payload, hdr->length)) != hdr->crc || payload[hdr->length-1] != '\0')
+        return -1;
+    return 0;
+}
+
+static int es_recover(struct EpisodeStore *store)
+{
+    /* Index records that are in the log but not in the index, eg: after a crash between
+     * writing log and index. A torn record at the end of the log is removed */
+    struct stat st;
+    struct ESRecordHeader hdr;
+    char payload[ES_MAX_RECORD];
+
+    if (fstat(store->index_fd, &st) < 0)
+        return -1;
+    uint64_t nindex = st.st_size / sizeof(struct ESIndexEntry);
+
+    if (fstat(store->log_fd, &st) < 0)
+        return -1;
+    uint64_t log_size = st.st_size;
+    uint64_t offset = 0;
+
+    // continue after last indexed record, rebuild index when it doesn't match the log
+    if (nindex > 0) {
+        struct ESIndexEntry last;
+        if (es_pread(store->index_fd, &last, sizeof(last), (nindex-1) * sizeof(last)) == 0 &&
+            es_read_record(store, last.offset, log_size, &hdr, payload) == 0 &&
+            last.pod_id == hdr.pod_id && last.guid_hash == hdr.guid_hash) {
+            offset = last.offset + sizeof(hdr) + hdr.length;
+        }
+        else {
+            ERROR("Episode index doesn't match log, rebuilding: %s\n", store->dir);
+            nindex = 0;
+        }
+    }
+    if (ftruncate(store->index_fd, nindex * sizeof(struct ESIndexEntry)) < 0)
+        return -1;
+
+    size_t nrecovered = 0;
+    while (es_read_record(store, offset, log_size, &hdr, payload) == 0) {
+        struct ESIndexEntry entry = { hdr.pod_id, hdr.guid_hash, hdr.published, offset };
+        if (es_pwrite(store->index_fd, &entry, sizeof(entry), nindex * sizeof(entry)) < 0)
+            return -1;
+        nindex++;
+        nrecovered++;
+        offset += sizeof(hdr) + hdr.length;
+    }
+
+    if (offset < log_size) {
+        DEBUG("Cutting off %ld bytes at end of episode log\n", log_size - offset);
+        if (ftruncate(store->log_fd, offset) < 0)
+            return -1;
+    }
+    if (nrecovered > 0)
+        DEBUG("Indexed %ld episodes from log\n", nrecovered);
+
+    store->log_size = offset;
+    return 0;
+}
+
+static int es_map(struct EpisodeStore *store)
+{
+    /* Map index again after it has grown */
+    struct stat st;
+
+    if (store->index != NULL)
+        munmap(store->index, store->nindex * sizeof(struct ESIndexEntry));
+    store->index = NULL;
+    store->nindex = 0;
+
+    if (fstat(store->index_fd, &st) < 0)
+        return -1;
+    if (st.st_size < (off_t)sizeof(struct ESIndexEntry))
+        return 0;
+
+    size_t nindex = st.st_size / sizeof(struct ESIndexEntry);
+    void *index = mmap(NULL, nindex * sizeof(struct ESIndexEntry), PROT_READ, MAP_SHARED, store->index_fd, 0);
+    if (index == MAP_FAILED) {
+        ERROR("Failed to map episode index: %s\n", strerror(errno));
+        return -1;
+    }
+    store->index = index;
+    store->nindex = nindex;
+    return 0;
+}
+
+static int es_index_guids(struct EpisodeStore *store)
+{
+    /* Add keys of records that are not in the guid index, eg: after a crash.
+     * Index is rebuilt when it has more records than the store */
+    struct GuidIndex *gi = &store->guids;
+    if (gi->header->position > store->nindex) {
+        DEBUG("Guid index is ahead of episode store, rebuilding\n");
+        if (gi_clear(gi) < 0)
+            return -1;
+    }
+
+    for (size_t i=gi->header->position ; i<store->nindex ; i++) {
+        if (gi_add(gi, es_key(store->index[i].pod_id, store->index[i].guid_hash)) < 0)
+            return -1;
+    }
+    gi->header->position = store->nindex;
+    return 0;
+}
+
+int es_open(struct EpisodeStore *store, const char *dir)
+{
+    /* Open or create store in dir */
+    char path[ES_MAX_PATH + 32];
+    memset(store, 0, sizeof(struct EpisodeStore));
+    store->log_fd = -1;
+    store->index_fd = -1;
+    store->guids.fd = -1;
+
+    if (strlen(dir) >= ES_MAX_PATH) {
+        ERROR("Episode store path too long: %s\n", dir);
+        return -1;
+    }
+    strcpy(store->dir, dir);
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        ERROR("Failed to create episode store dir: %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dir, ES_LOG_NAME);
+    store->log_fd = open(path, O_RDWR | O_CREAT, 0644);
+    snprintf(path, sizeof(path), "%s/%s", dir, ES_INDEX_NAME);
+    store->index_fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    store->buf = malloc(ES_BUF_SIZE);
+    store->max_pending = ES_INIT_PENDING;
+    store->pending = malloc(sizeof(struct ESIndexEntry) * store->max_pending);
+
+    if (store->log_fd < 0 || store->index_fd < 0 || store->buf == NULL || store->pending == NULL) {
+        ERROR("Failed to open episode store: %s: %s\n", dir, strerror(errno));
+        es_close(store);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dir, ES_GUIDS_NAME);
+    if (gi_open(&store->guids, path) < 0) {
+        es_close(store);
+        return -1;
+    }
+
+    if (es_recover(store) < 0 || es_map(store) < 0 || es_index_guids(store) < 0) {
+        ERROR("Failed to read episode store: %s\n", dir);
+        es_close(store);
+        return -1;
+    }
+    DEBUG("Opened episode store with %ld episodes\n", store->nindex);
+    return 0;
+}
+
+int es_flush(struct EpisodeStore *store)
+{
+    /* Write buffered records, then their index entries */
+    if (store->length == 0 && store->npending == 0)
+        return 0;
+
+    uint64_t offset = store->log_size - store->length;
+    if (es_pwrite(store->log_fd, store->buf, store->length, offset) < 0 ||
+        es_pwrite(store->index_fd, store->pending, store->npending * sizeof(struct ESIndexEntry), store->nindex * sizeof(struct ESIndexEntry)) < 0) {
+        ERROR("Failed to write episode store: %s: %s\n", store->dir, strerror(errno));
+        return -1;
+    }
+    store->length = 0;
+    store->npending = 0;
+    return es_map(store);
+}
+
+int es_close(struct EpisodeStore *store)
+{
+    int ret = 0;
+    if (store->log_fd >= 0 && store->index_fd >= 0)
+        ret = es_flush(store);
+
+    if (store->index != NULL)
+        munmap(store->index, store->nindex * sizeof(struct ESIndexEntry));
+    if (store->log_fd >= 0)
+        close(store->log_fd);
+    if (store->index_fd >= 0)
+        close(store->index_fd);
+    free(store->buf);
+    free(store->pending);
+    gi_close(&store->guids);
+
+    store->index = NULL;
+    store->nindex = 0;
+    store->buf = NULL;
+    store->pending = NULL;
+    store->log_fd = -1;
+    store->index_fd = -1;
+    return ret;
+}
+
+static size_t es_pack(char *buf, const char *str, size_t max_length)
+{
+    /* Copy string including NUL, cut off at max_length */
+    size_t n = strnlen(str, max_length - 1);
+    memcpy(buf, str, n);
+    buf[n] = '\0';
+    return n + 1;
+}
+
+int es_append(struct EpisodeStore *store, const char *podcast, struct Episode *ep)
+{
+    /* Buffer record, written to log on flush or when buffer is full.
+     * Known episodes are skipped before anything is formatted */
+    char payload[ES_MAX_RECORD];
+    size_t length = 0;
+
+    uint64_t pod_id = es_pod_id(podcast);
+    uint64_t guid_hash = es_guid_hash(ep);
+    uint64_t key = es_key(pod_id, guid_hash);
+    if (gi_contains(&store->guids, key))
+        return 0;
+
+    length += es_pack(payload + length, podcast, PODCAST_MAX_URL);
+    length += es_pack(payload + length, ep->title, PODCAST_MAX_TITLE);
+    length += es_pack(payload + length, ep->guid, PODCAST_MAX_GUID);
+    length += es_pack(payload + length, ep->url, PODCAST_MAX_URL);
+
+    struct ESRecordHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = ES_MAGIC;
+    hdr.length = length;
+    hdr.crc = crc32_final(crc32_update(CRC32_INIT, payload, length));
+    hdr.pod_id = pod_id;
+    hdr.guid_hash = guid_hash;
+    hdr.published = ep->published;
+
+    if (store->length + sizeof(hdr) + length > ES_BUF_SIZE && es_flush(store) < 0)
+        return -1;
+
+    if (store->npending >= store->max_pending) {
+        struct ESIndexEntry *tmp = realloc(store->pending, sizeof(struct ESIndexEntry) * store->max_pending * 2);
+        if (tmp == NULL) {
+            ERROR("Failed to grow episode index buffer to %ld\n", store->max_pending * 2);
+            return -1;
+        }
+        store->pending = tmp;
+        store->max_pending *= 2;
+    }
+
+    struct ESIndexEntry *entry = &store->pending[store->npending++];
+    entry->pod_id = hdr.pod_id;
+    entry->guid_hash = hdr.guid_hash;
+    entry->published = hdr.published;
+    entry->offset = store->log_size;
+
+    memcpy(store->buf + store->length, &hdr, sizeof(hdr));
+    memcpy(store->buf + store->length + sizeof(hdr), payload, length);
+    store->length += sizeof(hdr) + length;
+    store->log_size += sizeof(hdr) + length;
+
+    if (gi_add(&store->guids, key) < 0)
+        return -1;
+    store->guids.header->position++;
+    return 1;
+}
+
+int es_read(struct EpisodeStore *store, uint64_t offset, char *podcast, size_t size, struct Episode *ep)
+{
+    /* Read flushed record at offset into ep, podcast name is copied into podcast */
+    struct ESRecordHeader hdr;
+    char payload[ES_MAX_RECORD];
+
+    if (es_read_record(store, offset, store->log_size - store->length, &hdr, payload) < 0) {
+        ERROR("Invalid episode record at %ld\n", offset);
+        return -1;
+    }
+
+    // strings are NUL terminated and the last byte is checked to be NUL, so all four are there
+    const char *strs[4];
+    const char *ptr = payload;
+    for (int i=0 ; i<4 ; i++) {
+        if (ptr >= payload + hdr.length) {
+            ERROR("Invalid episode record at %ld\n", offset);
+            return -1;
+        }
+        strs[i] = ptr;
+        ptr += strlen(ptr) + 1;
+    }
+
+    snprintf(podcast, size, "%s", strs[0]);
+    *ep = episode_init();
+    snprintf(ep->title, PODCAST_MAX_TITLE, "%s", strs[1]);
+    snprintf(ep->guid, PODCAST_MAX_GUID, "%s", strs[2]);
+    snprintf(ep->url, PODCAST_MAX_URL, "%s", strs[3]);
+    ep->published = hdr.published;
+    return 0;
+}
+
+void es_batch_init(struct ESBatch *batch)
+{
+    batch->eps = NULL;
+    batch->length = 0;
+    batch->max = 0;
+}
+
+int es_batch_add(struct EpisodeStore *store, struct ESBatch *batch, const char *podcast, struct Episode *ep)
+{
+    /* Keep copy of episode when it isn't in the store, returns 1 if kept and 0 if known */
+    if (gi_contains(&store->guids, es_key(es_pod_id(podcast), es_guid_hash(ep))))
+        return 0;
+
+    if (batch->length >= batch->max) {
+        size_t max = (batch->max > 0) ? batch->max * 2 : ES_INIT_BATCH;
+        struct Episode *tmp = realloc(batch->eps, sizeof(struct Episode) * max);
+        if (tmp == NULL) {
+            ERROR("Failed to grow episode batch to %zu\n", max);
+            return -1;
+        }
+        batch->eps = tmp;
+        batch->max = max;
+    }
+    batch->eps[batch->length++] = *ep;
+    return 1;
+}
+
+long es_batch_commit(struct EpisodeStore *store, struct ESBatch *batch, const char *podcast)
+{
+    /* Episodes that are in batch twice, eg: an item that is repeated in a feed, are appended once */
+    long nadded = 0;
+    for (size_t i=0 ; i<batch->length ; i++) {
+        int res = es_append(store, podcast, &batch->eps[i]);
+        if (res < 0) {
+            nadded = -1;
+            break;
+        }
+        nadded += res;
+    }
+    es_batch_abort(batch);
+    return nadded;
+}
+
+void es_batch_abort(struct ESBatch *batch)
+{
+    free(batch->eps);
+    es_batch_init(batch);
+}
+
+long es_query_since(struct EpisodeStore *store, time_t since, es_episode_cb cb, void *user_data)
+{
+    /* Only index is scanned, records are read for matching entries */
+    char podcast[PODCAST_MAX_URL];
+    struct Episode ep;
+    long nfound = 0;
+
+    if (es_flush(store) < 0)
+        return -1;
+
+    for (size_t i=0 ; i<store->nindex ; i++) {
+        if (store->index[i].published < since)
+            continue;
+        if (es_read(store, store->index[i].offset, podcast, sizeof(podcast), &ep) < 0)
+            return -1;
+        cb(podcast, &ep, user_data);
+        nfound++;
+    }
+    return nfound;
+}
+
+long es_import(struct EpisodeStore *store, const char *dir)
+{
+    /* Episodes that are in the store already are skipped, so importing again only adds new episodes */
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        ERROR("Failed to open podcast dir: %s\n", dir);
+        return -1;
+    }
+
+    long nadded = 0;
+    struct dirent *entry;
+    while (nadded >= 0 && (entry = readdir(d)) != NULL) {
+        // skip temporary files of podcast files that are being written
+        size_t len = strlen(entry->d_name);
+        if (entry->d_name[0] == '.' || len <= 5 || strcmp(entry->d_name + len - 5, ".json") != 0)
+            continue;
+
+        char path[ES_MAX_PATH * 2];
+        struct Podcast pod;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+
+        // files of older versions don't know their feed
+        if (episodes_load_podcast(path, &pod) <= 0) {
+            DEBUG("Skipping podcast file without feed url: %s\n", path);
+            continue;
+        }
+
+        struct JSONBind bind;
+        if (json_bind_init_growable(&bind, &episode_schema) < 0)
+            break;
+
+        if (episodes_load(path, &bind) > 0) {
+            struct Episode *eps = bind.records;
+            for (size_t i=0 ; i<bind.nrecords ; i++) {
+                int res = es_append(store, pod.url, &eps[i]);
+                if (res < 0) {
+                    nadded = -1;
+                    break;
+                }
+                nadded += res;
+            }
+        }
+        json_bind_free(&bind);
+    }
+    closedir(d);
+
+    if (es_flush(store) < 0)
+        return -1;
+    return nadded;
+}
@@ -0,0 +1,133 @@
+#ifndef EPISODE_STORE_H
+#define EPISODE_STORE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "podcast.h"
+#include "guid_index.h"
+#include "lib/hash/hash.h"
+#include "lib/hash/crc32.h"
+
+// Binary store of all episodes in the library, so questions about the library don't need
+// every podcast file to be parsed.
+//
+// episodes.log  append-only log of records, a fixed header followed by the feed url,
+//               title, guid and url as NUL terminated strings. Records are never changed.
+// episodes.idx  array of fixed size entries, one per record in the same order, that is
+//               mapped into memory. Queries scan the index and only read matching records.
+//
+// guids.idx     set of (podcast, guid) keys of all records, see guid_index.h. Episodes that
+//               are known already are not appended again.
+//
+// Podcasts are identified by their feed url, which is in the first line of their podcast file,
+// see struct EpisodeWriter.
+// Log is written before index, so an entry never points to a missing record. On open, records
+// behind the last index entry are indexed again and a torn record at the end is cut off.
+
+#define ES_MAX_PATH     256
+#define ES_LOG_NAME     "episodes.log"
+#define ES_INDEX_NAME   "episodes.idx"
+#define ES_GUIDS_NAME   "guids.idx"
+#define ES_MAGIC        0x31535045  // "EPS1"
+#define ES_BUF_SIZE     (64 * 1024)
+#define ES_INIT_PENDING 256
+#define ES_INIT_BATCH   64
+
+// max length of the strings of one record
+#define ES_MAX_RECORD   (PODCAST_MAX_TITLE + PODCAST_MAX_GUID + PODCAST_MAX_URL * 2)
+
+extern int do_debug;
+extern int do_error;
+
+struct ESRecordHeader {
+    uint32_t magic;
+
+    // length and CRC-32 of the strings after the header
+    uint32_t length;
+    uint32_t crc;
+    uint32_t reserved;
+
+    uint64_t pod_id;
+    uint64_t guid_hash;
+    int64_t published;
+};
+
+struct ESIndexEntry {
+    uint64_t pod_id;
+    uint64_t guid_hash;
+    int64_t published;
+
+    // offset of record header in log
+    uint64_t offset;
+};
+
+struct EpisodeStore {
+    char dir[ES_MAX_PATH];
+    int log_fd;
+    int index_fd;
+
+    // end of last record in log, including records that are still buffered
+    uint64_t log_size;
+
+    // mapped index, only holds flushed entries
+    struct ESIndexEntry *index;
+    size_t nindex;
+
+    // appended records and their index entries that aren't written yet
+    char *buf;
+    size_t length;
+    struct ESIndexEntry *pending;
+    size_t npending;
+    size_t max_pending;
+
+    // keys of all records, also the buffered ones. position is the amount of records indexed
+    struct GuidIndex guids;
+};
+
+// New episodes of one feed transfer. They are only appended to the store when the transfer
+// succeeded, so a failed or cancelled transfer leaves no episodes behind. Known episodes are
+// skipped while adding
+struct ESBatch {
+    struct Episode *eps;
+    size_t length;
+    size_t max;
+};
+
+// Called for every episode that matches a query, podcast is the feed url
+typedef void (*es_episode_cb)(const char *podcast, struct Episode *ep, void *user_data);
+
+int es_open(struct EpisodeStore *store, const char *dir);
+int es_close(struct EpisodeStore *store);
+int es_flush(struct EpisodeStore *store);
+
+uint64_t es_pod_id(const char *podcast);
+uint64_t es_guid_hash(struct Episode *ep);
+
+// Append episode when it isn't in the store yet, returns 1 if appended and 0 if known
+int es_append(struct EpisodeStore *store, const char *podcast, struct Episode *ep);
+int es_read(struct EpisodeStore *store, uint64_t offset, char *podcast, size_t size, struct Episode *ep);
+
+void es_batch_init(struct ESBatch *batch);
+int es_batch_add(struct EpisodeStore *store, struct ESBatch *batch, const char *podcast, struct Episode *ep);
+
+// Append episodes of batch to store and empty it, returns amount appended or -1
+long es_batch_commit(struct EpisodeStore *store, struct ESBatch *batch, const char *podcast);
+void es_batch_abort(struct ESBatch *batch);
+
+// Episodes published at or after since, returns amount of episodes or -1 on error
+long es_query_since(struct EpisodeStore *store, time_t since, es_episode_cb cb, void *user_data);
+
+// Add episodes from podcast files in dir that are not in the store yet, returns amount added or -1
+long es_import(struct EpisodeStore *store, const char *dir);
+
+#endif
@@ -0,0 +1,395 @@
+#include "feed_meta.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+static void feed_meta_copy_field(char *dest, const char *src, size_t size)
+{
+    /* Copy field, tabs and newlines would break the file format */
+    size_t i;
+    for (i=0 ; i<size-1 && src[i] != '\0' ; i++)
+        dest[i] = (src[i] == '\t' || src[i] == '\n' || src[i] == '\r') ? ' ' : src[i];
+    dest[i] = '\0';
+}
+
+void feed_meta_init(struct FeedMetaStore *store)
+{
+    store->items = NULL;
+    store->length = 0;
+    store->max = 0;
+    store->table = NULL;
+    store->table_size = 0;
+    store->hashes = NULL;
+    store->nhashes = 0;
+    store->hashes_size = 0;
+}
+
+void feed_meta_free(struct FeedMetaStore *store)
+{
+    free(store->items);
+    free(store->table);
+    free(store->hashes);
+    feed_meta_init(store);
+}
+
+static size_t feed_meta_slot(struct FeedMetaStore *store, const char *url)
+{
+    /* Return slot of url in table, or the empty slot where it should go */
+    size_t slot = hash_str(url) & (store->table_size-1);
+
+    while (store->table[slot] != 0 && strcmp(store->items[store->table[slot]-1].url, url) != 0)
+        slot = (slot + 1) & (store->table_size-1);
+    return slot;
+}
+
+static int feed_meta_rehash(struct FeedMetaStore *store, size_t table_size)
+{
+    /* Build table of table_size slots for all items in store */
+    size_t *table = calloc(table_size, sizeof(size_t));
+    if (table == NULL) {
+        ERROR("Failed to allocate feed meta table\n");
+        return -1;
+    }
+    free(store->table);
+    store->table = table;
+    store->table_size = table_size;
+
+    for (size_t i=0 ; i<store->length ; i++)
+        store->table[feed_meta_slot(store, store->items[i].url)] = i + 1;
+    return 0;
+}
+
+static struct FeedMetaHashCount* feed_meta_hash_slot(struct FeedMetaStore *store, uint64_t hash)
+{
+    /* Return slot of hash, or the empty slot where it should go */
+    size_t slot = hash_data(&hash, sizeof(hash)) & (store->hashes_size-1);
+
+    while (store->hashes[slot].hash != 0 && store->hashes[slot].hash != hash)
+        slot = (slot + 1) & (store->hashes_size-1);
+    return &store->hashes[slot];
+}
+
+static int feed_meta_count_hashes(struct FeedMetaStore *store)
+{
+    /* Count body hashes of all items again, drops hashes that are no longer used */
+    size_t hashes_size = FEED_META_INIT_TABLE;
+    while (hashes_size < (store->length + 1) * 4)
+        hashes_size *= 2;
+
+    struct FeedMetaHashCount *hashes = calloc(hashes_size, sizeof(struct FeedMetaHashCount));
+    if (hashes == NULL) {
+        ERROR("Failed to allocate feed meta hashes\n");
+        return -1;
+    }
+    free(store->hashes);
+    store->hashes = hashes;
+    store->hashes_size = hashes_size;
+    store->nhashes = 0;
+
+    for (size_t i=0 ; i<store->length ; i++) {
+        if (store->items[i].hash == 0)
+            continue;
+        struct FeedMetaHashCount *hc = feed_meta_hash_slot(store, store->items[i].hash);
+        if (hc->hash == 0) {
+            hc->hash = store->items[i].hash;
+            store->nhashes++;
+        }
+        hc->count++;
+    }
+    return 0;
+}
+
+int feed_meta_load(struct FeedMetaStore *store, const char *path)
+{
+    /* Load store from file, a missing file results in an empty store */
+    char line[FEED_META_MAX_LINE];
+    feed_meta_init(store);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        ERROR("Failed to open feed meta file: %s\n", path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+
+        char *rest = line;
+        char *url  = strsep(&rest, "\t");
+        char *etag = strsep(&rest, "\t");
+        char *date = strsep(&rest, "\t");
+        char *hash = strsep(&rest, "\t");
+
+        // schedule columns are missing in files written by older versions, feed is due
+        char *last_pub   = strsep(&rest, "\t");
+        char *interval   = strsep(&rest, "\t");
+        char *nunchanged = strsep(&rest, "\t");
+        char *next_due   = strsep(&rest, "\t");
+        char *ttfb       = strsep(&rest, "\t");
+        char *ttfb_dev   = strsep(&rest, "\t");
+        char *location   = strsep(&rest, "\t");
+
+        if (url == NULL || hash == NULL || strlen(url) == 0) {
+            DEBUG("Skipping malformed feed meta line\n");
+            continue;
+        }
+
+        struct FeedMeta *meta = feed_meta_set(store, url);
+        if (meta == NULL)
+            break;
+
+        feed_meta_copy_field(meta->etag, etag, FEED_META_MAX_ETAG);
+        feed_meta_copy_field(meta->last_modified, date, FEED_META_MAX_DATE);
+        if (feed_meta_set_hash(store, meta, strtoull(hash, NULL, 16)) < 0)
+            break;
+
+        if (next_due != NULL) {
+            meta->last_pub = strtoll(last_pub, NULL, 10);
+            meta->interval = strtol(interval, NULL, 10);
+            meta->nunchanged = atoi(nunchanged);
+            meta->next_due = strtoll(next_due, NULL, 10);
+        }
+        if (ttfb_dev != NULL) {
+            meta->ttfb = strtol(ttfb, NULL, 10);
+            meta->ttfb_dev = strtol(ttfb_dev, NULL, 10);
+        }
+        if (location != NULL)
+            feed_meta_copy_field(meta->location, location, PODCAST_MAX_URL);
+    }
+    fclose(fp);
+    DEBUG("Loaded %zu feed meta entries\n", store->length);
+    return 0;
+}
+
+int feed_meta_save(struct FeedMetaStore *store, const char *path)
+{
+    /* Write to temporary file and rename so a crash never leaves a half written store */
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp_path, "w");
+    if (fp == NULL) {
+        ERROR("Failed to open feed meta file for writing: %s\n", tmp_path);
+        return -1;
+    }
+
+    for (size_t i=0 ; i<store->length ; i++) {
+        struct FeedMeta *meta = &store->items[i];
+        fprintf(fp, "%s\t%s\t%s\t%016lx\t%ld\t%ld\t%d\t%ld\t%ld\t%ld\t%s\n", meta->url, meta->etag, meta->last_modified, meta->hash,
+                (long)meta->last_pub, meta->interval, meta->nunchanged, (long)meta->next_due, meta->ttfb, meta->ttfb_dev, meta->location);
+    }
+
+    if (fclose(fp) != 0 || rename(tmp_path, path) < 0) {
+        ERROR("Failed to write feed meta file: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+struct FeedMeta* feed_meta_get(struct FeedMetaStore *store, const char *url)
+{
+    if (store->length == 0)
+        return NULL;
+
+    size_t slot = feed_meta_slot(store, url);
+    return (store->table[slot] != 0) ? &store->items[store->table[slot]-1] : NULL;
+}
+
+struct FeedMeta* feed_meta_set(struct FeedMetaStore *store, const char *url)
+{
+    /* Get entry for url, create an empty one if it doesn't exist */
+    struct FeedMeta *meta = feed_meta_get(store, url);
+    if (meta != NULL)
+        return meta;
+
+    if (store->length >= store->max) {
+        size_t max = (store->max > 0) ? store->max * 2 : FEED_META_INIT_TABLE / 2;
+        struct FeedMeta *tmp = realloc(store->items, sizeof(struct FeedMeta) * max);
+        if (tmp == NULL) {
+            ERROR("Failed to grow feed meta store to %zu\n", max);
+            return NULL;
+        }
+        store->items = tmp;
+        store->max = max;
+    }
+
+    if ((store->length + 1) * 2 > store->table_size) {
+        size_t table_size = (store->table_size > 0) ? store->table_size * 2 : FEED_META_INIT_TABLE;
+        if (feed_meta_rehash(store, table_size) < 0)
+            return NULL;
+    }
+
+    meta = &store->items[store->length++];
+    feed_meta_copy_field(meta->url, url, PODCAST_MAX_URL);
+    meta->etag[0] = '\0';
+    meta->last_modified[0] = '\0';
+    meta->hash = 0;
+    meta->last_pub = 0;
+    meta->interval = 0;
+    meta->nunchanged = 0;
+    meta->next_due = 0;
+    meta->ttfb = 0;
+    meta->ttfb_dev = 0;
+    meta->location[0] = '\0';
+
+    // url may be cut off or have its tabs replaced, the stored url is the key
+    store->table[feed_meta_slot(store, meta->url)] = store->length;
+    return meta;
+}
+
+int feed_meta_set_hash(struct FeedMetaStore *store, struct FeedMeta *meta, uint64_t hash)
+{
+    if (meta->hash == hash)
+        return 0;
+
+    if (meta->hash != 0) {
+        struct FeedMetaHashCount *hc = feed_meta_hash_slot(store, meta->hash);
+        if (hc->count > 0)
+            hc->count--;
+    }
+    meta->hash = hash;
+    if (hash == 0)
+        return 0;
+
+    // rebuilding counts the new hash of meta as well
+    if ((store->nhashes + 1) * 2 > store->hashes_size)
+        return feed_meta_count_hashes(store);
+
+    struct FeedMetaHashCount *hc = feed_meta_hash_slot(store, hash);
+    if (hc->hash == 0) {
+        hc->hash = hash;
+        store->nhashes++;
+    }
+    hc->count++;
+    return 0;
+}
+
+int feed_meta_hash_used(struct FeedMetaStore *store, uint64_t hash)
+{
+    if (hash == 0 || store->nhashes == 0)
+        return 0;
+    return feed_meta_hash_slot(store, hash)->count > 0;
+}
+
+void feed_meta_add_pub_date(struct FeedPubDates *pd, time_t date)
+{
+    /* Keep the newest dates, when full the oldest date is replaced */
+    if (pd->length < FEED_META_MAX_PUB_DATES) {
+        pd->dates[pd->length++] = date;
+        return;
+    }
+
+    int oldest = 0;
+    for (int i=1 ; i<pd->length ; i++) {
+        if (pd->dates[i] < pd->dates[oldest])
+            oldest = i;
+    }
+    if (date > pd->dates[oldest])
+        pd->dates[oldest] = date;
+}
+
+static int feed_meta_time_cmp(const void *a, const void *b)
+{
+    const time_t *ta = a;
+    const time_t *tb = b;
+    return (*ta > *tb) - (*ta < *tb);
+}
+
+static int feed_meta_long_cmp(const void *a, const void *b)
+{
+    const long *la = a;
+    const long *lb = b;
+    return (*la > *lb) - (*la < *lb);
+}
+
+static void feed_meta_learn(struct FeedMeta *meta, struct FeedPubDates *pd)
+{
+    /* Set newest publication and median interval between publications.
+     * Median is used so a single hiatus or double release doesn't throw off the estimate */
+    long intervals[FEED_META_MAX_PUB_DATES];
+    int nintervals = 0;
+
+    if (pd->length == 0)
+        return;
+
+    qsort(pd->dates, pd->length, sizeof(time_t), feed_meta_time_cmp);
+    meta->last_pub = pd->dates[pd->length-1];
+
+    for (int i=1 ; i<pd->length ; i++) {
+        if (pd->dates[i] > pd->dates[i-1])
+            intervals[nintervals++] = pd->dates[i] - pd->dates[i-1];
+    }
+    if (nintervals == 0)
+        return;
+
+    qsort(intervals, nintervals, sizeof(long), feed_meta_long_cmp);
+    meta->interval = intervals[nintervals/2];
+}
+
+
+void feed_meta_update(struct FeedMeta *meta, struct FeedPubDates *pd, int changed, time_t now)
+{
+    /* Learn from a successful fetch and calculate when feed is due again.
+     * Feed is polled a few times per publication interval and backs off while nothing changes.
+     * It is not polled long before the next episode is expected */
+    if (changed) {
+        meta->nunchanged = 0;
+        if (pd != NULL)
+            feed_meta_learn(meta, pd);
+    }
+    else {
+        meta->nunchanged++;
+    }
+
+    long base = (meta->interval > 0) ? meta->interval / FEED_META_POLL_DIVISOR : FEED_META_MIN_POLL;
+    int shift = (meta->nunchanged < FEED_META_MAX_BACKOFF) ? meta->nunchanged : FEED_META_MAX_BACKOFF;
+
+    long poll = base << shift;
+    if (poll < FEED_META_MIN_POLL)
+        poll = FEED_META_MIN_POLL;
+    if (poll > FEED_META_MAX_POLL)
+        poll = FEED_META_MAX_POLL;
+
+    meta->next_due = now + poll;
+
+    if (meta->interval > 0 && meta->last_pub > 0) {
+        time_t expected = meta->last_pub + meta->interval - base;
+        if (expected > meta->next_due)
+            meta->next_due = (expected < now + FEED_META_MAX_POLL) ? expected : now + FEED_META_MAX_POLL;
+    }
+    DEBUG("Feed due in %lds, interval: %lds, unchanged: %d: %s\n", (long)(meta->next_due - now), meta->interval, meta->nunchanged, meta->url);
+}
+
+void feed_meta_update_ttfb(struct FeedMeta *meta, long ttfb)
+{
+    /* Smooth first byte time like TCP does with round trip times (RFC 6298) */
+    if (ttfb <= 0)
+        return;
+
+    if (meta->ttfb == 0) {
+        meta->ttfb = ttfb;
+        meta->ttfb_dev = ttfb / 2;
+        return;
+    }
+
+    long diff = (ttfb > meta->ttfb) ? ttfb - meta->ttfb : meta->ttfb - ttfb;
+    meta->ttfb_dev = (3 * meta->ttfb_dev + diff) / 4;
+    meta->ttfb = (7 * meta->ttfb + ttfb) / 8;
+}
+
+long feed_meta_hedge_ms(struct FeedMeta *meta)
+{
+    /* Time after which a request is slower than almost all earlier requests, -1 without history */
+    if (meta == NULL || meta->ttfb == 0)
+        return -1;
+    return meta->ttfb + 4 * meta->ttfb_dev;
+}
+
+int feed_meta_is_due(struct FeedMetaStore *store, const char *url, time_t now)
+{
+    /* Unknown feeds are always due */
+    struct FeedMeta *meta = feed_meta_get(store, url);
+    return meta == NULL || meta->next_due <= now;
+}
@@ -0,0 +1,114 @@
+#ifndef FEED_META_H
+#define FEED_META_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "podcast.h"
+#include "lib/hash/hash.h"
+
+// Per feed HTTP validators, used to make conditional GET requests.
+// Also holds the poll schedule of a feed, learned from the publication dates of its items.
+// Stored as tab separated lines: url, etag, last-modified, content hash, last publication,
+// publication interval, unchanged count, next due time, first byte time and its deviation
+// and the target of a permanent redirect
+
+#define FEED_META_INIT_TABLE   64
+#define FEED_META_MAX_ETAG    128
+#define FEED_META_MAX_DATE     64
+#define FEED_META_MAX_LINE    (2 * PODCAST_MAX_URL + FEED_META_MAX_ETAG + FEED_META_MAX_DATE + 96)
+
+// Amount of newest publication dates used to estimate the publication interval
+#define FEED_META_MAX_PUB_DATES 16
+
+// A feed is polled FEED_META_POLL_DIVISOR times per publication interval, the poll interval is
+// doubled for every fetch that didn't change the feed, up to FEED_META_MAX_BACKOFF times
+#define FEED_META_POLL_DIVISOR  8
+#define FEED_META_MAX_BACKOFF   4
+#define FEED_META_MIN_POLL      (60 * 60)
+#define FEED_META_MAX_POLL      (7 * 24 * 60 * 60)
+
+extern int do_debug;
+extern int do_error;
+
+struct FeedMeta {
+    char url[PODCAST_MAX_URL];
+    char etag[FEED_META_MAX_ETAG];
+    char last_modified[FEED_META_MAX_DATE];
+
+    // FNV-1a hash of last downloaded feed body
+    uint64_t hash;
+
+    // newest publication date and median time between publications, 0 if unknown
+    time_t last_pub;
+    long interval;
+
+    // consecutive fetches that returned 304 or an unchanged body
+    int nunchanged;
+
+    // feed is not fetched before this time, unless a refresh is forced
+    time_t next_due;
+
+    // smoothed time until first byte of response and its mean deviation in ms, 0 if unknown
+    long ttfb;
+    long ttfb_dev;
+
+    // feed moved permanently (301 or 308) to this url and is fetched from there, empty if not moved
+    char location[PODCAST_MAX_URL];
+};
+
+// Publication dates of the newest items in a feed, collected while parsing
+struct FeedPubDates {
+    time_t dates[FEED_META_MAX_PUB_DATES];
+    int length;
+};
+
+// Amount of feeds that point to one cached body
+struct FeedMetaHashCount {
+    uint64_t hash;
+    size_t count;
+};
+
+// Items are found by url in table. Body hashes are counted in hashes, so a cached body that no
+// feed uses anymore is found without going through all feeds. Pointers to items are valid until
+// the next feed_meta_set()
+struct FeedMetaStore {
+    struct FeedMeta *items;
+    size_t length;
+    size_t max;
+
+    // index+1 of item in items, 0 is empty. Size is a power of 2 and at least twice length
+    size_t *table;
+    size_t table_size;
+
+    // open addressing set of body hashes, hash 0 is empty. Slots of hashes that are no longer
+    // used stay until the set is rebuilt, nhashes counts them too
+    struct FeedMetaHashCount *hashes;
+    size_t nhashes;
+    size_t hashes_size;
+};
+
+void feed_meta_init(struct FeedMetaStore *store);
+void feed_meta_free(struct FeedMetaStore *store);
+int feed_meta_load(struct FeedMetaStore *store, const char *path);
+int feed_meta_save(struct FeedMetaStore *store, const char *path);
+struct FeedMeta* feed_meta_get(struct FeedMetaStore *store, const char *url);
+struct FeedMeta* feed_meta_set(struct FeedMetaStore *store, const char *url);
+
+// Set body hash of meta, use this instead of changing meta->hash so bodies are counted
+int feed_meta_set_hash(struct FeedMetaStore *store, struct FeedMeta *meta, uint64_t hash);
+
+// Returns 1 if a feed points to the body with hash
+int feed_meta_hash_used(struct FeedMetaStore *store, uint64_t hash);
+
+void feed_meta_add_pub_date(struct FeedPubDates *pd, time_t date);
+void feed_meta_update(struct FeedMeta *meta, struct FeedPubDates *pd, int changed, time_t now);
+void feed_meta_update_ttfb(struct FeedMeta *meta, long ttfb);
+long feed_meta_hedge_ms(struct FeedMeta *meta);
+int feed_meta_is_due(struct FeedMetaStore *store, const char *url, time_t now);
+
+#endif
@@ -0,0 +1,216 @@
+#include "guid_index.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+static uint64_t gi_mix(uint64_t key)
+{
+    /* Keys are FNV-1a hashes that have weak low bits, spread them over all bits */
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static size_t gi_file_size(uint64_t capacity)
+{
+    return sizeof(struct GIHeader) + capacity + capacity * sizeof(uint64_t);
+}
+
+static int gi_map(struct GuidIndex *gi, int fd, size_t size)
+{
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        ERROR("Failed to map guid index: %s: %s\n", gi->path, strerror(errno));
+        return -1;
+    }
+    gi->fd = fd;
+    gi->map_size = size;
+    gi->header = data;
+    gi->bloom = (uint8_t*)data + sizeof(struct GIHeader);
+    gi->slots = (uint64_t*)(gi->bloom + gi->header->capacity);
+    return 0;
+}
+
+static void gi_unmap(struct GuidIndex *gi)
+{
+    if (gi->header != NULL)
+        munmap(gi->header, gi->map_size);
+    if (gi->fd >= 0)
+        close(gi->fd);
+    gi->fd = -1;
+    gi->header = NULL;
+    gi->bloom = NULL;
+    gi->slots = NULL;
+    gi->map_size = 0;
+}
+
+static int gi_create(struct GuidIndex *gi, int fd, uint64_t capacity, uint64_t position)
+{
+    /* Size file for capacity, file is zeroed so all slots are empty */
+    struct GIHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = GI_MAGIC;
+    header.capacity = capacity;
+    header.position = position;
+
+    if (ftruncate(fd, 0) < 0 || ftruncate(fd, gi_file_size(capacity)) < 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        ERROR("Failed to create guid index: %s: %s\n", gi->path, strerror(errno));
+        return -1;
+    }
+    return gi_map(gi, fd, gi_file_size(capacity));
+}
+
+static void gi_insert(struct GuidIndex *gi, uint64_t key)
+{
+    /* Add key that isn't in the index, there is always a free slot */
+    uint64_t h = gi_mix(key);
+    uint64_t mask = gi->header->capacity - 1;
+    uint64_t nbits = gi->header->capacity * 8;
+
+    for (uint64_t i=h & mask ; ; i=(i+1) & mask) {
+        if (gi->slots[i] == 0) {
+            gi->slots[i] = key;
+            break;
+        }
+    }
+
+    // double hashing, k bit positions from two halves of the hash
+    uint64_t h1 = h & 0xffffffff;
+    uint64_t h2 = (h >> 32) | 1;
+    for (int i=0 ; i<GI_BLOOM_HASHES ; i++) {
+        uint64_t bit = (h1 + i * h2) % nbits;
+        gi->bloom[bit / 8] |= 1 << (bit % 8);
+    }
+    gi->header->nkeys++;
+}
+
+static int gi_grow(struct GuidIndex *gi)
+{
+    /* Rebuild table and filter with double capacity in a new file that replaces the old one */
+    char tmp_path[sizeof(gi->path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", gi->path);
+
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ERROR("Failed to create guid index: %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    struct GuidIndex old = *gi;
+    if (gi_create(gi, fd, old.header->capacity * 2, old.header->position) < 0) {
+        *gi = old;
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    for (uint64_t i=0 ; i<old.header->capacity ; i++) {
+        if (old.slots[i] != 0)
+            gi_insert(gi, old.slots[i]);
+    }
+
+    if (rename(tmp_path, gi->path) < 0) {
+        ERROR("Failed to rename guid index: %s: %s\n", tmp_path, strerror(errno));
+        gi_unmap(gi);
+        unlink(tmp_path);
+        *gi = old;
+        return -1;
+    }
+    DEBUG("Grew guid index to %ld slots\n", gi->header->capacity);
+    gi_unmap(&old);
+    return 0;
+}
+
+int gi_open(struct GuidIndex *gi, const char *path)
+{
+    /* Open index, a missing or invalid file results in an empty index */
+    struct stat st;
+    struct GIHeader header;
+
+    gi->fd = -1;
+    gi->header = NULL;
+    gi->map_size = 0;
+    if (strlen(path) >= sizeof(gi->path)) {
+        ERROR("Guid index path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(gi->path, path);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        ERROR("Failed to open guid index: %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    if (pread(fd, &header, sizeof(header), 0) == sizeof(header) && header.magic == GI_MAGIC &&
+        header.capacity >= GI_INIT_CAPACITY && (header.capacity & (header.capacity - 1)) == 0 &&
+        (size_t)st.st_size == gi_file_size(header.capacity)) {
+        return gi_map(gi, fd, st.st_size);
+    }
+
+    if (st.st_size > 0)
+        ERROR("Invalid guid index, starting empty: %s\n", path);
+    if (gi_create(gi, fd, GI_INIT_CAPACITY, 0) < 0) {
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+void gi_close(struct GuidIndex *gi)
+{
+    gi_unmap(gi);
+}
+
+int gi_clear(struct GuidIndex *gi)
+{
+    int fd = gi->fd;
+    munmap(gi->header, gi->map_size);
+    gi->header = NULL;
+    if (gi_create(gi, fd, GI_INIT_CAPACITY, 0) < 0) {
+        close(fd);
+        gi->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+int gi_contains(struct GuidIndex *gi, uint64_t key)
+{
+    key += (key == 0);
+    uint64_t h = gi_mix(key);
+    uint64_t nbits = gi->header->capacity * 8;
+    uint64_t h1 = h & 0xffffffff;
+    uint64_t h2 = (h >> 32) | 1;
+
+    // any bit not set means key was never added
+    for (int i=0 ; i<GI_BLOOM_HASHES ; i++) {
+        uint64_t bit = (h1 + i * h2) % nbits;
+        if ((gi->bloom[bit / 8] & (1 << (bit % 8))) == 0)
+            return 0;
+    }
+
+    uint64_t mask = gi->header->capacity - 1;
+    for (uint64_t i=h & mask ; gi->slots[i] != 0 ; i=(i+1) & mask) {
+        if (gi->slots[i] == key)
+            return 1;
+    }
+    return 0;
+}
+
+int gi_add(struct GuidIndex *gi, uint64_t key)
+{
+    if (gi_contains(gi, key))
+        return 0;
+
+    if ((gi->header->nkeys + 1) * 2 > gi->header->capacity && gi_grow(gi) < 0)
+        return -1;
+
+    gi_insert(gi, key + (key == 0));
+    return 1;
+}
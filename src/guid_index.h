@@ -0,0 +1,65 @@
+#ifndef GUID_INDEX_H
+#define GUID_INDEX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// Persistent set of 64 bit keys, used to find out if an episode is known without reading
+// the episode store. File is mapped into memory and changed in place:
+//
+//   header | bloom filter, capacity bytes | open addressing table, capacity keys
+//
+// The Bloom filter is checked first and answers most lookups of new keys without probing the
+// table, known keys are always confirmed in the table. Table is linear probed and is kept at
+// most half full, it is rebuilt in a new file with double capacity when it grows.
+// Key 0 marks an empty slot and is stored as 1.
+
+#define GI_MAGIC         0x31584447  // "GDX1"
+#define GI_INIT_CAPACITY 4096
+#define GI_BLOOM_HASHES  6
+
+extern int do_debug;
+extern int do_error;
+
+struct GIHeader {
+    uint32_t magic;
+    uint32_t reserved;
+
+    // amount of slots, power of 2
+    uint64_t capacity;
+    uint64_t nkeys;
+
+    // for the owner of the index, eg: amount of episode store records that are indexed
+    uint64_t position;
+};
+
+struct GuidIndex {
+    char path[256];
+    int fd;
+
+    // mapping of whole file
+    struct GIHeader *header;
+    uint8_t *bloom;
+    uint64_t *slots;
+    size_t map_size;
+};
+
+int gi_open(struct GuidIndex *gi, const char *path);
+void gi_close(struct GuidIndex *gi);
+
+// Remove all keys
+int gi_clear(struct GuidIndex *gi);
+
+int gi_contains(struct GuidIndex *gi, uint64_t key);
+
+// Returns 1 if key was added, 0 if it was in the index already
+int gi_add(struct GuidIndex *gi, uint64_t key);
+
+#endif
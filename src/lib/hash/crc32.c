@@ -0,0 +1,90 @@
+#include "crc32.h"
+
+#define CRC32_POLY 0xedb88320U
+
+static uint32_t crc32_table[256];
+static int crc32_table_is_init = 0;
+
+static void crc32_table_init()
+{
+    for (uint32_t i=0 ; i<256 ; i++) {
+        uint32_t c = i;
+        for (int k=0 ; k<8 ; k++)
+            c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        crc32_table[i] = c;
+    }
+    crc32_table_is_init = 1;
+}
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size)
+{
+    const unsigned char *c = data;
+
+    if (!crc32_table_is_init)
+        crc32_table_init();
+
+    for (size_t i=0 ; i<size ; i++, c++)
+        crc = crc32_table[(crc ^ *c) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+uint32_t crc32_final(uint32_t crc)
+{
+    return crc ^ 0xffffffffU;
+}
+
+static uint32_t crc32_gf2_times(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    for (; vec ; vec >>= 1, mat++) {
+        if (vec & 1)
+            sum ^= *mat;
+    }
+    return sum;
+}
+
+static void crc32_gf2_square(uint32_t *square, const uint32_t *mat)
+{
+    for (int n=0 ; n<32 ; n++)
+        square[n] = crc32_gf2_times(mat, mat[n]);
+}
+
+uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, int64_t length_b)
+{
+    /* Apply length_b zero bytes to crc_a using a GF(2) matrix that is squared for
+     * every bit of the length, as done by zlib. Cost is log(length_b) */
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    if (length_b <= 0)
+        return crc_a;
+
+    // operator for one zero bit
+    odd[0] = CRC32_POLY;
+    uint32_t row = 1;
+    for (int n=1 ; n<32 ; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    // operators for two and four zero bits
+    crc32_gf2_square(even, odd);
+    crc32_gf2_square(odd, even);
+
+    do {
+        crc32_gf2_square(even, odd);
+        if (length_b & 1)
+            crc_a = crc32_gf2_times(even, crc_a);
+        length_b >>= 1;
+
+        if (length_b == 0)
+            break;
+
+        crc32_gf2_square(odd, even);
+        if (length_b & 1)
+            crc_a = crc32_gf2_times(odd, crc_a);
+        length_b >>= 1;
+    } while (length_b != 0);
+
+    return crc_a ^ crc_b;
+}
@@ -0,0 +1,23 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, same as zlib and gzip), used to checksum downloads while they stream in:
+//     uint32_t crc = CRC32_INIT;
+//     crc = crc32_update(crc, chunk, size);
+//     ...
+//     crc = crc32_final(crc);
+// Checksums of adjacent pieces can be combined, so data that arrives out of order, eg:
+// in byte ranges, can be checksummed per range.
+
+#define CRC32_INIT 0xffffffffU
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size);
+uint32_t crc32_final(uint32_t crc);
+
+// Return CRC of A+B from final CRCs of A and B and length of B
+uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, int64_t length_b);
+
+#endif
@@ -0,0 +1,22 @@
+#include "hash.h"
+
+
+uint64_t hash_update(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *c = data;
+    for (size_t i=0 ; i<size ; i++, c++) {
+        hash ^= *c;
+        hash *= HASH_PRIME;
+    }
+    return hash;
+}
+
+uint64_t hash_data(const void *data, size_t size)
+{
+    return hash_update(HASH_INIT, data, size);
+}
+
+uint64_t hash_str(const char *str)
+{
+    return hash_update(HASH_INIT, str, strlen(str));
+}
@@ -0,0 +1,20 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// 64 bit FNV-1a, fast non-cryptographic hash for keys, GUIDs and content addressing.
+// Can be computed incrementally while data streams in:
+//     uint64_t h = HASH_INIT;
+//     h = hash_update(h, chunk, size);
+
+#define HASH_INIT  0xcbf29ce484222325ULL
+#define HASH_PRIME 0x100000001b3ULL
+
+uint64_t hash_update(uint64_t hash, const void *data, size_t size);
+uint64_t hash_data(const void *data, size_t size);
+uint64_t hash_str(const char *str);
+
+#endif
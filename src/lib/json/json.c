@@ -1,12 +1,8 @@
 #include "json.h"
 
-#define DO_DEBUG 1
-#define DO_INFO  1
-#define DO_ERROR 1
-
-#define DEBUG(M, ...) if(DO_DEBUG){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
-#define INFO(M, ...) if(DO_INFO){fprintf(stdout, M, ##__VA_ARGS__);}
-#define ERROR(M, ...) if(DO_ERROR){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define INFO(M, ...) if(do_info){fprintf(stdout, M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
 
 
 
@@ -17,9 +13,18 @@ struct JSON json_init(void(*handle_data_cb)(struct JSON *json, enum JSONEvent ev
     json.stack_pos = -1;
     memset(json.stack, 0, sizeof(json.stack));
     json.user_data = NULL;
+    json.record = 0;
+    json.is_complete = 0;
+    json.record_offset = 0;
     return json;
 }
 
+void json_reset(struct JSON *json)
+{
+    json->stack_pos = -1;
+    memset(json->stack, 0, sizeof(json->stack));
+}
+
 static struct Position pos_init(char **chunks, size_t nchunks)
 {
     struct Position pos;
@@ -68,7 +73,9 @@ static enum JSONParseResult fforward_skip_escaped(struct Position *pos, char *se
     // TODO char can not be -1
 
     // save skipped chars that are on expected_lst in buffer
+    // data that doesn't fit in the parse buffer is cut off
     char* ptr = buf;
+    char* end = buf + JSON_MAX_PARSE_BUFFER - 1;
 
     // don't return these chars with buffer
     ignore_lst = (ignore_lst) ? ignore_lst : "";
@@ -89,11 +96,14 @@ static enum JSONParseResult fforward_skip_escaped(struct Position *pos, char *se
             if (!strchr(expected_lst, *(pos->c)))
                 return JSON_PARSE_ILLEGAL_CHAR;
         }
-        if (buf != NULL && !strchr(ignore_lst, *(pos->c)))
+        if (buf != NULL && ptr < end && !strchr(ignore_lst, *(pos->c)))
             *ptr++ = *(pos->c);
 
-        if (pos_next(pos) < 0)
+        if (pos_next(pos) < 0) {
+            if (ptr != NULL)
+                *ptr = '\0';
             return JSON_PARSE_END_OF_DATA;
+        }
     }
     // terminate string
     if (ptr != NULL)
@@ -161,7 +171,8 @@ static struct JSONItem json_item_init(enum JSONDtype dtype, char *data)
 {
     struct JSONItem ji;
     ji.dtype = dtype;
-    strncpy(ji.data, data, JSON_MAX_DATA);
+    strncpy(ji.data, data, JSON_MAX_DATA-1);
+    ji.data[JSON_MAX_DATA-1] = '\0';
     return ji;
 }
 
@@ -169,7 +180,7 @@ static struct JSONItem json_item_init(enum JSONDtype dtype, char *data)
 /* Stack operations */
 static int stack_put(struct JSON *json, struct JSONItem ji)
 {
-    ASSERTF(json->stack_pos <= JSON_MAX_STACK -1, "Can't PUT, stack is full!\n");
+    ASSERTF(json->stack_pos < JSON_MAX_STACK -1, "Can't PUT, stack is full!\n");
 
     (json->stack_pos)++;
     memcpy(&(json->stack[json->stack_pos]), &ji, sizeof(struct JSONItem));
@@ -338,10 +349,10 @@ enum JSONParseResult json_parse_string(struct JSON *json, struct Position *pos,
         DEBUG("Failed to find closing quotes\n");
         return JSON_PARSE_INCOMPLETE;
     }
-    if (stack_last_is_key(json) || stack_last_is_array(json))
-        ji = json_item_init(JSON_DTYPE_STRING, buf);
-    else if (stack_last_is_object(json))
+    if (stack_last_is_object(json))
         ji = json_item_init(JSON_DTYPE_KEY, buf);
+    else
+        ji = json_item_init(JSON_DTYPE_STRING, buf);
 
     stack_put(json, ji);
     if (ji.dtype == JSON_DTYPE_KEY)
@@ -360,7 +371,13 @@ enum JSONParseResult json_parse_string(struct JSON *json, struct Position *pos,
 
 static int json_parse_number(struct JSON *json, struct Position *pos, char *buf)
 {
-    if (fforward_skip_escaped(pos, ", ]}\n", "0123456789-null.", NULL, "\n", buf) < JSON_PARSE_SUCCESS) {
+    /* Returns 1 when number is terminated by end of data */
+    enum JSONParseResult res = fforward_skip_escaped(pos, ", ]}\n", "0123456789-null.", NULL, "\n", buf);
+
+    // when data is complete, end of data also ends the number
+    if (res == JSON_PARSE_END_OF_DATA && json->is_complete)
+        ;
+    else if (res < JSON_PARSE_SUCCESS) {
         DEBUG("Failed to find end of number\n");
         return -1;
     }
@@ -369,12 +386,17 @@ static int json_parse_number(struct JSON *json, struct Position *pos, char *buf)
     stack_put(json, ji);
     json->handle_data_cb(json, JSON_EV_NUMBER, json->user_data);
     stack_pop(json);
-    return 0;
+    return (res == JSON_PARSE_END_OF_DATA);
 }
 
 static int json_parse_bool(struct JSON *json, struct Position *pos, char *buf)
 {
-    if (fforward_skip_escaped(pos, ", ]}\n", "truefalse", NULL, "\n", buf) < JSON_PARSE_SUCCESS) {
+    /* Returns 1 when bool is terminated by end of data */
+    enum JSONParseResult res = fforward_skip_escaped(pos, ", ]}\n", "truefalse", NULL, "\n", buf);
+
+    if (res == JSON_PARSE_END_OF_DATA && json->is_complete)
+        ;
+    else if (res < JSON_PARSE_SUCCESS) {
         DEBUG("Failed to find end of boolean: %c\n", *pos->c);
         return -1;
     }
@@ -382,7 +404,7 @@ static int json_parse_bool(struct JSON *json, struct Position *pos, char *buf)
     stack_put(json, ji);
     json->handle_data_cb(json, JSON_EV_BOOL, json->user_data);
     stack_pop(json);
-    return 0;
+    return (res == JSON_PARSE_END_OF_DATA);
 }
 
 void json_handle_data_cb(struct JSON *json, enum JSONEvent ev, void *user_data)
@@ -542,15 +564,21 @@ size_t json_parse(struct JSON *json, char **chunks, size_t nchunks)
         }
 
         else if (strchr("0123456789-n.", *pos.c)) {
-            if (json_parse_number(json, &pos, tmp) < 0)
+            int res_num = json_parse_number(json, &pos, tmp);
+            if (res_num < 0)
                 break;
             nread = pos.npos;
+            if (res_num > 0)
+                break;
         }
 
         else if (strchr("tf", *pos.c)) {
-            if (json_parse_bool(json, &pos, tmp) < 0)
+            int res_bool = json_parse_bool(json, &pos, tmp);
+            if (res_bool < 0)
                 break;
             nread = pos.npos;
+            if (res_bool > 0)
+                break;
         }
         else {
             ERROR("Unhandled: %c\n", *pos.c);
@@ -14,7 +14,7 @@
 // eg: {object, key, array, string}
 // Everytime the last object is done parsing, it is removed from the stack.
 // When a new object is found, it is pushed onto the stack.
-#define JSON_MAX_STACK 8
+#define JSON_MAX_STACK 16
 
 // The buffer that holds the temporary data that is copied to the JSONItem while parsing
 // If it is too small, the stream data will probably become corrupt
@@ -31,6 +31,10 @@
 #define JCYAN    "\x1B[36m"
 #define JWHITE   "\x1B[37m"
 
+extern int do_debug;
+extern int do_info;
+extern int do_error;
+
 #define ASSERTF(A, M, ...) if(!(A)) {ERROR(M, ##__VA_ARGS__); assert(A); }
 
 enum JSONDtype {
@@ -99,6 +103,15 @@ struct JSON {
 
     // pointer to userdata is passed to callback
     void *user_data;
+
+    // When parsing records (NDJSON or array elements, see json_records.h) these hold the
+    // index of the current record and its offset in the input.
+    size_t record;
+    size_t record_offset;
+
+    // Input holds complete values, so end of data also terminates a number or bool.
+    // When streaming, end of data means that we have to wait for more data.
+    int is_complete;
 };
 
 
@@ -117,4 +130,7 @@ void json_handle_data_cb(struct JSON *json, enum JSONEvent ev, void *user_data);
 
 int stack_item_is_type(struct JSON *json, int offset, enum JSONDtype dtype);
 
+// Reset stack so parser can start at a new top-level value
+void json_reset(struct JSON *json);
+
 #endif
@@ -0,0 +1,245 @@
+#include "json_bind.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define INFO(M, ...) if(do_info){fprintf(stdout, M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+
+int json_bind_schema_compile(struct JSONBindSchema *schema)
+{
+    /* Fill open addressing table with key hashes so keys can be found without string compares */
+    if (schema->is_compiled)
+        return 0;
+
+    assert((JSON_BIND_TABLE_SIZE & (JSON_BIND_TABLE_SIZE-1)) == 0);  // table size must be a power of 2
+
+    if (schema->nfields * 2 > JSON_BIND_TABLE_SIZE) {
+        ERROR("Failed to compile schema, too many fields: %ld\n", schema->nfields);
+        return -1;
+    }
+
+    memset(schema->slots, 0, sizeof(schema->slots));
+    schema->scalar_field = -1;
+    schema->array_key_hash = (schema->array_key) ? hash_str(schema->array_key) : 0;
+
+    for (size_t i=0 ; i<schema->nfields ; i++) {
+        const struct JSONBindField *f = &schema->fields[i];
+
+        if (f->name == NULL) {
+            schema->scalar_field = i;
+            continue;
+        }
+
+        uint64_t hash = hash_str(f->name);
+        size_t slot = hash & (JSON_BIND_TABLE_SIZE-1);
+
+        while (schema->slots[slot] != 0) {
+            if (schema->hashes[slot] == hash) {
+                ERROR("Failed to compile schema, duplicate key: %s\n", f->name);
+                return -1;
+            }
+            slot = (slot + 1) & (JSON_BIND_TABLE_SIZE-1);
+        }
+        schema->hashes[slot] = hash;
+        schema->slots[slot] = i + 1;
+    }
+    schema->is_compiled = 1;
+    return 0;
+}
+
+static int json_bind_find_field(struct JSONBindSchema *schema, const char *key)
+{
+    uint64_t hash = hash_str(key);
+    size_t slot = hash & (JSON_BIND_TABLE_SIZE-1);
+
+    while (schema->slots[slot] != 0) {
+        if (schema->hashes[slot] == hash)
+            return schema->slots[slot] - 1;
+        slot = (slot + 1) & (JSON_BIND_TABLE_SIZE-1);
+    }
+    return -1;
+}
+
+static void json_bind_reset(struct JSONBind *bind, struct JSONBindSchema *schema)
+{
+    bind->schema = schema;
+    bind->nrecords = 0;
+    bind->overflow = 0;
+    bind->array_pos = -1;
+    bind->field = -1;
+    bind->in_record = 0;
+}
+
+int json_bind_init(struct JSONBind *bind, struct JSONBindSchema *schema, void *records, size_t max_records)
+{
+    if (json_bind_schema_compile(schema) < 0)
+        return -1;
+
+    json_bind_reset(bind, schema);
+    bind->records = records;
+    bind->max_records = max_records;
+    bind->growable = 0;
+    return 0;
+}
+
+int json_bind_init_growable(struct JSONBind *bind, struct JSONBindSchema *schema)
+{
+    if (json_bind_schema_compile(schema) < 0)
+        return -1;
+
+    json_bind_reset(bind, schema);
+    bind->growable = 1;
+    bind->max_records = JSON_BIND_INIT_RECORDS;
+    bind->records = malloc(schema->record_size * bind->max_records);
+    if (bind->records == NULL) {
+        ERROR("Failed to allocate records\n");
+        return -1;
+    }
+    return 0;
+}
+
+void json_bind_free(struct JSONBind *bind)
+{
+    if (bind->growable)
+        free(bind->records);
+    bind->records = NULL;
+    bind->nrecords = 0;
+    bind->max_records = 0;
+}
+
+static void* json_bind_new_record(struct JSONBind *bind)
+{
+    /* Return zeroed record or NULL if there is no room */
+    size_t size = bind->schema->record_size;
+
+    if (bind->nrecords >= bind->max_records) {
+        if (!bind->growable) {
+            if (!bind->overflow)
+                ERROR("Failed to bind record, limit reached: %ld\n", bind->max_records);
+            bind->overflow = 1;
+            return NULL;
+        }
+        void *tmp = realloc(bind->records, size * bind->max_records * 2);
+        if (tmp == NULL) {
+            ERROR("Failed to grow records to %ld\n", bind->max_records * 2);
+            bind->overflow = 1;
+            return NULL;
+        }
+        bind->records = tmp;
+        bind->max_records *= 2;
+    }
+    void *record = (char*)bind->records + size * bind->nrecords;
+    memset(record, 0, size);
+    return record;
+}
+
+static void json_bind_set_value(const struct JSONBindField *f, void *record, const char *data)
+{
+    char *dst = (char*)record + f->offset;
+
+    switch (f->type) {
+        case JSON_BIND_STRING:
+            strncpy(dst, data, f->max_length-1);
+            dst[f->max_length-1] = '\0';
+            break;
+        case JSON_BIND_INT:
+            *(int*)dst = strtol(data, NULL, 10);
+            break;
+        case JSON_BIND_LONG:
+            *(long*)dst = strtol(data, NULL, 10);
+            break;
+        case JSON_BIND_BOOL:
+            *(int*)dst = (strcmp(data, "true") == 0);
+            break;
+        case JSON_BIND_ENUM:
+            *(int*)dst = -1;
+            for (int i=0 ; f->enum_names[i] != NULL ; i++) {
+                if (strcmp(f->enum_names[i], data) == 0) {
+                    *(int*)dst = i;
+                    break;
+                }
+            }
+            break;
+    }
+}
+
+static int json_bind_is_null(enum JSONEvent ev, const char *data)
+{
+    /* The parser reports null as a number with the text "null", a quoted "null" is a string */
+    return ev == JSON_EV_NUMBER && strcmp(data, "null") == 0;
+}
+
+static int json_bind_is_records_array(struct JSONBind *bind, struct JSON *json)
+{
+    /* Records are in a top-level array, or in the array at array_key in a top-level object */
+    if (json->stack_pos == 0)
+        return 1;
+
+    if (json->stack_pos == 2 && bind->schema->array_key != NULL) {
+        struct JSONItem *key = stack_get_from_end(json, 1);
+        return stack_item_is_type(json, 2, JSON_DTYPE_OBJECT) == 1 &&
+               key->dtype == JSON_DTYPE_KEY &&
+               hash_str(key->data) == bind->schema->array_key_hash;
+    }
+    return 0;
+}
+
+void json_bind_handle_data_cb(struct JSON *json, enum JSONEvent ev, void *user_data)
+{
+    struct JSONBind *bind = user_data;
+    struct JSONBindSchema *schema = bind->schema;
+    struct JSONItem *ji = stack_get_from_end(json, 0);
+    int pos = json->stack_pos;
+
+    switch (ev) {
+        case JSON_EV_ARRAY_START:
+            if (bind->array_pos < 0 && json_bind_is_records_array(bind, json))
+                bind->array_pos = pos;
+            break;
+
+        case JSON_EV_ARRAY_END:
+            if (pos == bind->array_pos)
+                bind->array_pos = -1;
+            break;
+
+        case JSON_EV_OBJECT_START:
+            if (bind->array_pos >= 0 && pos == bind->array_pos+1)
+                bind->in_record = (json_bind_new_record(bind) != NULL);
+            break;
+
+        case JSON_EV_OBJECT_END:
+            if (bind->in_record && pos == bind->array_pos+1) {
+                bind->nrecords++;
+                bind->in_record = 0;
+            }
+            break;
+
+        case JSON_EV_KEY:
+            if (bind->in_record && pos == bind->array_pos+2)
+                bind->field = json_bind_find_field(schema, ji->data);
+            break;
+
+        case JSON_EV_STRING:
+        case JSON_EV_NUMBER:
+        case JSON_EV_BOOL:
+            // value in record: {array, object, key, value}
+            if (bind->in_record && pos == bind->array_pos+3) {
+                // null leaves the field unset
+                if (bind->field >= 0 && !json_bind_is_null(ev, ji->data)) {
+                    void *record = (char*)bind->records + schema->record_size * bind->nrecords;
+                    json_bind_set_value(&schema->fields[bind->field], record, ji->data);
+                }
+                bind->field = -1;
+            }
+            // scalar in records array: {array, value}
+            else if (bind->array_pos >= 0 && pos == bind->array_pos+1 && schema->scalar_field >= 0 &&
+                     !json_bind_is_null(ev, ji->data)) {
+                void *record = json_bind_new_record(bind);
+                if (record != NULL) {
+                    json_bind_set_value(&schema->fields[schema->scalar_field], record, ji->data);
+                    bind->nrecords++;
+                }
+            }
+            break;
+    }
+}
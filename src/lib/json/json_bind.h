@@ -0,0 +1,96 @@
+#ifndef JSON_BIND_H
+#define JSON_BIND_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>     // offsetof
+#include <string.h>
+#include <assert.h>
+
+#include "json.h"
+#include "lib/hash/hash.h"
+
+// Bind JSON objects to C structs using a static table of field descriptors.
+// Records are the objects in a records array, that is a top-level array or the array
+// under schema.array_key in a top-level object, eg: {"actions": [{...}, {...}]}.
+// Values are written straight into the record struct, keys are looked up by their hash.
+// A null value leaves the field as it is, zeroed in a new record.
+//
+// Use json_bind_handle_data_cb() as JSON callback with a struct JSONBind as user data.
+
+// Size of the key hash table, must be a power of 2 and bigger than twice the amount of fields
+#define JSON_BIND_TABLE_SIZE 64
+
+// Initial amount of records when records array is allocated by binder
+#define JSON_BIND_INIT_RECORDS 64
+
+enum JSONBindType {
+    JSON_BIND_STRING,       // char array of max_length bytes, value is cut off if too long
+    JSON_BIND_INT,          // int
+    JSON_BIND_LONG,         // long
+    JSON_BIND_BOOL,         // int, 1 or 0
+    JSON_BIND_ENUM          // int, index of value in enum_names or -1 if not found
+};
+
+struct JSONBindField {
+    // key in record object. NULL binds values in an array of scalars, eg: ["a", "b"]
+    const char *name;
+    size_t offset;
+    enum JSONBindType type;
+    size_t max_length;
+    const char **enum_names;    // NULL terminated
+};
+
+struct JSONBindSchema {
+    const struct JSONBindField *fields;
+    size_t nfields;
+    size_t record_size;
+
+    // key of records array in top-level object, NULL if records are only in a top-level array
+    const char *array_key;
+
+    // precomputed by json_bind_schema_compile()
+    int is_compiled;
+    uint64_t array_key_hash;
+    uint64_t hashes[JSON_BIND_TABLE_SIZE];
+    int slots[JSON_BIND_TABLE_SIZE];    // index+1 of field, 0 if empty
+    int scalar_field;                   // field without name or -1
+};
+
+#define JSON_BIND_SCHEMA(TYPE, FIELDS, ARRAY_KEY) { FIELDS, sizeof(FIELDS)/sizeof(*FIELDS), sizeof(TYPE), ARRAY_KEY, 0, 0, {0}, {0}, -1 }
+
+struct JSONBind {
+    struct JSONBindSchema *schema;
+
+    void *records;
+    size_t nrecords;
+    size_t max_records;
+
+    // records are allocated by binder and grow when full, free with json_bind_free()
+    int growable;
+
+    // set when records didn't fit
+    int overflow;
+
+    // stack position of the records array, -1 if not in records array
+    int array_pos;
+
+    // field that belongs to last found key, -1 if key is not bound
+    int field;
+
+    int in_record;
+};
+
+int json_bind_schema_compile(struct JSONBindSchema *schema);
+
+// Bind to a fixed size array of records
+int json_bind_init(struct JSONBind *bind, struct JSONBindSchema *schema, void *records, size_t max_records);
+
+// Bind to an array of records that is allocated and grown by the binder
+int json_bind_init_growable(struct JSONBind *bind, struct JSONBindSchema *schema);
+void json_bind_free(struct JSONBind *bind);
+
+void json_bind_handle_data_cb(struct JSON *json, enum JSONEvent ev, void *user_data);
+
+#endif
@@ -0,0 +1,121 @@
+#include "json_records.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define INFO(M, ...) if(do_info){fprintf(stdout, M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+int json_records_init(struct JSONRecords *records)
+{
+    records->length = 0;
+    records->size = JSON_RECORDS_INIT_SIZE;
+    records->parent = JSON_DTYPE_UNKNOWN;
+    records->records = malloc(sizeof(struct JSONRecord) * records->size);
+    if (records->records == NULL) {
+        ERROR("Failed to allocate records\n");
+        return -1;
+    }
+    return 0;
+}
+
+void json_records_free(struct JSONRecords *records)
+{
+    free(records->records);
+    records->records = NULL;
+    records->length = 0;
+    records->size = 0;
+}
+
+int json_records_add(struct JSONRecords *records, size_t offset, size_t length)
+{
+    if (records->length >= records->size) {
+        struct JSONRecord *tmp = realloc(records->records, sizeof(struct JSONRecord) * records->size * 2);
+        if (tmp == NULL) {
+            ERROR("Failed to grow records to %ld\n", records->size * 2);
+            return -1;
+        }
+        records->records = tmp;
+        records->size *= 2;
+    }
+    records->records[records->length].offset = offset;
+    records->records[records->length].length = length;
+    records->length++;
+    return 0;
+}
+
+static int json_is_blank(const char *buf, size_t size)
+{
+    for (size_t i=0 ; i<size ; i++) {
+        if (!strchr(" \t\r", buf[i]))
+            return 0;
+    }
+    return 1;
+}
+
+int json_ndjson_split(const char *buf, size_t size, struct JSONRecords *records)
+{
+    /* JSON strings can't contain raw newlines so every newline is a record boundary */
+    const char *start = buf;
+    const char *end = buf + size;
+
+    while (start < end) {
+        const char *nl = memchr(start, '\n', end - start);
+        if (nl == NULL)
+            nl = end;
+
+        if (!json_is_blank(start, nl - start)) {
+            if (json_records_add(records, start - buf, nl - start) < 0)
+                return -1;
+        }
+        start = nl + 1;
+    }
+    return records->length;
+}
+
+static int json_parse_record_at(struct JSON *json, char *start, size_t length, size_t index, size_t offset, enum JSONDtype parent)
+{
+    /* Record is NUL terminated in place, start[length] must be inside the buffer.
+     * Callers own buffers of size + 1 bytes, see json_records.h */
+    char *end = start + length;
+    char c = *end;
+    *end = '\0';
+
+    json_reset(json);
+    json->record = index;
+    json->record_offset = offset;
+    json->is_complete = 1;
+
+    // stack position when record is parsed completely
+    int stack_pos = -1;
+
+    if (parent != JSON_DTYPE_UNKNOWN) {
+        json->stack_pos = ++stack_pos;
+        json->stack[0].dtype = parent;
+        json->stack[0].data[0] = '\0';
+    }
+
+    char *chunks[2] = {start, NULL};
+    size_t nread = json_parse(json, chunks, 2);
+
+    *end = c;
+
+    if (nread == (size_t)-1 || json->stack_pos != stack_pos) {
+        ERROR("Failed to parse record %ld @ %ld\n", index, offset);
+        return -1;
+    }
+    return 0;
+}
+
+int json_parse_record(struct JSON *json, char *buf, struct JSONRecords *records, size_t index)
+{
+    struct JSONRecord *record = &records->records[index];
+    return json_parse_record_at(json, buf + record->offset, record->length, index, record->offset, records->parent);
+}
+
+int json_parse_records(struct JSON *json, char *buf, struct JSONRecords *records)
+{
+    for (size_t i=0 ; i<records->length ; i++) {
+        if (json_parse_record(json, buf, records, i) < 0)
+            return -1;
+    }
+    return records->length;
+}
@@ -0,0 +1,56 @@
+#ifndef JSON_RECORDS_H
+#define JSON_RECORDS_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "json.h"
+
+// A record is a top-level JSON value somewhere in a bigger buffer, eg: a line in an
+// NDJSON (JSON Lines) file. Parser state is reset for every record so the stack only
+// needs to hold the nesting of one record, and records can be parsed independently.
+//
+// The parser stops at a NUL byte, so a record is terminated while it is parsed by writing
+// a NUL right behind it. Buffers that are split into records must be writable and have one
+// byte of room after the data: size + 1 bytes for size bytes of data. This byte is written
+// when the last record runs up to the end of the data, eg: NDJSON without a trailing newline.
+
+// Initial size of record list, grows by doubling
+#define JSON_RECORDS_INIT_SIZE 64
+
+typedef void(*json_data_cb)(struct JSON *json, enum JSONEvent ev, void *user_data);
+
+struct JSONRecord {
+    size_t offset;
+    size_t length;
+};
+
+struct JSONRecords {
+    struct JSONRecord *records;
+    size_t length;
+    size_t size;
+
+    // Container the records are in. JSON_DTYPE_ARRAY for elements of a top-level array,
+    // the array is then put on the stack before parsing a record so callbacks see the
+    // same stack as when the whole document is parsed at once.
+    enum JSONDtype parent;
+};
+
+int  json_records_init(struct JSONRecords *records);
+void json_records_free(struct JSONRecords *records);
+int  json_records_add(struct JSONRecords *records, size_t offset, size_t length);
+
+// Find lines in buf, empty lines are skipped. buf must have room for size + 1 bytes
+int json_ndjson_split(const char *buf, size_t size, struct JSONRecords *records);
+
+// Parse record at index. buf must be writable because the record is temporarily NUL terminated,
+// and must be one byte bigger than the data it was split from, see above.
+// json->record and json->record_offset are set so the callback knows where the data comes from.
+int json_parse_record(struct JSON *json, char *buf, struct JSONRecords *records, size_t index);
+
+// Parse all records with one parser, returns amount of records or -1 on error.
+int json_parse_records(struct JSON *json, char *buf, struct JSONRecords *records);
+
+#endif
@@ -0,0 +1,244 @@
+#include "json_writer.h"
+
+#define DO_ERROR 1
+
+#define ERROR(M, ...) if(DO_ERROR){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+
+int jw_init(struct JSONWriter *jw, size_t size)
+{
+    memset(jw, 0, sizeof(struct JSONWriter));
+
+    if (size == 0)
+        size = JSON_WRITER_INIT_SIZE;
+
+    if ((jw->buf = malloc(size)) == NULL) {
+        ERROR("Failed to allocate JSON writer buffer\n");
+        return -1;
+    }
+    jw->size = size;
+    jw->buf[0] = '\0';
+    return 0;
+}
+
+void jw_free(struct JSONWriter *jw)
+{
+    free(jw->buf);
+    jw->buf = NULL;
+    jw->size = 0;
+    jw->length = 0;
+    jw->offset = 0;
+}
+
+void jw_reset(struct JSONWriter *jw)
+{
+    /* Empty buffer and state but keep the allocated memory */
+    jw->length = 0;
+    jw->offset = 0;
+    jw->depth = 0;
+    jw->after_key = 0;
+    memset(jw->need_comma, 0, sizeof(jw->need_comma));
+}
+
+static int jw_reserve(struct JSONWriter *jw, size_t n)
+{
+    /* Make sure there is room for n more bytes.
+     * Read data is discarded first, only grow when that is not enough */
+    if (jw->offset > 0) {
+        memmove(jw->buf, jw->buf + jw->offset, jw->length - jw->offset);
+        jw->length -= jw->offset;
+        jw->offset = 0;
+    }
+
+    if (jw->length + n < jw->size)
+        return 0;
+
+    size_t size = jw->size;
+    while (jw->length + n >= size)
+        size *= 2;
+
+    char *buf = realloc(jw->buf, size);
+    if (buf == NULL) {
+        ERROR("Failed to grow JSON writer buffer to %ld bytes\n", size);
+        return -1;
+    }
+    jw->buf = buf;
+    jw->size = size;
+    return 0;
+}
+
+static int jw_write(struct JSONWriter *jw, const char *data, size_t n)
+{
+    if (jw_reserve(jw, n) < 0)
+        return -1;
+    memcpy(jw->buf + jw->length, data, n);
+    jw->length += n;
+    return 0;
+}
+
+static int jw_separator(struct JSONWriter *jw)
+{
+    /* Write comma between values, a value directly after a key doesn't need one */
+    if (jw->after_key) {
+        jw->after_key = 0;
+        return 0;
+    }
+    if (jw->need_comma[jw->depth] && jw_write(jw, ",", 1) < 0)
+        return -1;
+
+    jw->need_comma[jw->depth] = 1;
+    return 0;
+}
+
+static int jw_write_escaped(struct JSONWriter *jw, const char *str)
+{
+    /* Write quoted string, escape quotes, backslashes and control chars */
+    const char *hex = "0123456789abcdef";
+
+    // worst case every char becomes \u00XX
+    if (jw_reserve(jw, strlen(str) * 6 + 2) < 0)
+        return -1;
+
+    char *ptr = jw->buf + jw->length;
+    *ptr++ = '"';
+
+    for (const unsigned char *c = (const unsigned char*)str ; *c != '\0' ; c++) {
+        switch (*c) {
+            case '"':
+            case '\\':
+                *ptr++ = '\\';
+                *ptr++ = *c;
+                break;
+            case '\n':
+                *ptr++ = '\\';
+                *ptr++ = 'n';
+                break;
+            case '\r':
+                *ptr++ = '\\';
+                *ptr++ = 'r';
+                break;
+            case '\t':
+                *ptr++ = '\\';
+                *ptr++ = 't';
+                break;
+            default:
+                if (*c < 0x20) {
+                    *ptr++ = '\\';
+                    *ptr++ = 'u';
+                    *ptr++ = '0';
+                    *ptr++ = '0';
+                    *ptr++ = hex[*c >> 4];
+                    *ptr++ = hex[*c & 0x0f];
+                }
+                else {
+                    *ptr++ = *c;
+                }
+        }
+    }
+    *ptr++ = '"';
+    jw->length = ptr - jw->buf;
+    return 0;
+}
+
+static int jw_open(struct JSONWriter *jw, char c)
+{
+    if (jw->depth >= JSON_WRITER_MAX_DEPTH-1) {
+        ERROR("Failed to open JSON container, max depth reached: %d\n", JSON_WRITER_MAX_DEPTH);
+        return -1;
+    }
+    if (jw_separator(jw) < 0 || jw_write(jw, &c, 1) < 0)
+        return -1;
+
+    jw->depth++;
+    jw->need_comma[jw->depth] = 0;
+    return 0;
+}
+
+static int jw_close(struct JSONWriter *jw, char c)
+{
+    assert(jw->depth > 0);  // closing container that was never opened
+    jw->depth--;
+    return jw_write(jw, &c, 1);
+}
+
+int jw_object_open(struct JSONWriter *jw)
+{
+    return jw_open(jw, '{');
+}
+
+int jw_object_close(struct JSONWriter *jw)
+{
+    return jw_close(jw, '}');
+}
+
+int jw_array_open(struct JSONWriter *jw)
+{
+    return jw_open(jw, '[');
+}
+
+int jw_array_close(struct JSONWriter *jw)
+{
+    return jw_close(jw, ']');
+}
+
+int jw_key(struct JSONWriter *jw, const char *key)
+{
+    if (jw_separator(jw) < 0 || jw_write_escaped(jw, key) < 0 || jw_write(jw, ":", 1) < 0)
+        return -1;
+    jw->after_key = 1;
+    return 0;
+}
+
+int jw_string(struct JSONWriter *jw, const char *str)
+{
+    if (jw_separator(jw) < 0)
+        return -1;
+    return jw_write_escaped(jw, str);
+}
+
+int jw_int(struct JSONWriter *jw, long value)
+{
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%ld", value);
+
+    if (jw_separator(jw) < 0)
+        return -1;
+    return jw_write(jw, buf, n);
+}
+
+int jw_bool(struct JSONWriter *jw, int value)
+{
+    if (jw_separator(jw) < 0)
+        return -1;
+    return (value) ? jw_write(jw, "true", 4) : jw_write(jw, "false", 5);
+}
+
+int jw_raw(struct JSONWriter *jw, const char *data, size_t n)
+{
+    if (jw_write(jw, data, n) < 0)
+        return -1;
+    jw->need_comma[jw->depth] = 0;
+    return 0;
+}
+
+size_t jw_unread(struct JSONWriter *jw)
+{
+    return jw->length - jw->offset;
+}
+
+size_t jw_read(struct JSONWriter *jw, char *buf, size_t size)
+{
+    size_t n = jw_unread(jw);
+    if (n > size)
+        n = size;
+
+    memcpy(buf, jw->buf + jw->offset, n);
+    jw->offset += n;
+
+    // everything is read, start at beginning of buffer again
+    if (jw->offset == jw->length) {
+        jw->offset = 0;
+        jw->length = 0;
+    }
+    return n;
+}
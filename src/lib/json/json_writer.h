@@ -0,0 +1,59 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+// Initial size of the output buffer. The buffer doubles when a value doesn't fit.
+// When the writer is drained while writing (see jw_read()) it will stay roughly at the
+// size of the biggest read + one serialized record.
+#define JSON_WRITER_INIT_SIZE 4096
+
+// Max nesting of objects/arrays
+#define JSON_WRITER_MAX_DEPTH 16
+
+struct JSONWriter {
+    char *buf;
+
+    // amount of bytes written to buffer
+    size_t length;
+
+    // allocated size of buffer
+    size_t size;
+
+    // bytes that are already read by jw_read()
+    size_t offset;
+
+    // for every nesting level, indicates if next value needs a separator
+    int need_comma[JSON_WRITER_MAX_DEPTH];
+    int depth;
+
+    // last written item was a key, so next value doesn't need a separator
+    int after_key;
+};
+
+int  jw_init(struct JSONWriter *jw, size_t size);
+void jw_free(struct JSONWriter *jw);
+void jw_reset(struct JSONWriter *jw);
+
+int jw_object_open(struct JSONWriter *jw);
+int jw_object_close(struct JSONWriter *jw);
+int jw_array_open(struct JSONWriter *jw);
+int jw_array_close(struct JSONWriter *jw);
+
+int jw_key(struct JSONWriter *jw, const char *key);
+int jw_string(struct JSONWriter *jw, const char *str);
+int jw_int(struct JSONWriter *jw, long value);
+int jw_bool(struct JSONWriter *jw, int value);
+
+// Write data as is, eg: separators and whitespace between records that are written by caller.
+// Next value on the current level gets no comma, data should contain it when one is needed
+int jw_raw(struct JSONWriter *jw, const char *data, size_t n);
+
+// Copy at most size unread bytes to buf and return the amount of bytes copied
+size_t jw_read(struct JSONWriter *jw, char *buf, size_t size);
+size_t jw_unread(struct JSONWriter *jw);
+
+#endif
@@ -143,8 +143,9 @@ static void pp_add_to_buf(char *buf, int len, char c)
         //*(lptr+1) = '\0';
     }
     else {
-        buf[strlen(buf)] = c;
-        buf[strlen(buf)+1] = '\0';
+        size_t n = strlen(buf);
+        buf[n] = c;
+        buf[n+1] = '\0';
     }
 }
 
@@ -0,0 +1,612 @@
+#include "potato_validate.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define INFO(M, ...) if(do_info){fprintf(stdout, M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+// What the JSON validator expects next
+enum PPValidateJSONState {
+    PP_VJ_VALUE,
+    PP_VJ_VALUE_OR_CLOSE,   // after '['
+    PP_VJ_KEY,              // after ',' in object
+    PP_VJ_KEY_OR_CLOSE,     // after '{'
+    PP_VJ_COLON,
+    PP_VJ_AFTER_VALUE
+};
+
+// Location of an open XML tag name in the buffer, used to match closing tags
+struct PPValidateTag {
+    size_t offset;
+    size_t length;
+};
+
+
+// HELPERS ////////////////////////////
+static int pp_v_is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static int pp_v_is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static int pp_v_is_hex(char c)
+{
+    return pp_v_is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static size_t pp_v_skip_space(const char *buf, size_t size, size_t i)
+{
+    while (i < size && pp_v_is_space(buf[i]))
+        i++;
+    return i;
+}
+
+static int pp_v_starts_with(const char *buf, size_t size, size_t i, const char *str)
+{
+    /* Returns 1 on match, 0 on no match, -1 if data ends while still matching */
+    for (; *str != '\0' ; str++, i++) {
+        if (i >= size)
+            return -1;
+        if (buf[i] != *str)
+            return 0;
+    }
+    return 1;
+}
+
+static size_t pp_v_find(const char *buf, size_t size, size_t i, const char *str)
+{
+    /* Return offset of str in buf starting at i, or size if not found */
+    size_t len = strlen(str);
+
+    while (i + len <= size) {
+        const char *c = memchr(buf + i, *str, size - i);
+        if (c == NULL)
+            break;
+        i = c - buf;
+        if (i + len <= size && memcmp(c, str, len) == 0)
+            return i;
+        i++;
+    }
+    return size;
+}
+
+static enum PPValidateResult pp_v_fail(enum PPValidateResult res, size_t offset, size_t *err_offset, const char *msg)
+{
+    if (err_offset != NULL)
+        *err_offset = offset;
+
+    if (res == PP_VALIDATE_ERROR)
+        DEBUG("Validation failed @ %ld: %s\n", offset, msg);
+    return res;
+}
+
+
+// JSON ///////////////////////////////
+static enum PPValidateResult pp_v_json_string(const char *buf, size_t size, size_t *i)
+{
+    /* *i points to opening quote. On success *i points to char after closing quote,
+     * otherwise to the offending char */
+    size_t p = *i + 1;
+
+    while (p < size) {
+        unsigned char c = buf[p];
+
+        if (c == '"') {
+            *i = p + 1;
+            return PP_VALIDATE_SUCCESS;
+        }
+        else if (c == '\\') {
+            if (p + 1 >= size)
+                break;
+
+            c = buf[p+1];
+            if (c == 'u') {
+                for (int k=2 ; k<6 ; k++) {
+                    if (p + k >= size) {
+                        *i = size;
+                        return PP_VALIDATE_INCOMPLETE;
+                    }
+                    if (!pp_v_is_hex(buf[p+k])) {
+                        *i = p + k;
+                        return PP_VALIDATE_ERROR;
+                    }
+                }
+                p += 6;
+                continue;
+            }
+            if (c == '\0' || !strchr("\"\\/bfnrt", c)) {
+                *i = p + 1;
+                return PP_VALIDATE_ERROR;
+            }
+            p += 2;
+            continue;
+        }
+        else if (c < 0x20) {
+            *i = p;
+            return PP_VALIDATE_ERROR;
+        }
+        p++;
+    }
+    *i = size;
+    return PP_VALIDATE_INCOMPLETE;
+}
+
+static enum PPValidateResult pp_v_json_number(const char *buf, size_t size, size_t *i)
+{
+    /* -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+     * A number that ends at the end of data is complete */
+    size_t p = *i;
+
+    if (buf[p] == '-')
+        p++;
+
+    if (p >= size)
+        goto incomplete;
+
+    if (buf[p] == '0') {
+        p++;
+    }
+    else if (pp_v_is_digit(buf[p])) {
+        while (p < size && pp_v_is_digit(buf[p]))
+            p++;
+    }
+    else {
+        goto error;
+    }
+
+    if (p < size && buf[p] == '.') {
+        p++;
+        if (p >= size)
+            goto incomplete;
+        if (!pp_v_is_digit(buf[p]))
+            goto error;
+        while (p < size && pp_v_is_digit(buf[p]))
+            p++;
+    }
+
+    if (p < size && (buf[p] == 'e' || buf[p] == 'E')) {
+        p++;
+        if (p < size && (buf[p] == '+' || buf[p] == '-'))
+            p++;
+        if (p >= size)
+            goto incomplete;
+        if (!pp_v_is_digit(buf[p]))
+            goto error;
+        while (p < size && pp_v_is_digit(buf[p]))
+            p++;
+    }
+
+    *i = p;
+    return PP_VALIDATE_SUCCESS;
+
+incomplete:
+    *i = size;
+    return PP_VALIDATE_INCOMPLETE;
+error:
+    *i = p;
+    return PP_VALIDATE_ERROR;
+}
+
+static enum PPValidateResult pp_v_json_literal(const char *buf, size_t size, size_t *i)
+{
+    const char *literals[] = {"true", "false", "null"};
+
+    for (size_t k=0 ; k<sizeof(literals)/sizeof(*literals) ; k++) {
+        int res = pp_v_starts_with(buf, size, *i, literals[k]);
+        if (res == 1) {
+            *i += strlen(literals[k]);
+            return PP_VALIDATE_SUCCESS;
+        }
+        else if (res < 0) {
+            *i = size;
+            return PP_VALIDATE_INCOMPLETE;
+        }
+    }
+    return PP_VALIDATE_ERROR;
+}
+
+enum PPValidateResult pp_validate_json(const char *buf, size_t size, size_t *err_offset)
+{
+    // one bit per nesting level, set if level is an object
+    unsigned char is_object[PP_VALIDATE_MAX_DEPTH/8] = {0};
+    int depth = 0;
+
+    enum PPValidateJSONState s = PP_VJ_VALUE;
+    enum PPValidateResult res;
+    size_t i = 0;
+
+    while ((i = pp_v_skip_space(buf, size, i)) < size) {
+        char c = buf[i];
+
+        switch (s) {
+            case PP_VJ_VALUE_OR_CLOSE:
+                if (c == ']') {
+                    depth--;
+                    i++;
+                    s = PP_VJ_AFTER_VALUE;
+                    break;
+                }
+                // fall through
+            case PP_VJ_VALUE:
+                if (c == '{' || c == '[') {
+                    if (depth >= PP_VALIDATE_MAX_DEPTH)
+                        return pp_v_fail(PP_VALIDATE_ERROR, i, err_offset, "max depth reached");
+
+                    if (c == '{')
+                        is_object[depth/8] |= 1 << (depth%8);
+                    else
+                        is_object[depth/8] &= ~(1 << (depth%8));
+
+                    depth++;
+                    i++;
+                    s = (c == '{') ? PP_VJ_KEY_OR_CLOSE : PP_VJ_VALUE_OR_CLOSE;
+                    break;
+                }
+                else if (c == '"')
+                    res = pp_v_json_string(buf, size, &i);
+                else if (c == '-' || pp_v_is_digit(c))
+                    res = pp_v_json_number(buf, size, &i);
+                else
+                    res = pp_v_json_literal(buf, size, &i);
+
+                if (res != PP_VALIDATE_SUCCESS)
+                    return pp_v_fail(res, i, err_offset, "invalid value");
+
+                s = PP_VJ_AFTER_VALUE;
+                break;
+
+            case PP_VJ_KEY_OR_CLOSE:
+                if (c == '}') {
+                    depth--;
+                    i++;
+                    s = PP_VJ_AFTER_VALUE;
+                    break;
+                }
+                // fall through
+            case PP_VJ_KEY:
+                if (c != '"')
+                    return pp_v_fail(PP_VALIDATE_ERROR, i, err_offset, "expected key");
+
+                if ((res = pp_v_json_string(buf, size, &i)) != PP_VALIDATE_SUCCESS)
+                    return pp_v_fail(res, i, err_offset, "invalid key");
+
+                s = PP_VJ_COLON;
+                break;
+
+            case PP_VJ_COLON:
+                if (c != ':')
+                    return pp_v_fail(PP_VALIDATE_ERROR, i, err_offset, "expected ':'");
+                i++;
+                s = PP_VJ_VALUE;
+                break;
+
+            case PP_VJ_AFTER_VALUE: {
+                if (depth == 0)
+                    return pp_v_fail(PP_VALIDATE_ERROR, i, err_offset, "data after top-level value");
+
+                int in_object = is_object[(depth-1)/8] & (1 << ((depth-1)%8));
+
+                if (c == ',') {
+                    s = (in_object) ? PP_VJ_KEY : PP_VJ_VALUE;
+                }
+                else if ((c == '}' && in_object) || (c == ']' && !in_object)) {
+                    depth--;
+                }
+                else {
+                    return pp_v_fail(PP_VALIDATE_ERROR, i, err_offset, "unexpected char after value");
+                }
+                i++;
+                break;
+            }
+        }
+    }
+
+    if (s != PP_VJ_AFTER_VALUE || depth != 0)
+        return pp_v_fail(PP_VALIDATE_INCOMPLETE, size, err_offset, "incomplete");
+
+    return PP_VALIDATE_SUCCESS;
+}
+
+
+// XML ////////////////////////////////
+static int pp_v_xml_is_name_start(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == ':' || c >= 0x80;
+}
+
+static int pp_v_xml_is_name(unsigned char c)
+{
+    return pp_v_xml_is_name_start(c) || pp_v_is_digit(c) || c == '-' || c == '.';
+}
+
+static enum PPValidateResult pp_v_xml_name(const char *buf, size_t size, size_t *i)
+{
+    if (*i >= size) {
+        *i = size;
+        return PP_VALIDATE_INCOMPLETE;
+    }
+    if (!pp_v_xml_is_name_start(buf[*i]))
+        return PP_VALIDATE_ERROR;
+
+    while (*i < size && pp_v_xml_is_name(buf[*i]))
+        (*i)++;
+
+    return (*i < size) ? PP_VALIDATE_SUCCESS : PP_VALIDATE_INCOMPLETE;
+}
+
+static enum PPValidateResult pp_v_xml_entity(const char *buf, size_t size, size_t *i)
+{
+    /* *i points to '&', eg: &amp; &#39; &#x27; &#X27; */
+    size_t p = *i + 1;
+
+    if (p < size && buf[p] == '#') {
+        p++;
+        int hex = (p < size && (buf[p] == 'x' || buf[p] == 'X'));
+        if (hex)
+            p++;
+
+        size_t start = p;
+        while (p < size && (hex ? pp_v_is_hex(buf[p]) : pp_v_is_digit(buf[p])))
+            p++;
+
+        if (p < size && p == start) {
+            *i = p;
+            return PP_VALIDATE_ERROR;
+        }
+    }
+    else {
+        enum PPValidateResult res = pp_v_xml_name(buf, size, &p);
+        if (res != PP_VALIDATE_SUCCESS) {
+            *i = p;
+            return res;
+        }
+    }
+
+    if (p >= size) {
+        *i = size;
+        return PP_VALIDATE_INCOMPLETE;
+    }
+    if (buf[p] != ';' || p - *i > PP_VALIDATE_MAX_ENTITY) {
+        *i = p;
+        return PP_VALIDATE_ERROR;
+    }
+    *i = p + 1;
+    return PP_VALIDATE_SUCCESS;
+}
+
+static enum PPValidateResult pp_v_xml_text(const char *buf, size_t size, size_t *i, int in_root)
+{
+    /* Text between tags, outside of the root element only whitespace is allowed */
+    while (*i < size && buf[*i] != '<') {
+        if (buf[*i] == '&' && in_root) {
+            enum PPValidateResult res = pp_v_xml_entity(buf, size, i);
+            if (res != PP_VALIDATE_SUCCESS)
+                return res;
+            continue;
+        }
+        if (!in_root && !pp_v_is_space(buf[*i]))
+            return PP_VALIDATE_ERROR;
+        (*i)++;
+    }
+    return PP_VALIDATE_SUCCESS;
+}
+
+static enum PPValidateResult pp_v_xml_skip_to(const char *buf, size_t size, size_t *i, const char *end)
+{
+    size_t p = pp_v_find(buf, size, *i, end);
+    if (p >= size) {
+        *i = size;
+        return PP_VALIDATE_INCOMPLETE;
+    }
+    *i = p + strlen(end);
+    return PP_VALIDATE_SUCCESS;
+}
+
+static enum PPValidateResult pp_v_xml_doctype(const char *buf, size_t size, size_t *i)
+{
+    /* Skip <!DOCTYPE ...>, may contain an internal subset between [] and quoted strings */
+    int subset = 0;
+    char quote = '\0';
+
+    for (size_t p=*i+2 ; p<size ; p++) {
+        char c = buf[p];
+        if (quote) {
+            if (c == quote)
+                quote = '\0';
+        }
+        else if (c == '"' || c == '\'')
+            quote = c;
+        else if (c == '[')
+            subset++;
+        else if (c == ']')
+            subset--;
+        else if (c == '>' && subset == 0) {
+            *i = p + 1;
+            return PP_VALIDATE_SUCCESS;
+        }
+    }
+    *i = size;
+    return PP_VALIDATE_INCOMPLETE;
+}
+
+static enum PPValidateResult pp_v_xml_attributes(const char *buf, size_t size, size_t *i, int *self_closing)
+{
+    /* Parse attributes until '>' or '/>' is found, eg: <tag key="value" key2='value'> */
+    enum PPValidateResult res;
+    *self_closing = 0;
+
+    while (1) {
+        size_t p = pp_v_skip_space(buf, size, *i);
+        int has_space = p > *i;
+        *i = p;
+
+        if (*i >= size)
+            return PP_VALIDATE_INCOMPLETE;
+
+        if (buf[*i] == '>') {
+            (*i)++;
+            return PP_VALIDATE_SUCCESS;
+        }
+        if (buf[*i] == '/') {
+            if (*i + 1 >= size) {
+                *i = size;
+                return PP_VALIDATE_INCOMPLETE;
+            }
+            if (buf[*i+1] != '>') {
+                (*i)++;
+                return PP_VALIDATE_ERROR;
+            }
+            *self_closing = 1;
+            *i += 2;
+            return PP_VALIDATE_SUCCESS;
+        }
+
+        // attributes must be separated by whitespace
+        if (!has_space)
+            return PP_VALIDATE_ERROR;
+
+        if ((res = pp_v_xml_name(buf, size, i)) != PP_VALIDATE_SUCCESS)
+            return res;
+
+        *i = pp_v_skip_space(buf, size, *i);
+        if (*i >= size)
+            return PP_VALIDATE_INCOMPLETE;
+        if (buf[*i] != '=')
+            return PP_VALIDATE_ERROR;
+
+        *i = pp_v_skip_space(buf, size, *i + 1);
+        if (*i >= size)
+            return PP_VALIDATE_INCOMPLETE;
+
+        char quote = buf[*i];
+        if (quote != '"' && quote != '\'')
+            return PP_VALIDATE_ERROR;
+
+        for ((*i)++ ; *i < size && buf[*i] != quote ; (*i)++) {
+            if (buf[*i] == '<')
+                return PP_VALIDATE_ERROR;
+        }
+        if (*i >= size)
+            return PP_VALIDATE_INCOMPLETE;
+        (*i)++;
+    }
+}
+
+enum PPValidateResult pp_validate_xml(const char *buf, size_t size, size_t *err_offset)
+{
+    struct PPValidateTag stack[PP_VALIDATE_MAX_DEPTH];
+    int depth = 0;
+    int root_seen = 0;
+
+    enum PPValidateResult res;
+    size_t i = 0;
+
+    // UTF-8 byte order mark before the prolog
+    if (size >= 3 && memcmp(buf, "\xEF\xBB\xBF", 3) == 0)
+        i = 3;
+
+    while (i < size) {
+        if (buf[i] != '<') {
+            if ((res = pp_v_xml_text(buf, size, &i, depth > 0)) != PP_VALIDATE_SUCCESS)
+                return pp_v_fail(res, i, err_offset, "invalid text");
+            continue;
+        }
+
+        if (i + 1 >= size)
+            return pp_v_fail(PP_VALIDATE_INCOMPLETE, size, err_offset, "incomplete");
+
+        int is_comment = pp_v_starts_with(buf, size, i, "<!--");
+        int is_cdata   = pp_v_starts_with(buf, size, i, "<![CDATA[");
+
+        if (is_comment < 0 || is_cdata < 0)
+            return pp_v_fail(PP_VALIDATE_INCOMPLETE, size, err_offset, "incomplete");
+
+        if (is_comment) {
+            res = pp_v_xml_skip_to(buf, size, &i, "-->");
+        }
+        else if (is_cdata) {
+            if (depth == 0)
+                return pp_v_fail(PP_VALIDATE_ERROR, i, err_offset, "CDATA outside of root element");
+            res = pp_v_xml_skip_to(buf, size, &i, "]]>");
+        }
+        else if (buf[i+1] == '?') {
+            res = pp_v_xml_skip_to(buf, size, &i, "?>");
+        }
+        else if (buf[i+1] == '!') {
+            if (depth > 0 || root_seen)
+                return pp_v_fail(PP_VALIDATE_ERROR, i, err_offset, "unexpected declaration");
+            res = pp_v_xml_doctype(buf, size, &i);
+        }
+        else if (buf[i+1] == '/') {
+            size_t start = i + 2;
+            i = start;
+            if ((res = pp_v_xml_name(buf, size, &i)) != PP_VALIDATE_SUCCESS)
+                return pp_v_fail(res, i, err_offset, "invalid closing tag");
+
+            if (depth == 0)
+                return pp_v_fail(PP_VALIDATE_ERROR, start, err_offset, "closing tag without opening tag");
+
+            struct PPValidateTag *t = &stack[depth-1];
+            if (t->length != i - start || memcmp(buf + t->offset, buf + start, t->length) != 0)
+                return pp_v_fail(PP_VALIDATE_ERROR, start, err_offset, "closing tag doesn't match opening tag");
+
+            i = pp_v_skip_space(buf, size, i);
+            if (i >= size)
+                return pp_v_fail(PP_VALIDATE_INCOMPLETE, size, err_offset, "incomplete");
+            if (buf[i] != '>')
+                return pp_v_fail(PP_VALIDATE_ERROR, i, err_offset, "expected '>'");
+            i++;
+            depth--;
+        }
+        else {
+            size_t start = i + 1;
+            int self_closing;
+
+            if (depth == 0 && root_seen)
+                return pp_v_fail(PP_VALIDATE_ERROR, i, err_offset, "more than one root element");
+
+            i = start;
+            if ((res = pp_v_xml_name(buf, size, &i)) != PP_VALIDATE_SUCCESS)
+                return pp_v_fail(res, i, err_offset, "invalid tag name");
+
+            size_t length = i - start;
+
+            if ((res = pp_v_xml_attributes(buf, size, &i, &self_closing)) != PP_VALIDATE_SUCCESS)
+                return pp_v_fail(res, i, err_offset, "invalid attributes");
+
+            root_seen = 1;
+
+            if (!self_closing) {
+                if (depth >= PP_VALIDATE_MAX_DEPTH)
+                    return pp_v_fail(PP_VALIDATE_ERROR, start, err_offset, "max depth reached");
+                stack[depth].offset = start;
+                stack[depth].length = length;
+                depth++;
+            }
+        }
+
+        if (res != PP_VALIDATE_SUCCESS)
+            return pp_v_fail(res, i, err_offset, "invalid markup");
+    }
+
+    if (depth > 0 || !root_seen)
+        return pp_v_fail(PP_VALIDATE_INCOMPLETE, size, err_offset, "incomplete");
+
+    return PP_VALIDATE_SUCCESS;
+}
+
+enum PPValidateResult pp_validate(enum PPGrammar grammar, const char *buf, size_t size, size_t *err_offset)
+{
+    switch (grammar) {
+        case PP_GRAMMAR_JSON:
+            return pp_validate_json(buf, size, err_offset);
+        case PP_GRAMMAR_XML:
+            return pp_validate_xml(buf, size, err_offset);
+        default:
+            assert(!"Unknown grammar");
+    }
+    return PP_VALIDATE_ERROR;
+}
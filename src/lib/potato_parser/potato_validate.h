@@ -0,0 +1,41 @@
+#ifndef POTATO_VALIDATE_H
+#define POTATO_VALIDATE_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+// Validate-only mode. Checks structure and tag/brace balance in one pass over a buffer.
+// Nothing is copied, no stack of tokens is kept and no callbacks are called.
+// Use this to check a cached response before trusting it.
+
+// Max nesting of objects/arrays or tags
+#define PP_VALIDATE_MAX_DEPTH 1024
+
+// Max length of an XML entity eg: &amp; or &#x1F600;
+#define PP_VALIDATE_MAX_ENTITY 32
+
+extern int do_debug;
+extern int do_info;
+extern int do_error;
+
+enum PPGrammar {
+    PP_GRAMMAR_JSON,
+    PP_GRAMMAR_XML
+};
+
+enum PPValidateResult {
+    PP_VALIDATE_ERROR,          // syntax error, err_offset points to the offending char
+    PP_VALIDATE_INCOMPLETE,     // data ends before document is complete, eg: truncated download
+    PP_VALIDATE_SUCCESS
+};
+
+// Validate buffer of size bytes. Buffer doesn't have to be NUL terminated.
+// On failure err_offset is set to the offset of the first error, or size when incomplete.
+enum PPValidateResult pp_validate(enum PPGrammar grammar, const char *buf, size_t size, size_t *err_offset);
+
+enum PPValidateResult pp_validate_json(const char *buf, size_t size, size_t *err_offset);
+enum PPValidateResult pp_validate_xml(const char *buf, size_t size, size_t *err_offset);
+
+#endif
@@ -236,11 +236,12 @@ enum PPParseResult pp_xml_tag_open_cb(struct PP *pp, struct PPToken *t)
     char *param_str;
     pp_str_split_at_char(t->data, ' ', &param_str);
 
-    // TODO fix this
-    //if (param_str != NULL)
-    //    pp_xml_token_parse_parameters(t, param_str, PP_XML_MAX_PARAM);
-
+    // parameters point into token data, so parse them in the copy that lives on the stack
     pp_stack_put(&(pp->stack), *t);
+    if (param_str != NULL) {
+        struct PPToken *st = pp_stack_get_from_end(pp, 0);
+        pp_xml_token_parse_parameters(st, st->data + (param_str - t->data), PP_XML_MAX_PARAM);
+    }
     pp->handle_data_cb(pp, t->dtype, pp->user_data);
 
     if (is_single_line)
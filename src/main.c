@@ -4,10 +4,18 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <dirent.h>
 
 //#include "utils.h"
 #include "api_client.h"
 #include "podcast.h"
+#include "downloader.h"
+#include "media_probe.h"
+#include "episode_store.h"
+#include "action_queue.h"
+#ifdef TEST_SERVER
+#include "test_server.h"
+#endif
 #include "lib/json/json.h"
 #include "lib/potato_parser/potato_xml.h"
 #include "lib/potato_parser/potato_json.h"
@@ -15,6 +23,18 @@
 
 #define SUCCESS 0
 
+#define DOWNLOAD_DIR "downloads"
+#define MEDIA_INFO_PATH "test/media.tsv"
+#define EPISODE_STORE_DIR "test/store"
+#define DEFAULT_NLATEST 1
+
+// -L is only available when the test server is built in, see: make loopback
+#ifdef TEST_SERVER
+#define OPTIONS "s:p:P:a:r:A:u:k:c:H:n:K:L:W:hDSFETRNdMI"
+#else
+#define OPTIONS "s:p:P:a:r:A:u:k:c:H:n:K:W:hDSFETRNdMI"
+#endif
+
 int do_debug = 0;
 int do_info = 1;
 int do_error = 1;
@@ -28,9 +48,28 @@ struct State {
     char user[API_CLIENT_MAX_USER];
     char key[API_CLIENT_MAX_KEY];
     char podcast[API_CLIENT_MAX_PODCAST];
+    char subscribe[PODCAST_MAX_URL];
+    char unsubscribe[PODCAST_MAX_URL];
+    char play[PODCAST_MAX_URL + 32];
+#ifdef TEST_SERVER
+    char loopback[TS_MAX_PATH];
+    char url_prefix[API_CLIENT_MAX_SERVER];
+#endif
     int  port;
+    int  concurrent;
+    int  per_host;
+    int  nlatest;
+    int  nsegments;
     int  do_sync;
+    int  do_refresh;
+    int  do_hedge;
+    int  do_cache;
+    int  do_reparse;
+    int  do_net_cache;
     int  do_download;
+    int  do_probe;
+    int  do_import;
+    int  ndays_new;
 };
 
 static struct State state_init()
@@ -40,9 +79,28 @@ static struct State state_init()
     s.user[0] = '\0';
     s.key[0] = '\0';
     s.podcast[0] = '\0';
+    s.subscribe[0] = '\0';
+    s.unsubscribe[0] = '\0';
+    s.play[0] = '\0';
+#ifdef TEST_SERVER
+    s.loopback[0] = '\0';
+    s.url_prefix[0] = '\0';
+#endif
     s.port = 80;
+    s.concurrent = API_CLIENT_DEFAULT_CONCURRENT;
+    s.per_host = API_CLIENT_DEFAULT_PER_HOST;
+    s.nlatest = DEFAULT_NLATEST;
+    s.nsegments = 1;
     s.do_sync = 0;
+    s.do_refresh = 0;
+    s.do_hedge = 0;
+    s.do_cache = 0;
+    s.do_reparse = 0;
+    s.do_net_cache = 0;
     s.do_download = 0;
+    s.do_probe = 0;
+    s.do_import = 0;
+    s.ndays_new = -1;
     return s;
 }
 
@@ -53,9 +111,30 @@ static void show_help(struct State *s)
     printf("  -p    port,   default=%d\n", s->port);
     printf("  -u    user\n");
     printf("  -k    key\n");
+    printf("  -c    concurrent feed transfers, default=%d, max=%d\n", s->concurrent, API_CLIENT_MAX_CONCURRENT);
+    printf("  -H    concurrent feed transfers per host, default=%d\n", s->per_host);
     printf("  -d    download episodes\n");
+    printf("  -M    find duration and size of episodes without downloading them, cached in: %s\n", MEDIA_INFO_PATH);
+    printf("  -n    episodes per podcast to download or probe, default=%d\n", s->nlatest);
+    printf("  -K    connections per download, default=%d, max=%d\n", s->nsegments, DL_MAX_SEGMENTS);
     printf("  -S    sync\n");
+    printf("  -F    fetch all feeds, also feeds that are not due yet\n");
+    printf("  -E    send a second request for feeds that respond slower than usual\n");
+    printf("  -T    keep feeds in cache dir: %s\n", API_CLIENT_CACHE_DIR);
+    printf("  -R    parse cached feeds again, without network\n");
+    if (NC_HAVE_SSLS)
+        printf("  -N    keep DNS addresses and TLS sessions between runs in: %s\n", API_CLIENT_NET_CACHE_PATH);
+    else
+        printf("  -N    keep DNS addresses between runs in: %s, TLS sessions need curl >= 8.12\n", API_CLIENT_NET_CACHE_PATH);
+    printf("  -I    import podcast files into episode store and add new episodes while syncing: %s\n", EPISODE_STORE_DIR);
+    printf("  -W    list episodes from episode store published in the last n days\n");
     printf("  -P    podcast url\n");
+    printf("  -a    subscribe to podcast url, uploaded on next sync\n");
+    printf("  -r    unsubscribe from podcast url, uploaded on next sync\n");
+    printf("  -A    record play position of episode of podcast -P, uploaded on next sync, eg: <position>,<total>,<episode url>\n");
+#ifdef TEST_SERVER
+    printf("  -L    run against loopback test server, eg: latency=50,gzip=1 or replay=<dir>\n");
+#endif
     printf("  -D    debugging\n");
 }
 
@@ -74,7 +153,7 @@ static int parse_args(struct State *s, int argc, char **argv)
     int option;
     DEBUG("Parsing args\n");
 
-    while((option = getopt(argc, argv, "s:p:P:u:k:hDSd")) != -1) {
+    while((option = getopt(argc, argv, OPTIONS)) != -1) {
         switch (option) {
             case 's':
                 strncpy(s->server, optarg, sizeof(s->server));
@@ -85,9 +164,47 @@ static int parse_args(struct State *s, int argc, char **argv)
                     return -1;
                 }
                 break;
+            case 'c':
+                if (atoi_err(optarg, &(s->concurrent)) < 0) {
+                    ERROR("Concurrency is not a number: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'H':
+                if (atoi_err(optarg, &(s->per_host)) < 0) {
+                    ERROR("Concurrency per host is not a number: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'n':
+                if (atoi_err(optarg, &(s->nlatest)) < 0) {
+                    ERROR("Amount of episodes is not a number: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'K':
+                if (atoi_err(optarg, &(s->nsegments)) < 0) {
+                    ERROR("Amount of connections is not a number: %s\n", optarg);
+                    return -1;
+                }
+                break;
+#ifdef TEST_SERVER
+            case 'L':
+                strncpy(s->loopback, optarg, sizeof(s->loopback)-1);
+                break;
+#endif
             case 'P':
                 strncpy(s->podcast, optarg, sizeof(s->podcast));
                 break;
+            case 'a':
+                strncpy(s->subscribe, optarg, sizeof(s->subscribe)-1);
+                break;
+            case 'r':
+                strncpy(s->unsubscribe, optarg, sizeof(s->unsubscribe)-1);
+                break;
+            case 'A':
+                strncpy(s->play, optarg, sizeof(s->play)-1);
+                break;
             case 'u':
                 strncpy(s->user, optarg, sizeof(s->user));
                 break;
@@ -97,9 +214,36 @@ static int parse_args(struct State *s, int argc, char **argv)
             case 'd':
                 s->do_download = 1;
                 break;
+            case 'M':
+                s->do_probe = 1;
+                break;
+            case 'I':
+                s->do_import = 1;
+                break;
+            case 'W':
+                if (atoi_err(optarg, &(s->ndays_new)) < 0) {
+                    ERROR("Amount of days is not a number: %s\n", optarg);
+                    return -1;
+                }
+                break;
             case 'S':
                 s->do_sync = 1;
                 break;
+            case 'F':
+                s->do_refresh = 1;
+                break;
+            case 'E':
+                s->do_hedge = 1;
+                break;
+            case 'T':
+                s->do_cache = 1;
+                break;
+            case 'R':
+                s->do_reparse = 1;
+                break;
+            case 'N':
+                s->do_net_cache = 1;
+                break;
             case 'D':
                 do_debug = 1;
                 break;
@@ -114,6 +258,23 @@ static int parse_args(struct State *s, int argc, char **argv)
                 return -1;
        }
     }
+    // reparsing, changing subscriptions, recording actions and the episode store only use local files
+    if (s->do_reparse ||
+        (!s->do_sync && (s->do_import || s->ndays_new >= 0 || strlen(s->subscribe) > 0 || strlen(s->unsubscribe) > 0 || strlen(s->play) > 0)))
+        return SUCCESS;
+
+#ifdef TEST_SERVER
+    // test server doesn't check credentials and provides the server in synthetic mode
+    if (strlen(s->loopback) > 0) {
+        if (strlen(s->user) <= 0)
+            strcpy(s->user, "test");
+        if (strlen(s->key) <= 0)
+            strcpy(s->key, "test");
+        if (strlen(s->server) <= 0)
+            strcpy(s->server, "loopback");
+    }
+#endif
+
     if (strlen(s->user) <= 0)
         return -1;
     if (strlen(s->key) <= 0)
@@ -122,6 +283,12 @@ static int parse_args(struct State *s, int argc, char **argv)
         return -1;
     if (s->port < 0)
         return -1;
+    if (s->concurrent <= 0 || s->concurrent > API_CLIENT_MAX_CONCURRENT)
+        return -1;
+    if (s->per_host <= 0)
+        return -1;
+    if (s->nsegments <= 0 || s->nsegments > DL_MAX_SEGMENTS)
+        return -1;
 
     return SUCCESS;
 }
@@ -187,62 +354,457 @@ static void test_pp_xml()
 }
 
 
+static int download_path(char *buf, size_t size, const char *pod_file, const char *url)
+{
+    /* Build path for episode: <base>/downloads/<podcast>/<url hash>.<ext> */
+    char pod_name[256];
+    strncpy(pod_name, pod_file, sizeof(pod_name)-1);
+    pod_name[sizeof(pod_name)-1] = '\0';
+    char *dot = strrchr(pod_name, '.');
+    if (dot != NULL)
+        *dot = '\0';
+
+    // extension of last path component, without query
+    char ext[16] = "";
+    const char *end = url + strcspn(url, "?#");
+    const char *slash = url;
+    for (const char *c=url ; c<end ; c++) {
+        if (*c == '/')
+            slash = c;
+    }
+    for (const char *c=end-1 ; c>slash ; c--) {
+        if (*c == '.') {
+            if (end - c < (int)sizeof(ext))
+                snprintf(ext, sizeof(ext), "%.*s", (int)(end - c), c);
+            break;
+        }
+    }
+
+    int n = snprintf(buf, size, "%s/%s/%s/%016lx%s", API_CLIENT_BASE_DIR, DOWNLOAD_DIR, pod_name, hash_str(url), ext);
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
 static int do_download_episodes(struct State *s)
 {
-    // FIXME sometimes nread (returned from json_parse())is less than what is actually parsed
-    const int nchunks = 256;
-    const char *path = "data/test.json";
-    //const char *path = "test/podcasts/trash_taste_podcast.json";
-    FILE *fp;
-    size_t n;
-    char chunk[nchunks+1];
-    char chunk_unread[nchunks+1];
-    chunk[0] = '\0';
-    chunk_unread[0] = '\0';
-    char *chunks[2];
+    /* Download latest episodes of all synced podcasts */
+    char pod_dir[256];
+    snprintf(pod_dir, sizeof(pod_dir), "%s/%s", API_CLIENT_BASE_DIR, API_CLIENT_POD_DIR);
+
+    DIR *dir = opendir(pod_dir);
+    if (dir == NULL) {
+        ERROR("No podcasts found in %s, sync first\n", pod_dir);
+        return -1;
+    }
+
+    struct Downloader dl;
+    if (dl_init(&dl, s->concurrent, s->nsegments) < 0) {
+        closedir(dir);
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", pod_dir, entry->d_name);
+
+        struct JSONBind bind;
+        if (json_bind_init_growable(&bind, &episode_schema) < 0)
+            break;
+
+        if (episodes_load(path, &bind) > 0) {
+            struct Episode *eps = bind.records;
+            int nadded = 0;
+
+            for (size_t i=0 ; i<bind.nrecords && nadded<s->nlatest ; i++) {
+                char dl_path[DL_MAX_PATH];
+                if (strlen(eps[i].url) == 0 || download_path(dl_path, sizeof(dl_path), entry->d_name, eps[i].url) < 0)
+                    continue;
+                if (dl_add(&dl, eps[i].url, dl_path) == 0)
+                    nadded++;
+            }
+        }
+        json_bind_free(&bind);
+    }
+    closedir(dir);
+
+    INFO("Downloading %ld episodes\n", dl.njobs);
+    int nfailed = dl_run(&dl);
+    dl_free(&dl);
+
+    if (nfailed != 0) {
+        ERROR("Failed to download %d episodes\n", nfailed);
+        return -1;
+    }
+    return 0;
+}
+
+static int do_probe_episodes(struct State *s)
+{
+    /* Find duration and size of latest episodes of all synced podcasts with range requests */
+    char pod_dir[256];
+    snprintf(pod_dir, sizeof(pod_dir), "%s/%s", API_CLIENT_BASE_DIR, API_CLIENT_POD_DIR);
+
+    DIR *dir = opendir(pod_dir);
+    if (dir == NULL) {
+        ERROR("No podcasts found in %s, sync first\n", pod_dir);
+        return -1;
+    }
+
+    struct MediaProbe mp;
+    if (mp_init(&mp, s->concurrent) < 0) {
+        closedir(dir);
+        return -1;
+    }
+    if (mp_load(&mp, MEDIA_INFO_PATH) < 0) {
+        mp_free(&mp);
+        closedir(dir);
+        return -1;
+    }
+
+    size_t ncached = 0;
+    size_t nadded = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", pod_dir, entry->d_name);
+
+        struct JSONBind bind;
+        if (json_bind_init_growable(&bind, &episode_schema) < 0)
+            break;
+
+        if (episodes_load(path, &bind) > 0) {
+            struct Episode *eps = bind.records;
+            int nepisodes = 0;
+
+            for (size_t i=0 ; i<bind.nrecords && nepisodes<s->nlatest ; i++) {
+                if (strlen(eps[i].url) == 0)
+                    continue;
+                int res = mp_add(&mp, eps[i].url);
+                if (res < 0)
+                    continue;
+                if (res == 1)
+                    ncached++;
+                else
+                    nadded++;
+                nepisodes++;
+            }
+        }
+        json_bind_free(&bind);
+    }
+    closedir(dir);
+
+    INFO("Probing %ld episodes, cached: %ld\n", nadded, ncached);
+    long start_ms = ac_now_ms();
+    int nfailed = mp_run(&mp);
+
+    for (size_t i=0 ; i<mp.ninfos ; i++) {
+        struct MediaInfo *info = &mp.infos[i];
+        if (info->result != MP_RESULT_SUCCESS)
+            continue;
+        INFO("%02ld:%02ld:%02ld %6ldkB %4ldkbps %-4s %s\n", info->duration / 3600, (info->duration / 60) % 60, info->duration % 60,
+             (long)info->size / 1024, info->bitrate, mp_format_str(info->format), info->url);
+    }
+    INFO("Probe took: %ldms\n", ac_now_ms() - start_ms);
+
+    if (nfailed >= 0 && mp_save(&mp, MEDIA_INFO_PATH) < 0)
+        nfailed = -1;
+    mp_free(&mp);
+
+    if (nfailed != 0) {
+        ERROR("Failed to probe %d episodes\n", nfailed);
+        return -1;
+    }
+    return 0;
+}
+
+static void print_new_episode_cb(const char *podcast, struct Episode *ep, void *user_data)
+{
+    /* user_data points to the current time */
+    time_t *now = user_data;
+    INFO("%4ldd ago  %s  %s\n", (*now - ep->published) / (24 * 3600), podcast, ep->title);
+}
+
+static int do_episode_store(struct State *s)
+{
+    /* Import podcast files into the episode store and list new episodes from it */
+    struct EpisodeStore store;
+    if (es_open(&store, EPISODE_STORE_DIR) < 0)
+        return -1;
+
     int ret = 0;
+    if (s->do_import) {
+        char pod_dir[256];
+        snprintf(pod_dir, sizeof(pod_dir), "%s/%s", API_CLIENT_BASE_DIR, API_CLIENT_POD_DIR);
 
+        long nadded = es_import(&store, pod_dir);
+        if (nadded < 0)
+            ret = -1;
+        else
+            INFO("Imported %ld episodes, store has %ld episodes\n", nadded, store.nindex);
+    }
 
-    //struct JSON json = json_init(json_handle_data_cb);
-    struct PP pp = pp_json_init(pp_json_handle_data_cb);
+    if (ret == 0 && s->ndays_new >= 0) {
+        long start_ms = ac_now_ms();
+        time_t now = time(NULL);
+        long nfound = es_query_since(&store, now - s->ndays_new * 24 * 3600, print_new_episode_cb, &now);
+        if (nfound < 0)
+            ret = -1;
+        else
+            INFO("Found %ld episodes in %ldms\n", nfound, ac_now_ms() - start_ms);
+    }
 
-    fp = fopen(path, "r");
-    if (fp == NULL) {
-        DEBUG("no such file, %s\n", path);
+    if (es_close(&store) < 0)
+        ret = -1;
+    return ret;
+}
+
+static int do_upload_actions(struct APIClient *client, struct ActionStore *store)
+{
+    /* Upload queued actions after superseded play positions are dropped.
+     * Queue is only cleared when the server accepted all of them and the action store
+     * that holds them is saved, a crash before that uploads them again on next sync */
+    struct ActionQueue queue;
+    struct EpisodeAction *actions;
+    int ret = 0;
+
+    if (aq_open(&queue, API_CLIENT_ACTION_QUEUE_PATH) < 0)
         return -1;
+
+    if (queue.nrecords == 0) {
+        aq_close(&queue);
+        return 0;
     }
 
-    while (!feof(fp)) {
+    size_t nqueued = queue.nrecords;
+    long nactions = aq_compact(&queue);
+    if (nactions < 0 || aq_read(&queue, &actions) < 0) {
+        aq_close(&queue);
+        return -1;
+    }
 
-        n = fread(chunk, 1, nchunks, fp);
-        //DEBUG("READ: %s\n", chunk);
+    if (ac_upload_actions(client, actions, nactions) < API_CLIENT_REQ_SUCCESS) {
+        INFO("Actions not uploaded, kept in queue: %ld\n", nactions);
+        ret = -1;
+    }
+    else if (action_store_apply(store, actions, nactions) < 0 || action_store_save(store, API_CLIENT_ACTIONS_PATH) < 0 ||
+             aq_clear(&queue) < 0) {
+        ret = -1;
+    }
+    else {
+        INFO("Actions uploaded: %ld, queued: %zu\n", nactions, nqueued);
+    }
 
-        if (strlen(chunk_unread) > 0) {
-            chunks[0] = chunk_unread;
-            chunks[1] = chunk;
+    free(actions);
+    if (aq_close(&queue) < 0)
+        ret = -1;
+    return ret;
+}
+
+static int do_sync_actions(struct APIClient *client)
+{
+    /* Upload queued actions, then get actions since last sync and apply them to local
+     * state in one batch. Cursor is only moved when state is saved */
+    struct ActionStore store;
+    struct ActionParser ap;
+    int ret = -1;
+
+    if (action_store_load(&store, API_CLIENT_ACTIONS_PATH) < 0)
+        return -1;
+
+    if (do_upload_actions(client, &store) < 0)
+        ERROR("Failed to upload episode actions\n");
+
+    if (action_parser_init(&ap) < 0) {
+        action_store_free(&store);
+        return -1;
+    }
+
+    if (ac_get_actions(client, store.since, &ap) >= API_CLIENT_REQ_SUCCESS &&
+        action_store_apply(&store, ap.bind.records, ap.bind.nrecords) == 0) {
+
+        store.since = ap.timestamp;
+        if (action_store_save(&store, API_CLIENT_ACTIONS_PATH) == 0) {
+            INFO("Actions received: %ld, episodes: %ld\n", ap.bind.nrecords, store.nactions);
+            ret = 0;
         }
-        else {
-            chunks[0] = chunk;
-            chunks[1] = NULL;
+    }
+
+    json_bind_free(&ap.bind);
+    action_store_free(&store);
+    return ret;
+}
+
+static int do_sync_subscriptions(struct APIClient *client, struct SubscriptionStore *store)
+{
+    /* Upload local changes, then get changes since last sync and merge them.
+     * Local changes that fail to upload are kept and uploaded on next sync */
+    struct SubscriptionParser sp;
+    int ret = -1;
+
+    if (store->add.length > 0 || store->remove.length > 0) {
+        if (ac_upload_subscription_changes(client, &store->add, &store->remove) >= API_CLIENT_REQ_SUCCESS) {
+            INFO("Subscription changes uploaded: +%ld -%ld\n", store->add.length, store->remove.length);
+            subscription_set_clear(&store->add);
+            subscription_set_clear(&store->remove);
         }
+    }
 
-        //int nread = json_parse(&json, chunks, sizeof(chunks)/sizeof(*chunks));
-        int nread = pp_parse(&pp, chunks, sizeof(chunks)/sizeof(*chunks));
-        if (nread < 0) {
-            DEBUG("JSON returns 0 read chars\n");
-            ret = -1;
-            break;
+    if (subscription_parser_init(&sp) < 0)
+        return -1;
+
+    if (ac_get_subscriptions(client, store->since, &sp) >= API_CLIENT_REQ_SUCCESS) {
+        int nchanged = subscription_store_apply(store, &sp);
+        if (nchanged >= 0) {
+            store->since = sp.timestamp;
+            INFO("Subscriptions changed: %d, subscriptions: %ld\n", nchanged, store->subscribed.length);
+            ret = 0;
         }
+    }
 
-        if (nread < nchunks && nread != 0)
-            strcpy(chunk_unread, chunk+nread);
+    if (subscription_store_save(store, API_CLIENT_SUBSCRIPTIONS_PATH) < 0)
+        ret = -1;
+
+    subscription_parser_free(&sp);
+    return ret;
+}
+
+static int do_change_subscriptions(struct State *s)
+{
+    /* Change local subscriptions, changes are uploaded on next sync */
+    struct SubscriptionStore store;
+    char url[PODCAST_MAX_URL];
+    int ret = 0;
+
+    if (subscription_store_load(&store, API_CLIENT_SUBSCRIPTIONS_PATH) < 0)
+        return -1;
+
+    if (strlen(s->subscribe) > 0) {
+        ac_url_normalize(s->subscribe, url, sizeof(url));
+        if (subscription_store_subscribe(&store, url) < 0)
+            ret = -1;
         else
-            chunk_unread[0] = '\0';
-        //DEBUG("Read: %d of %d\n", nread, chunk_size);
-    
+            INFO("Subscribed: %s\n", url);
     }
-    DEBUG("END\n");
-    fclose(fp);
+    if (strlen(s->unsubscribe) > 0) {
+        ac_url_normalize(s->unsubscribe, url, sizeof(url));
+        if (subscription_store_unsubscribe(&store, url) < 0)
+            ret = -1;
+        else
+            INFO("Unsubscribed: %s\n", url);
+    }
+
+    if (ret == 0 && subscription_store_save(&store, API_CLIENT_SUBSCRIPTIONS_PATH) < 0)
+        ret = -1;
+
+    subscription_store_free(&store);
+    return ret;
+}
+
+static int do_record_action(struct State *s)
+{
+    /* Queue a play action from: <position>,<total>,<episode url>
+     * Action is durable when this returns, it is uploaded on next sync */
+    struct ActionQueue queue;
+    struct EpisodeAction action;
+    char *url;
+    int ret = 0;
+
+    if (strlen(s->podcast) <= 0) {
+        ERROR("Play action needs a podcast url, use -P\n");
+        return -1;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.action = POD_ACTION_PLAY;
+    action.position = strtol(s->play, &url, 10);
+    if (*url == ',')
+        action.total = strtol(url+1, &url, 10);
+    if (*url != ',' || strlen(url+1) <= 0) {
+        ERROR("Invalid play action, expected: <position>,<total>,<episode url>: %s\n", s->play);
+        return -1;
+    }
+    strncpy(action.ep.url, url+1, sizeof(action.ep.url)-1);
+    strncpy(action.pod.url, s->podcast, sizeof(action.pod.url)-1);
+
+    time_t now = time(NULL);
+    strftime(action.timestamp, sizeof(action.timestamp), "%Y-%m-%dT%H:%M:%S", gmtime(&now));
+
+    if (aq_open(&queue, API_CLIENT_ACTION_QUEUE_PATH) < 0)
+        return -1;
+    if (aq_append(&queue, &action) < 0)
+        ret = -1;
+    if (aq_close(&queue) < 0)
+        ret = -1;
+
+    if (ret == 0)
+        INFO("Play action queued: %d/%d %s, queued: %zu\n", action.position, action.total, action.ep.url, queue.nrecords);
+    return ret;
+}
+
+static int do_sync_feeds(struct State *s, struct APIClient *client)
+{
+    /* Sync actions and subscriptions, then fetch all subscribed feeds that are due */
+    struct SubscriptionStore subs;
+    if (subscription_store_load(&subs, API_CLIENT_SUBSCRIPTIONS_PATH) < 0) {
+        ERROR("Failed to load subscriptions\n");
+        return -1;
+    }
+
+    if (do_sync_actions(client) < 0)
+        ERROR("Failed to sync episode actions\n");
+
+    if (do_sync_subscriptions(client, &subs) < 0)
+        ERROR("Failed to sync subscriptions\n");
+
+    size_t nsubscriptions = subs.subscribed.length;
+    struct Podcast *pods = malloc(sizeof(struct Podcast) * (nsubscriptions + 1));
+    enum APIClientReqResult *results = malloc(sizeof(enum APIClientReqResult) * (nsubscriptions + 1));
+    if (pods == NULL || results == NULL) {
+        ERROR("Failed to allocate feeds\n");
+        free(pods);
+        free(results);
+        subscription_store_free(&subs);
+        return -1;
+    }
+
+    // only fetch feeds that are due according to their publication schedule
+    size_t pods_found = nsubscriptions;
+    memcpy(pods, subs.subscribed.pods, sizeof(struct Podcast) * nsubscriptions);
+    if (!s->do_refresh) {
+        long ndue = ac_feeds_due(client, pods, nsubscriptions, time(NULL));
+        if (ndue >= 0)
+            pods_found = ndue;
+    }
+    INFO("Feeds due: %ld/%ld\n", pods_found, nsubscriptions);
+
+    // feeds are fetched concurrently, with at most max_per_host transfers per host
+    ac_sync_episodes(client, pods, pods_found, results);
+
+    int ret = 0;
+    int not_modified = 0;
+    for (int i=0 ; i<pods_found ; i++) {
+        if (results[i] == API_CLIENT_REQ_NOT_MODIFIED)
+            not_modified++;
+
+        if (results[i] == API_CLIENT_REQ_PARSE_ERROR) {
+            ERROR("Fail on: %s\n", pods[i].url);
+            ret = -1;
+            break;
+        }
+    }
+    INFO("Feeds not modified: %d/%ld\n", not_modified, pods_found);
+    INFO("Feeds coalesced: %ld/%ld\n", client->ncoalesced, pods_found);
+
+    free(pods);
+    free(results);
+    subscription_store_free(&subs);
     return ret;
 }
 
@@ -253,32 +815,128 @@ int do_sync_episodes(struct State *s)
     strncpy(client.user, s->user, API_CLIENT_MAX_USER);
     strncpy(client.key, s->key, API_CLIENT_MAX_KEY);
     client.port = s->port;
-    client.timeout = 100L;
+    client.max_concurrent = s->concurrent;
+
+    if (ac_init(&client) < 0) {
+        ERROR("Failed to initialize client\n");
+        return -1;
+    }
+    client.max_per_host = s->per_host;
+    client.hedge = s->do_hedge;
+#ifdef TEST_SERVER
+    strcpy(client.url_prefix, s->url_prefix);
+#endif
+    long start_ms = ac_now_ms();
+    int ret = 0;
+
+    struct ResponseCache cache;
+    if (s->do_cache && rc_init(&cache, API_CLIENT_CACHE_DIR) == 0)
+        client.cache = &cache;
+
+    // first request to every host can skip DNS and resume its TLS session
+    struct NetCache net_cache;
+    if (s->do_net_cache && nc_load(&net_cache, API_CLIENT_NET_CACHE_PATH, time(NULL)) == 0)
+        ac_net_cache_open(&client, &net_cache);
+
+    // new episodes go into the episode store, known episodes are skipped
+    struct EpisodeStore store;
+    size_t nstored = 0;
+    if (s->do_import && es_open(&store, EPISODE_STORE_DIR) == 0) {
+        client.store = &store;
+        nstored = store.nindex;
+    }
+
+    // validators from last sync, so unchanged feeds are not downloaded again
+    struct FeedMetaStore feed_meta;
+    if (feed_meta_load(&feed_meta, API_CLIENT_FEED_META_PATH) == 0)
+        client.feed_meta = &feed_meta;
 
     if (strlen(s->podcast) > 0) {
         struct Podcast pod;
         strcpy(pod.url, s->podcast);
         printf("\n** %s\n", pod.url);
         if (get_episodes(&client, &pod) < API_CLIENT_REQ_SUCCESS)
-            return -1;
+            ret = -1;
+    }
+    else if (do_sync_feeds(s, &client) < 0) {
+        ret = -1;
+    }
+    if (client.feed_meta != NULL)
+        feed_meta_save(client.feed_meta, API_CLIENT_FEED_META_PATH);
+    feed_meta_free(&feed_meta);
+
+    if (client.net_cache != NULL) {
+        ac_net_cache_close(&client);
+        nc_save(&net_cache, API_CLIENT_NET_CACHE_PATH);
+        nc_free(&net_cache);
     }
-    else {
 
-        struct Podcast pods[API_CLIENT_MAX_SUBSCRIPTIONS];
-        size_t pods_found = 0;
+    if (client.store != NULL) {
+        if (es_flush(&store) == 0)
+            INFO("New episodes: %ld\n", store.nindex - nstored);
+        es_close(&store);
+    }
 
-        //ac_get_actions(&client, -1);
-        ac_get_subscriptions(&client, pods, API_CLIENT_MAX_SUBSCRIPTIONS, &pods_found);
+    INFO("Connections reused: %ld/%ld\n", client.nreused, client.nrequests);
+    INFO("Sync took: %ldms\n", ac_now_ms() - start_ms);
+    ac_cleanup(&client);
+    return ret;
+}
 
-        for (int i=0 ; i<pods_found ; i++) {
-            printf("\n** %s\n", pods[i].url);
-            if (get_episodes(&client, &pods[i]) == API_CLIENT_REQ_PARSE_ERROR) {
-                ERROR("Fail on: %s\n", pods[i].url);
-                return -1;
-            }
+int do_reparse_episodes()
+{
+    /* Parse all cached feeds again, feeds are found by the body hash of their last sync */
+    struct APIClient client;
+    if (ac_init(&client) < 0) {
+        ERROR("Failed to initialize client\n");
+        return -1;
+    }
+
+    struct ResponseCache cache;
+    if (rc_init(&cache, API_CLIENT_CACHE_DIR) < 0) {
+        ac_cleanup(&client);
+        return -1;
+    }
+    client.cache = &cache;
+
+    struct FeedMetaStore feed_meta;
+    if (feed_meta_load(&feed_meta, API_CLIENT_FEED_META_PATH) < 0) {
+        ERROR("Failed to load feed info: %s\n", API_CLIENT_FEED_META_PATH);
+        feed_meta_free(&feed_meta);
+        ac_cleanup(&client);
+        return -1;
+    }
+
+    long start_ms = ac_now_ms();
+    int ret = 0;
+    size_t nparsed = 0;
+
+    for (size_t i=0 ; i<feed_meta.length ; i++) {
+        struct FeedMeta *meta = &feed_meta.items[i];
+        if (meta->hash == 0)
+            continue;
+
+        struct Podcast pod;
+        memset(&pod, 0, sizeof(struct Podcast));
+        strcpy(pod.url, meta->url);
+        printf("\n** %s\n", pod.url);
+
+        enum APIClientReqResult res = ac_reparse_feed(&client, &pod, meta->hash);
+        if (res == API_CLIENT_REQ_NOTFOUND)
+            continue;
+        if (res < API_CLIENT_REQ_SUCCESS) {
+            ERROR("Fail on: %s\n", pod.url);
+            ret = -1;
+            continue;
         }
+        nparsed++;
     }
-    return 0;
+
+    INFO("Feeds parsed from cache: %zu/%zu\n", nparsed, feed_meta.length);
+    feed_meta_free(&feed_meta);
+    INFO("Reparse took: %ldms\n", ac_now_ms() - start_ms);
+    ac_cleanup(&client);
+    return ret;
 }
 
 static void handle_local_episode_data_cb(struct JSON *json, enum JSONEvent ev, void *user_data)
@@ -296,21 +954,48 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    re_test();
-    return 0;
+    //re_test();
+    //return 0;
     //test_pp_xml();
     //return 0;
 
-    if (s.do_sync) {
-        if (do_sync_episodes(&s) < 0)
-            return 1;
-    }
-    if (s.do_download) {
-        if (do_download_episodes(&s) < 0)
+#ifdef TEST_SERVER
+    // serve everything from loopback so sync can run without network
+    struct TestServer ts;
+    if (strlen(s.loopback) > 0) {
+        ts_init(&ts);
+        if (ts_configure(&ts, s.loopback) < 0 || ts_start(&ts) < 0) {
+            ERROR("Failed to start test server\n");
             return 1;
-    }
+        }
 
+        if (ts.mode == TS_MODE_SYNTHETIC)
+            ts_url(&ts, s.server, sizeof(s.server));
+        else
+            ts_url(&ts, s.url_prefix, sizeof(s.url_prefix));
+    }
+#endif
 
+    int ret = 0;
+    if ((strlen(s.subscribe) > 0 || strlen(s.unsubscribe) > 0) && do_change_subscriptions(&s) < 0)
+        ret = 1;
+    if (strlen(s.play) > 0 && do_record_action(&s) < 0)
+        ret = 1;
+    if (s.do_reparse && do_reparse_episodes() < 0)
+        ret = 1;
+    if (s.do_sync && do_sync_episodes(&s) < 0)
+        ret = 1;
+    if (ret == 0 && (s.do_import || s.ndays_new >= 0) && do_episode_store(&s) < 0)
+        ret = 1;
+    if (ret == 0 && s.do_probe && do_probe_episodes(&s) < 0)
+        ret = 1;
+    if (ret == 0 && s.do_download && do_download_episodes(&s) < 0)
+        ret = 1;
+
+#ifdef TEST_SERVER
+    if (strlen(s.loopback) > 0)
+        ts_stop(&ts);
+#endif
 
-    return 0;
+    return ret;
 }
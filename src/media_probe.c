@@ -0,0 +1,753 @@
+#include "media_probe.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+// returned by parsers when probe is done, result is set in info
+#define MP_DONE -1
+
+// kbit/s, index 0 is free format and 15 is invalid
+static const int mp3_bitrates[5][16] = {
+    { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, -1 },   // V1 layer I
+    { 0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384, -1 },   // V1 layer II
+    { 0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, -1 },   // V1 layer III
+    { 0, 32, 48, 56,  64,  80,  96, 112, 128, 144, 160, 176, 192, 224, 256, -1 },   // V2 layer I
+    { 0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160, -1 }    // V2 layer II & III
+};
+
+static const long mp3_samplerates[3] = { 44100, 48000, 32000 };
+
+struct MP3Frame {
+    int v1;
+    int layer;
+    int mono;
+    long bitrate;
+    long samplerate;
+    long nsamples;
+};
+
+static uint32_t mp_be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t mp_be64(const unsigned char *p)
+{
+    return ((uint64_t)mp_be32(p) << 32) | mp_be32(p+4);
+}
+
+static uint64_t mp_le64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i=7 ; i>=0 ; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static uint32_t mp_le32(const unsigned char *p)
+{
+    return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+static uint32_t mp_syncsafe(const unsigned char *p)
+{
+    return ((uint32_t)(p[0] & 0x7f) << 21) | ((uint32_t)(p[1] & 0x7f) << 14) | ((uint32_t)(p[2] & 0x7f) << 7) | (p[3] & 0x7f);
+}
+
+const char* mp_format_str(enum MPFormat format)
+{
+    switch (format) {
+        case MP_FORMAT_MP3:
+            return "mp3";
+        case MP_FORMAT_MP4:
+            return "mp4";
+        case MP_FORMAT_OGG:
+            return "ogg";
+        default:
+            return "unknown";
+    }
+}
+
+static enum MPFormat mp_format_parse(const char *str)
+{
+    if (strcmp(str, "mp3") == 0)
+        return MP_FORMAT_MP3;
+    if (strcmp(str, "mp4") == 0)
+        return MP_FORMAT_MP4;
+    if (strcmp(str, "ogg") == 0)
+        return MP_FORMAT_OGG;
+    return MP_FORMAT_UNKNOWN;
+}
+
+int mp_init(struct MediaProbe *mp, int max_concurrent)
+{
+    mp->ninfos = 0;
+    mp->max_infos = MP_INIT_INFOS;
+    mp->max_concurrent = (max_concurrent > 0) ? max_concurrent : MP_DEFAULT_CONCURRENT;
+    if (mp->max_concurrent > MP_MAX_CONCURRENT)
+        mp->max_concurrent = MP_MAX_CONCURRENT;
+    mp->connect_timeout = 30L;
+    mp->timeout = 60L;
+    mp->share = NULL;
+
+    mp->infos = malloc(sizeof(struct MediaInfo) * mp->max_infos);
+    if (mp->infos == NULL) {
+        ERROR("Failed to allocate media info\n");
+        return -1;
+    }
+    return 0;
+}
+
+void mp_free(struct MediaProbe *mp)
+{
+    free(mp->infos);
+    mp->infos = NULL;
+    mp->ninfos = 0;
+    mp->max_infos = 0;
+}
+
+struct MediaInfo* mp_get(struct MediaProbe *mp, const char *url)
+{
+    for (size_t i=0 ; i<mp->ninfos ; i++) {
+        if (strcmp(mp->infos[i].url, url) == 0)
+            return &mp->infos[i];
+    }
+    return NULL;
+}
+
+static struct MediaInfo* mp_set(struct MediaProbe *mp, const char *url)
+{
+    /* Get info for url, create an empty one if it doesn't exist */
+    struct MediaInfo *info = mp_get(mp, url);
+    if (info != NULL)
+        return info;
+
+    if (strlen(url) >= PODCAST_MAX_URL || strpbrk(url, "\t\r\n") != NULL) {
+        ERROR("Failed to add media url: %s\n", url);
+        return NULL;
+    }
+
+    if (mp->ninfos >= mp->max_infos) {
+        struct MediaInfo *tmp = realloc(mp->infos, sizeof(struct MediaInfo) * mp->max_infos * 2);
+        if (tmp == NULL) {
+            ERROR("Failed to grow media info to %ld\n", mp->max_infos * 2);
+            return NULL;
+        }
+        mp->infos = tmp;
+        mp->max_infos *= 2;
+    }
+
+    info = &mp->infos[mp->ninfos++];
+    strcpy(info->url, url);
+    info->format = MP_FORMAT_UNKNOWN;
+    info->result = MP_RESULT_PENDING;
+    info->size = -1;
+    info->duration = -1;
+    info->bitrate = -1;
+    info->probed = 0;
+    return info;
+}
+
+int mp_add(struct MediaProbe *mp, const char *url)
+{
+    /* Failed probes are tried again */
+    struct MediaInfo *info = mp_set(mp, url);
+    if (info == NULL)
+        return -1;
+    if (info->result == MP_RESULT_SUCCESS)
+        return 1;
+
+    info->result = MP_RESULT_PENDING;
+    return 0;
+}
+
+int mp_load(struct MediaProbe *mp, const char *path)
+{
+    /* Load cached results, a missing file leaves the cache empty */
+    char line[MP_MAX_LINE];
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        ERROR("Failed to open media info file: %s\n", path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+
+        char *rest = line;
+        char *url      = strsep(&rest, "\t");
+        char *format   = strsep(&rest, "\t");
+        char *size     = strsep(&rest, "\t");
+        char *duration = strsep(&rest, "\t");
+        char *bitrate  = strsep(&rest, "\t");
+        char *probed   = strsep(&rest, "\t");
+
+        if (url == NULL || probed == NULL || strlen(url) == 0) {
+            DEBUG("Skipping malformed media info line\n");
+            continue;
+        }
+
+        struct MediaInfo *info = mp_set(mp, url);
+        if (info == NULL)
+            break;
+
+        info->format = mp_format_parse(format);
+        info->result = MP_RESULT_SUCCESS;
+        info->size = strtoll(size, NULL, 10);
+        info->duration = strtol(duration, NULL, 10);
+        info->bitrate = strtol(bitrate, NULL, 10);
+        info->probed = strtoll(probed, NULL, 10);
+    }
+    fclose(fp);
+    DEBUG("Loaded %ld media info entries\n", mp->ninfos);
+    return 0;
+}
+
+int mp_save(struct MediaProbe *mp, const char *path)
+{
+    /* Only successful probes are saved, write to temporary file and rename */
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp_path, "w");
+    if (fp == NULL) {
+        ERROR("Failed to open media info file for writing: %s\n", tmp_path);
+        return -1;
+    }
+
+    for (size_t i=0 ; i<mp->ninfos ; i++) {
+        struct MediaInfo *info = &mp->infos[i];
+        if (info->result != MP_RESULT_SUCCESS)
+            continue;
+        fprintf(fp, "%s\t%s\t%ld\t%ld\t%ld\t%ld\n", info->url, mp_format_str(info->format), info->size,
+                info->duration, info->bitrate, (long)info->probed);
+    }
+
+    if (fclose(fp) != 0 || rename(tmp_path, path) < 0) {
+        ERROR("Failed to write media info file: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int mp_finish(struct MPProbe *pr, long duration, curl_off_t nbytes)
+{
+    /* Set result from duration in seconds, bitrate is calculated from nbytes of audio data */
+    struct MediaInfo *info = pr->info;
+    if (duration <= 0) {
+        DEBUG("No duration found: %s\n", info->url);
+        info->result = MP_RESULT_ERROR;
+        return MP_DONE;
+    }
+
+    info->duration = duration;
+    if (nbytes > 0 && info->bitrate <= 0)
+        info->bitrate = (nbytes * 8) / duration / 1000;
+    info->result = MP_RESULT_SUCCESS;
+    return MP_DONE;
+}
+
+static int mp_fail(struct MPProbe *pr, const char *reason)
+{
+    DEBUG("Failed to probe: %s: %s\n", pr->info->url, reason);
+    pr->info->result = MP_RESULT_ERROR;
+    return MP_DONE;
+}
+
+static int mp3_frame_parse(const unsigned char *p, struct MP3Frame *frame)
+{
+    /* Parse 4 byte MPEG audio frame header, returns -1 when it isn't a valid header */
+    if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0)
+        return -1;
+
+    int version = (p[1] >> 3) & 0x03;
+    int layer = 4 - ((p[1] >> 1) & 0x03);
+    int bitrate_index = p[2] >> 4;
+    int samplerate_index = (p[2] >> 2) & 0x03;
+
+    // 1 is a reserved version, layer 4 is reserved
+    if (version == 1 || layer == 4 || bitrate_index == 15 || samplerate_index == 3)
+        return -1;
+
+    frame->v1 = (version == 3);
+    frame->layer = layer;
+    frame->mono = ((p[3] >> 6) == 3);
+
+    int table = (frame->v1) ? layer - 1 : ((layer == 1) ? 3 : 4);
+    frame->bitrate = mp3_bitrates[table][bitrate_index];
+
+    // version 2.5 has a quarter of the sample rate, 2 half
+    frame->samplerate = mp3_samplerates[samplerate_index];
+    if (version == 0)
+        frame->samplerate /= 4;
+    else if (version == 2)
+        frame->samplerate /= 2;
+
+    if (layer == 1)
+        frame->nsamples = 384;
+    else if (layer == 3 && !frame->v1)
+        frame->nsamples = 576;
+    else
+        frame->nsamples = 1152;
+    return 0;
+}
+
+static void mp3_id3_parse(struct MPProbe *pr)
+{
+    /* Find size of ID3v2 tag and duration from TLEN frame if it's in the buffer */
+    const unsigned char *p = pr->data;
+    int version = p[3];
+    int flags = p[5];
+
+    pr->audio_start = 10 + mp_syncsafe(p+6);
+    if (flags & 0x10)
+        pr->audio_start += 10;
+
+    // frame layout differs in v2.2, extended header is rare and isn't worth parsing
+    if ((version != 3 && version != 4) || (flags & 0x40))
+        return;
+
+    size_t end = (pr->audio_start < (curl_off_t)pr->length) ? (size_t)pr->audio_start : pr->length;
+    size_t pos = 10;
+    while (pos + 10 <= end && p[pos] != '\0') {
+        size_t size = (version == 4) ? mp_syncsafe(p+pos+4) : mp_be32(p+pos+4);
+        if (size > end - pos - 10)
+            break;
+
+        // text frame, first byte is encoding, duration is in ms
+        if (memcmp(p+pos, "TLEN", 4) == 0 && size > 1) {
+            char buf[32];
+            size_t n = (size - 1 < sizeof(buf) - 1) ? size - 1 : sizeof(buf) - 1;
+            memcpy(buf, p+pos+11, n);
+            buf[n] = '\0';
+            pr->tlen = strtol(buf, NULL, 10);
+            break;
+        }
+        pos += 10 + size;
+    }
+}
+
+static curl_off_t mp3_parse(struct MPProbe *pr)
+{
+    /* Duration from Xing/Info or VBRI header, TLEN frame or from bitrate of a CBR file */
+    struct MediaInfo *info = pr->info;
+    struct MP3Frame frame;
+
+    if (pr->offset == 0 && pr->length >= 10 && memcmp(pr->data, "ID3", 3) == 0)
+        mp3_id3_parse(pr);
+
+    // tag is bigger than the buffer, frames start later in the file
+    if (pr->audio_start < pr->offset || pr->audio_start + 4 > pr->offset + (curl_off_t)pr->length)
+        return pr->audio_start;
+
+    // there may be some padding or junk before the first frame
+    size_t pos = pr->audio_start - pr->offset;
+    while (pos + 4 <= pr->length && mp3_frame_parse(pr->data+pos, &frame) < 0)
+        pos++;
+
+    curl_off_t nbytes = (info->size > 0) ? info->size - pr->audio_start : -1;
+
+    if (pos + 4 > pr->length) {
+        if (pr->tlen > 0)
+            return mp_finish(pr, pr->tlen / 1000, nbytes);
+        return mp_fail(pr, "no mp3 frame found");
+    }
+
+    // Xing/Info header is after the side info of the first frame
+    size_t side_info = (frame.v1) ? ((frame.mono) ? 17 : 32) : ((frame.mono) ? 9 : 17);
+    size_t xing = pos + 4 + side_info;
+    size_t vbri = pos + 4 + 32;
+    long nframes = -1;
+
+    if (xing + 16 <= pr->length && (memcmp(pr->data+xing, "Xing", 4) == 0 || memcmp(pr->data+xing, "Info", 4) == 0)) {
+        uint32_t flags = mp_be32(pr->data+xing+4);
+        // optional fields follow the flags in order, bytes field moves up without frames field
+        size_t field = xing + 8;
+        if (flags & 0x01) {
+            nframes = mp_be32(pr->data+field);
+            field += 4;
+        }
+        if (flags & 0x02)
+            nbytes = mp_be32(pr->data+field);
+    }
+    else if (vbri + 18 <= pr->length && memcmp(pr->data+vbri, "VBRI", 4) == 0) {
+        nbytes = mp_be32(pr->data+vbri+10);
+        nframes = mp_be32(pr->data+vbri+14);
+    }
+
+    if (nframes > 0)
+        return mp_finish(pr, nframes * frame.nsamples / frame.samplerate, nbytes);
+    if (pr->tlen > 0)
+        return mp_finish(pr, pr->tlen / 1000, nbytes);
+
+    // constant bitrate, free format has no bitrate in the header
+    if (frame.bitrate <= 0 || nbytes <= 0)
+        return mp_fail(pr, "unknown mp3 bitrate or size");
+
+    info->bitrate = frame.bitrate;
+    return mp_finish(pr, (nbytes * 8) / (frame.bitrate * 1000), nbytes);
+}
+
+static curl_off_t mp4_mvhd_parse(struct MPProbe *pr, const unsigned char *p)
+{
+    /* Duration in timescale units, 64 bit values in version 1 */
+    uint32_t timescale;
+    uint64_t duration;
+
+    if (p[8] == 1) {
+        timescale = mp_be32(p+28);
+        duration = mp_be64(p+32);
+    }
+    else {
+        timescale = mp_be32(p+20);
+        duration = mp_be32(p+24);
+    }
+
+    if (timescale == 0)
+        return mp_fail(pr, "mp4 timescale is zero");
+    return mp_finish(pr, duration / timescale, pr->info->size);
+}
+
+static curl_off_t mp4_parse(struct MPProbe *pr)
+{
+    /* Walk boxes until 'moov', duration is in its 'mvhd' box. Box at pr->box is the next one to look at.
+     * Returns offset to fetch when a box header isn't in the buffer */
+    struct MediaInfo *info = pr->info;
+    curl_off_t parent_end = -1;
+
+    while (info->size < 0 || pr->box < info->size) {
+        if (parent_end >= 0 && pr->box >= parent_end)
+            return mp_fail(pr, "no mvhd box in moov");
+
+        curl_off_t pos = pr->box - pr->offset;
+        if (pos < 0 || pos + 8 > (curl_off_t)pr->length)
+            return pr->box;
+
+        const unsigned char *p = pr->data + pos;
+        curl_off_t size = mp_be32(p);
+        curl_off_t header = 8;
+
+        // 1 is a 64 bit size after the type, 0 is until end of file
+        if (size == 1) {
+            if (pos + 16 > (curl_off_t)pr->length)
+                return pr->box;
+            size = mp_be64(p+8);
+            header = 16;
+        }
+        else if (size == 0 && info->size > 0) {
+            size = info->size - pr->box;
+        }
+        if (size < header)
+            return mp_fail(pr, "invalid mp4 box size");
+
+        if (memcmp(p+4, "moov", 4) == 0) {
+            parent_end = pr->box + size;
+            pr->box += header;
+            continue;
+        }
+        if (memcmp(p+4, "mvhd", 4) == 0) {
+            if (pos + header + 40 > (curl_off_t)pr->length)
+                return pr->box;
+            return mp4_mvhd_parse(pr, p);
+        }
+        pr->box += size;
+    }
+    return mp_fail(pr, "no moov box found");
+}
+
+static curl_off_t ogg_parse(struct MPProbe *pr)
+{
+    /* Sample rate is in the header packet on the first page, amount of samples
+     * is the granule position of the last page */
+    struct MediaInfo *info = pr->info;
+
+    if (pr->ogg_rate == 0) {
+        if (pr->offset != 0 || pr->length < 28)
+            return mp_fail(pr, "no ogg header");
+
+        size_t pos = 27 + pr->data[26];
+        const unsigned char *p = pr->data + pos;
+        if (pos + 20 > pr->length)
+            return mp_fail(pr, "ogg header page too short");
+
+        if (memcmp(p, "\x01vorbis", 7) == 0) {
+            pr->ogg_rate = mp_le32(p+12);
+        }
+        else if (memcmp(p, "OpusHead", 8) == 0) {
+            // opus is always 48kHz, pre-skip samples aren't part of the duration
+            pr->ogg_rate = 48000;
+            pr->ogg_preskip = p[10] | (p[11] << 8);
+        }
+        if (pr->ogg_rate <= 0)
+            return mp_fail(pr, "unsupported ogg codec");
+    }
+
+    if (info->size < 0)
+        return mp_fail(pr, "ogg size unknown");
+
+    // last page should be in the tail of the file
+    if (pr->offset + (curl_off_t)pr->length < info->size)
+        return (info->size > MP_FETCH_SIZE) ? info->size - MP_FETCH_SIZE : 0;
+
+    for (long pos=(long)pr->length-14 ; pos>=0 ; pos--) {
+        const unsigned char *p = pr->data + pos;
+        if (memcmp(p, "OggS", 4) != 0)
+            continue;
+
+        // -1 means no packet ends on this page
+        uint64_t granule = mp_le64(p+6);
+        if (granule == UINT64_MAX)
+            continue;
+        if (granule <= (uint64_t)pr->ogg_preskip)
+            break;
+        return mp_finish(pr, (granule - pr->ogg_preskip) / pr->ogg_rate, info->size);
+    }
+    return mp_fail(pr, "no ogg page with granule position found");
+}
+
+static curl_off_t mp_parse(struct MPProbe *pr)
+{
+    /* Parse received data, returns offset of the next range to fetch or MP_DONE */
+    struct MediaInfo *info = pr->info;
+
+    if (info->format == MP_FORMAT_UNKNOWN) {
+        const unsigned char *p = pr->data;
+        if (pr->offset != 0 || pr->length < 12)
+            return mp_fail(pr, "file too short");
+
+        if (memcmp(p, "ID3", 3) == 0 || mp3_frame_parse(p, &(struct MP3Frame){0}) == 0)
+            info->format = MP_FORMAT_MP3;
+        else if (memcmp(p+4, "ftyp", 4) == 0)
+            info->format = MP_FORMAT_MP4;
+        else if (memcmp(p, "OggS", 4) == 0)
+            info->format = MP_FORMAT_OGG;
+        else
+            return mp_fail(pr, "unknown format");
+    }
+
+    switch (info->format) {
+        case MP_FORMAT_MP3:
+            return mp3_parse(pr);
+        case MP_FORMAT_MP4:
+            return mp4_parse(pr);
+        case MP_FORMAT_OGG:
+            return ogg_parse(pr);
+        default:
+            return mp_fail(pr, "unknown format");
+    }
+}
+
+static size_t mp_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    /* Fill buffer, transfer is stopped when it is full */
+    struct MPProbe *pr = userdata;
+    size_t chunksize = size * nmemb;
+    size_t n = MP_FETCH_SIZE - pr->length;
+    if (n > chunksize)
+        n = chunksize;
+
+    memcpy(pr->data + pr->length, ptr, n);
+    pr->length += n;
+
+    // returning less than chunksize stops the transfer
+    return n;
+}
+
+static int mp_probe_setup(struct MediaProbe *mp, struct MPProbe *pr, curl_off_t start)
+{
+    /* Setup curl handle to fetch MP_FETCH_SIZE bytes at start */
+    char range[64];
+    snprintf(range, sizeof(range), "%ld-%ld", start, start + MP_FETCH_SIZE - 1);
+
+    pr->offset = start;
+    pr->length = 0;
+    pr->nsteps++;
+
+    pr->curl = curl_easy_init();
+    if (pr->curl == NULL)
+        return -1;
+
+    curl_easy_setopt(pr->curl, CURLOPT_URL, pr->info->url);
+    curl_easy_setopt(pr->curl, CURLOPT_RANGE, range);
+    curl_easy_setopt(pr->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(pr->curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(pr->curl, CURLOPT_CONNECTTIMEOUT, mp->connect_timeout);
+    curl_easy_setopt(pr->curl, CURLOPT_TIMEOUT, mp->timeout);
+    curl_easy_setopt(pr->curl, CURLOPT_WRITEFUNCTION, mp_write_cb);
+    curl_easy_setopt(pr->curl, CURLOPT_WRITEDATA, pr);
+    curl_easy_setopt(pr->curl, CURLOPT_PRIVATE, pr);
+    if (mp->share != NULL)
+        curl_easy_setopt(pr->curl, CURLOPT_SHARE, mp->share);
+    return 0;
+}
+
+static int mp_probe_start(struct MediaProbe *mp, struct MPProbe *pr, struct MediaInfo *info)
+{
+    memset(pr, 0, sizeof(struct MPProbe));
+    pr->info = info;
+    pr->tlen = -1;
+    info->format = MP_FORMAT_UNKNOWN;
+    info->size = -1;
+    info->duration = -1;
+    info->bitrate = -1;
+
+    if (mp_probe_setup(mp, pr, 0) < 0) {
+        info->result = MP_RESULT_ERROR;
+        return -1;
+    }
+    return 0;
+}
+
+static curl_off_t mp_probe_finish(struct MPProbe *pr, CURLcode res)
+{
+    /* Find where received data is in the file and parse it.
+     * Returns offset of the next range to fetch or MP_DONE */
+    struct MediaInfo *info = pr->info;
+    long status_code = 0;
+    struct curl_header *h;
+
+    curl_easy_getinfo(pr->curl, CURLINFO_RESPONSE_CODE, &status_code);
+
+    // write callback stopped transfer because buffer is full
+    if (res == CURLE_WRITE_ERROR && pr->length == MP_FETCH_SIZE)
+        res = CURLE_OK;
+
+    if (res != CURLE_OK) {
+        curl_easy_cleanup(pr->curl);
+        pr->curl = NULL;
+        ERROR("Failed to probe: %s: %s\n", info->url, curl_easy_strerror(res));
+        info->result = MP_RESULT_ERROR;
+        return MP_DONE;
+    }
+
+    if (status_code == 206 && curl_easy_header(pr->curl, "Content-Range", 0, CURLH_HEADER, -1, &h) == CURLHE_OK) {
+        long start, end, size;
+        int n = sscanf(h->value, "bytes %ld-%ld/%ld", &start, &end, &size);
+        if (n >= 2)
+            pr->offset = start;
+        if (n == 3)
+            info->size = size;
+    }
+    // server ignored range and sent the file from the start
+    else {
+        curl_off_t length = -1;
+        curl_easy_getinfo(pr->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        pr->offset = 0;
+        if (length >= 0)
+            info->size = length;
+    }
+    curl_easy_cleanup(pr->curl);
+    pr->curl = NULL;
+
+    curl_off_t prev = pr->offset;
+    curl_off_t next = mp_parse(pr);
+    if (next == MP_DONE)
+        return MP_DONE;
+
+    if (status_code != 206)
+        return mp_fail(pr, "server doesn't support ranges");
+    if (next == prev || pr->nsteps >= MP_MAX_STEPS)
+        return mp_fail(pr, "needed data not received");
+    return next;
+}
+
+static struct MPProbe* mp_free_slot(struct MPProbe *slots, int nslots)
+{
+    for (int i=0 ; i<nslots ; i++) {
+        if (slots[i].curl == NULL)
+            return &slots[i];
+    }
+    return NULL;
+}
+
+int mp_run(struct MediaProbe *mp)
+{
+    /* Keep max_concurrent probes running until all pending urls are probed */
+    struct MPProbe *slots = calloc(mp->max_concurrent, sizeof(struct MPProbe));
+    if (slots == NULL) {
+        ERROR("Failed to allocate probes\n");
+        return -1;
+    }
+
+    CURLM *multi = curl_multi_init();
+    if (multi == NULL) {
+        free(slots);
+        return -1;
+    }
+
+    int ret = 0;
+    size_t ninfo = 0;
+    int running = 0;
+
+    while (ret == 0) {
+        // start new probes in free slots
+        struct MPProbe *pr;
+        while (ninfo < mp->ninfos && (pr = mp_free_slot(slots, mp->max_concurrent)) != NULL) {
+            struct MediaInfo *info = &mp->infos[ninfo++];
+            if (info->result != MP_RESULT_PENDING || mp_probe_start(mp, pr, info) < 0)
+                continue;
+
+            curl_multi_add_handle(multi, pr->curl);
+            running++;
+        }
+        if (running == 0)
+            break;
+
+        int still_running;
+        CURLMcode mc = curl_multi_perform(multi, &still_running);
+        if (mc == CURLM_OK)
+            mc = curl_multi_poll(multi, NULL, 0, 1000, NULL);
+
+        if (mc != CURLM_OK) {
+            ERROR("CURL multi error: %s\n", curl_multi_strerror(mc));
+            ret = -1;
+            break;
+        }
+
+        CURLMsg *msg;
+        int msgs_left;
+        while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&pr);
+            curl_multi_remove_handle(multi, pr->curl);
+
+            curl_off_t next = mp_probe_finish(pr, msg->data.result);
+            if (next != MP_DONE) {
+                DEBUG("Fetching range at %ld: %s\n", next, pr->info->url);
+                if (mp_probe_setup(mp, pr, next) == 0) {
+                    curl_multi_add_handle(multi, pr->curl);
+                    continue;
+                }
+                pr->info->result = MP_RESULT_ERROR;
+            }
+
+            pr->info->probed = time(NULL);
+            running--;
+        }
+    }
+
+    // only on errors, cleanup probes that are still running
+    for (int i=0 ; i<mp->max_concurrent ; i++) {
+        if (slots[i].curl != NULL) {
+            curl_multi_remove_handle(multi, slots[i].curl);
+            curl_easy_cleanup(slots[i].curl);
+            slots[i].info->result = MP_RESULT_ERROR;
+        }
+    }
+    curl_multi_cleanup(multi);
+    free(slots);
+
+    if (ret < 0)
+        return ret;
+
+    for (size_t i=0 ; i<mp->ninfos ; i++) {
+        if (mp->infos[i].result == MP_RESULT_ERROR || mp->infos[i].result == MP_RESULT_PENDING)
+            ret++;
+    }
+    return ret;
+}
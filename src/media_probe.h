@@ -0,0 +1,119 @@
+#ifndef MEDIA_PROBE_H
+#define MEDIA_PROBE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <curl/curl.h>
+
+#include "podcast.h"
+
+// Finds size, duration and bitrate of media files without downloading them.
+// The first MP_FETCH_SIZE bytes are fetched with a range request and parsed. When the
+// information isn't there, eg: a big ID3 tag, an MP4 'moov' box at the end or the last Ogg
+// page, the part of the file that has it is fetched with another range request.
+//
+//   MP3  ID3v2 TLEN frame, Xing/Info or VBRI frame count, or first frame header for CBR files
+//   MP4  duration and timescale from 'mvhd' box in 'moov'
+//   Ogg  sample rate from Vorbis or Opus header, sample count from granule of last page
+//
+// Probes run in parallel using the curl multi interface. Results are cached per url in a
+// tab separated file: url, format, size, duration, bitrate, probe time
+
+#define MP_FETCH_SIZE (16 * 1024)
+
+// max amount of range requests per file
+#define MP_MAX_STEPS 4
+
+#define MP_DEFAULT_CONCURRENT 8
+#define MP_MAX_CONCURRENT     32
+#define MP_INIT_INFOS         64
+#define MP_MAX_LINE           (PODCAST_MAX_URL + 128)
+
+extern int do_debug;
+extern int do_info;
+extern int do_error;
+
+enum MPFormat {
+    MP_FORMAT_UNKNOWN,
+    MP_FORMAT_MP3,
+    MP_FORMAT_MP4,
+    MP_FORMAT_OGG
+};
+
+enum MPResult {
+    MP_RESULT_ERROR,
+    MP_RESULT_PENDING,
+    MP_RESULT_SUCCESS
+};
+
+struct MediaInfo {
+    char url[PODCAST_MAX_URL];
+    enum MPFormat format;
+    enum MPResult result;
+
+    // -1 if unknown, duration in seconds and bitrate in kbit/s
+    curl_off_t size;
+    long duration;
+    long bitrate;
+
+    time_t probed;
+};
+
+// State of one probe, kept between range requests
+struct MPProbe {
+    CURL *curl;
+    struct MediaInfo *info;
+    int nsteps;
+
+    // received data starts at offset in file
+    curl_off_t offset;
+    unsigned char data[MP_FETCH_SIZE];
+    size_t length;
+
+    // mp3: first byte after ID3v2 tag, duration from TLEN frame in ms or -1
+    curl_off_t audio_start;
+    long tlen;
+
+    // mp4: offset of next top-level box
+    curl_off_t box;
+
+    // ogg: samples per second and samples to skip at start, 0 if header wasn't parsed
+    long ogg_rate;
+    long ogg_preskip;
+};
+
+struct MediaProbe {
+    struct MediaInfo *infos;
+    size_t ninfos;
+    size_t max_infos;
+
+    // max amount of files probed at the same time
+    int max_concurrent;
+    long connect_timeout;
+    long timeout;
+
+    // optional, shares DNS and TLS cache with API client
+    CURLSH *share;
+};
+
+int mp_init(struct MediaProbe *mp, int max_concurrent);
+void mp_free(struct MediaProbe *mp);
+int mp_load(struct MediaProbe *mp, const char *path);
+int mp_save(struct MediaProbe *mp, const char *path);
+
+struct MediaInfo* mp_get(struct MediaProbe *mp, const char *url);
+
+// Queue url for probing, returns 1 if it is cached already
+int mp_add(struct MediaProbe *mp, const char *url);
+
+// Probe all queued urls, returns amount of failed probes or -1 on error
+int mp_run(struct MediaProbe *mp);
+
+const char* mp_format_str(enum MPFormat format);
+
+#endif
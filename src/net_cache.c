@@ -0,0 +1,297 @@
+#include "net_cache.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+static void nc_hex_encode(FILE *fp, const unsigned char *data, size_t size)
+{
+    for (size_t i=0 ; i<size ; i++)
+        fprintf(fp, "%02x", data[i]);
+}
+
+static int nc_hex_decode(const char *hex, unsigned char *buf, size_t size)
+{
+    /* Decode hex string into buf, returns amount of bytes or -1 when it doesn't fit or isn't hex */
+    size_t len = strlen(hex);
+    if (len % 2 != 0 || len / 2 > size)
+        return -1;
+
+    for (size_t i=0 ; i<len/2 ; i++) {
+        unsigned int byte;
+        if (sscanf(hex + i*2, "%2x", &byte) != 1)
+            return -1;
+        buf[i] = byte;
+    }
+    return len / 2;
+}
+
+static void nc_copy_field(char *dest, const char *src, size_t size)
+{
+    /* Copy field, tabs and newlines would break the file format */
+    size_t i;
+    for (i=0 ; i<size-1 && src[i] != '\0' ; i++)
+        dest[i] = (src[i] == '\t' || src[i] == '\n' || src[i] == '\r') ? ' ' : src[i];
+    dest[i] = '\0';
+}
+
+static int nc_add_session(struct NetCache *nc, const char *key, const unsigned char *hmac, size_t hmac_len,
+                          const unsigned char *data, size_t data_len, time_t expires)
+{
+    /* Copy session into cache, a newer session for the same key replaces the old one */
+    if (hmac_len > NC_MAX_HMAC || strlen(key) >= NC_MAX_KEY)
+        return -1;
+
+    unsigned char *copy = malloc(data_len);
+    if (copy == NULL)
+        return -1;
+    memcpy(copy, data, data_len);
+
+    struct NCSession *s = NULL;
+    for (size_t i=0 ; i<nc->nsessions ; i++) {
+        if (strcmp(nc->sessions[i].key, key) == 0) {
+            s = &nc->sessions[i];
+            free(s->data);
+            break;
+        }
+    }
+    if (s == NULL) {
+        if (nc->nsessions >= NC_MAX_SESSIONS) {
+            free(copy);
+            return -1;
+        }
+        s = &nc->sessions[nc->nsessions++];
+    }
+
+    strcpy(s->key, key);
+    memcpy(s->hmac, hmac, hmac_len);
+    s->hmac_len = hmac_len;
+    s->data = copy;
+    s->data_len = data_len;
+    s->expires = expires;
+    return 0;
+}
+
+static void nc_load_session(struct NetCache *nc, char *key, char *hmac_hex, char *data_hex, time_t expires)
+{
+    unsigned char hmac[NC_MAX_HMAC];
+    size_t max_len = strlen(data_hex) / 2;
+    unsigned char *data = malloc(max_len + 1);
+    if (data == NULL)
+        return;
+
+    int hmac_len = nc_hex_decode(hmac_hex, hmac, sizeof(hmac));
+    int data_len = nc_hex_decode(data_hex, data, max_len);
+    if (hmac_len < 0 || data_len <= 0) {
+        DEBUG("Skipping malformed TLS session\n");
+    }
+    else {
+        nc_add_session(nc, key, hmac, hmac_len, data, data_len, expires);
+    }
+    free(data);
+}
+
+void nc_init(struct NetCache *nc)
+{
+    nc->naddresses = 0;
+    nc->nsessions = 0;
+}
+
+int nc_load(struct NetCache *nc, const char *path, time_t now)
+{
+    /* Load cache from file, expired entries are dropped. A missing file results in an empty cache */
+    char *line = NULL;
+    size_t line_size = 0;
+    nc_init(nc);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        ERROR("Failed to open net cache file: %s\n", path);
+        return -1;
+    }
+
+    // session data has no fixed size so lines are read with getline()
+    while (getline(&line, &line_size, fp) > 0) {
+        line[strcspn(line, "\n")] = '\0';
+
+        char *rest = line;
+        char *type = strsep(&rest, "\t");
+        char *f1 = strsep(&rest, "\t");
+        char *f2 = strsep(&rest, "\t");
+        char *f3 = strsep(&rest, "\t");
+        char *expires = strsep(&rest, "\t");
+
+        if (type == NULL || expires == NULL || strtoll(expires, NULL, 10) <= now)
+            continue;
+
+        if (strcmp(type, "dns") == 0 && nc->naddresses < NC_MAX_ADDRESSES) {
+            struct NCAddress *a = &nc->addresses[nc->naddresses++];
+            nc_copy_field(a->host, f1, NC_MAX_HOST);
+            a->port = strtol(f2, NULL, 10);
+            nc_copy_field(a->addr, f3, NC_MAX_ADDR);
+            a->expires = strtoll(expires, NULL, 10);
+        }
+        else if (strcmp(type, "tls") == 0) {
+            nc_load_session(nc, f1, f2, f3, strtoll(expires, NULL, 10));
+        }
+    }
+    free(line);
+    fclose(fp);
+    DEBUG("Loaded %ld addresses and %ld TLS sessions\n", nc->naddresses, nc->nsessions);
+    return 0;
+}
+
+int nc_save(struct NetCache *nc, const char *path)
+{
+    /* Write to temporary file and rename so a crash never leaves a half written cache.
+     * File holds TLS session secrets, so only the user can read it */
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    int fd = open(tmp_path, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    FILE *fp = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    if (fp == NULL) {
+        ERROR("Failed to open net cache file for writing: %s: %s\n", tmp_path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    for (size_t i=0 ; i<nc->naddresses ; i++) {
+        struct NCAddress *a = &nc->addresses[i];
+        fprintf(fp, "dns\t%s\t%ld\t%s\t%ld\n", a->host, a->port, a->addr, (long)a->expires);
+    }
+    for (size_t i=0 ; i<nc->nsessions ; i++) {
+        struct NCSession *s = &nc->sessions[i];
+        fprintf(fp, "tls\t%s\t", s->key);
+        nc_hex_encode(fp, s->hmac, s->hmac_len);
+        fprintf(fp, "\t");
+        nc_hex_encode(fp, s->data, s->data_len);
+        fprintf(fp, "\t%ld\n", (long)s->expires);
+    }
+
+    if (fclose(fp) != 0 || rename(tmp_path, path) < 0) {
+        ERROR("Failed to write net cache file: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+void nc_free(struct NetCache *nc)
+{
+    for (size_t i=0 ; i<nc->nsessions ; i++)
+        free(nc->sessions[i].data);
+    nc->nsessions = 0;
+}
+
+void nc_add_address(struct NetCache *nc, const char *host, long port, const char *addr, time_t now)
+{
+    /* Remember address of host. The expiry time of a known host isn't extended, otherwise an
+     * address that was passed to curl from the cache would never be resolved again */
+    if (strlen(host) == 0 || strlen(addr) == 0 || strlen(host) >= NC_MAX_HOST || strlen(addr) >= NC_MAX_ADDR)
+        return;
+
+    // host is an address, there is nothing to resolve
+    if (strcmp(host, addr) == 0)
+        return;
+
+    for (size_t i=0 ; i<nc->naddresses ; i++) {
+        if (nc->addresses[i].port == port && strcmp(nc->addresses[i].host, host) == 0)
+            return;
+    }
+    if (nc->naddresses >= NC_MAX_ADDRESSES)
+        return;
+
+    struct NCAddress *a = &nc->addresses[nc->naddresses++];
+    strcpy(a->host, host);
+    a->port = port;
+    strcpy(a->addr, addr);
+    a->expires = now + NC_DNS_TTL;
+}
+
+int nc_remove_address(struct NetCache *nc, const char *host, long port)
+{
+    /* Forget address, eg: when connecting to it failed. Returns 1 if address was found */
+    for (size_t i=0 ; i<nc->naddresses ; i++) {
+        if (nc->addresses[i].port == port && strcmp(nc->addresses[i].host, host) == 0) {
+            nc->addresses[i] = nc->addresses[--nc->naddresses];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+struct curl_slist* nc_resolve_list(struct NetCache *nc)
+{
+    /* Create list of host:port:address entries for CURLOPT_RESOLVE, IPv6 addresses need brackets */
+    struct curl_slist *list = NULL;
+    char entry[NC_MAX_HOST + NC_MAX_ADDR + 32];
+
+    for (size_t i=0 ; i<nc->naddresses ; i++) {
+        struct NCAddress *a = &nc->addresses[i];
+        if (strchr(a->addr, ':') != NULL)
+            snprintf(entry, sizeof(entry), "%s:%ld:[%s]", a->host, a->port, a->addr);
+        else
+            snprintf(entry, sizeof(entry), "%s:%ld:%s", a->host, a->port, a->addr);
+
+        struct curl_slist *tmp = curl_slist_append(list, entry);
+        if (tmp == NULL)
+            break;
+        list = tmp;
+    }
+    return list;
+}
+
+#if NC_HAVE_SSLS
+
+static CURLcode nc_export_cb(CURL *curl, void *userptr, const char *session_key,
+                             const unsigned char *shmac, size_t shmac_len,
+                             const unsigned char *sdata, size_t sdata_len,
+                             curl_off_t valid_until, int ietf_tls_id, const char *alpn, size_t earlydata_max)
+{
+    struct NetCache *nc = userptr;
+    (void)curl; (void)ietf_tls_id; (void)alpn; (void)earlydata_max;
+
+    if (session_key != NULL && sdata_len > 0)
+        nc_add_session(nc, session_key, shmac, shmac_len, sdata, sdata_len, valid_until);
+    return CURLE_OK;
+}
+
+int nc_import_sessions(struct NetCache *nc, CURL *curl)
+{
+    /* Put sessions in the TLS session cache of the share handle that curl uses */
+    int nimported = 0;
+    for (size_t i=0 ; i<nc->nsessions ; i++) {
+        struct NCSession *s = &nc->sessions[i];
+        if (curl_easy_ssls_import(curl, s->key, s->hmac, s->hmac_len, s->data, s->data_len) == CURLE_OK)
+            nimported++;
+    }
+    DEBUG("Imported %d/%ld TLS sessions\n", nimported, nc->nsessions);
+    return nimported;
+}
+
+int nc_export_sessions(struct NetCache *nc, CURL *curl)
+{
+    /* Copy sessions from the TLS session cache of the share handle that curl uses */
+    if (curl_easy_ssls_export(curl, nc_export_cb, nc) != CURLE_OK)
+        return -1;
+    return 0;
+}
+
+#else
+
+int nc_import_sessions(struct NetCache *nc, CURL *curl)
+{
+    (void)nc; (void)curl;
+    DEBUG("TLS sessions are not kept, needs curl >= 8.12, built with %s\n", LIBCURL_VERSION);
+    return 0;
+}
+
+int nc_export_sessions(struct NetCache *nc, CURL *curl)
+{
+    (void)nc; (void)curl;
+    return 0;
+}
+
+#endif
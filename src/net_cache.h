@@ -0,0 +1,79 @@
+#ifndef NET_CACHE_H
+#define NET_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <curl/curl.h>
+
+// Resolved addresses and TLS sessions that are kept between runs, so the first request to a
+// host doesn't need a DNS lookup and can resume its TLS session.
+// Stored as tab separated lines:
+//     dns  host  port  address  expires
+//     tls  session key  hex hmac  hex session  expires
+//
+// Addresses are passed to curl with CURLOPT_RESOLVE. Curl doesn't expose the TTL of a DNS
+// record so addresses expire NC_DNS_TTL seconds after they were first seen.
+// Exporting TLS sessions needs curl >= 8.12, older versions only keep addresses.
+
+#define NC_MAX_HOST      256
+#define NC_MAX_ADDR      64
+#define NC_MAX_ADDRESSES 256
+#define NC_MAX_SESSIONS  64
+#define NC_MAX_KEY       512
+#define NC_MAX_HMAC      64
+
+#define NC_DNS_TTL (60 * 60)
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+#define NC_HAVE_SSLS 1
+#else
+#define NC_HAVE_SSLS 0
+#endif
+
+extern int do_debug;
+extern int do_error;
+
+struct NCAddress {
+    char host[NC_MAX_HOST];
+    long port;
+    char addr[NC_MAX_ADDR];
+    time_t expires;
+};
+
+struct NCSession {
+    char key[NC_MAX_KEY];
+    unsigned char hmac[NC_MAX_HMAC];
+    size_t hmac_len;
+    unsigned char *data;
+    size_t data_len;
+    time_t expires;
+};
+
+struct NetCache {
+    struct NCAddress addresses[NC_MAX_ADDRESSES];
+    size_t naddresses;
+
+    struct NCSession sessions[NC_MAX_SESSIONS];
+    size_t nsessions;
+};
+
+void nc_init(struct NetCache *nc);
+int nc_load(struct NetCache *nc, const char *path, time_t now);
+int nc_save(struct NetCache *nc, const char *path);
+void nc_free(struct NetCache *nc);
+
+void nc_add_address(struct NetCache *nc, const char *host, long port, const char *addr, time_t now);
+int nc_remove_address(struct NetCache *nc, const char *host, long port);
+struct curl_slist* nc_resolve_list(struct NetCache *nc);
+
+int nc_import_sessions(struct NetCache *nc, CURL *curl);
+int nc_export_sessions(struct NetCache *nc, CURL *curl);
+
+#endif
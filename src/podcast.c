@@ -1,5 +1,53 @@
 #include "podcast.h"
 
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+// Must be in the same order as enum PodActions
+static const char *podcast_action_names[] = {
+    "download",
+    "delete",
+    "play",
+    "new",
+    "flattr",
+    NULL
+};
+
+// Subscriptions are an array of podcast URLs
+static const struct JSONBindField podcast_fields[] = {
+    { NULL, offsetof(struct Podcast, url), JSON_BIND_STRING, PODCAST_MAX_URL, NULL },
+};
+
+static const struct JSONBindField episode_action_fields[] = {
+    { "podcast",   offsetof(struct EpisodeAction, pod.url),   JSON_BIND_STRING, PODCAST_MAX_URL,       NULL },
+    { "episode",   offsetof(struct EpisodeAction, ep.url),    JSON_BIND_STRING, PODCAST_MAX_URL,       NULL },
+    { "guid",      offsetof(struct EpisodeAction, ep.guid),   JSON_BIND_STRING, PODCAST_MAX_GUID,      NULL },
+    { "action",    offsetof(struct EpisodeAction, action),    JSON_BIND_ENUM,   0,                     podcast_action_names },
+    { "timestamp", offsetof(struct EpisodeAction, timestamp), JSON_BIND_STRING, PODCAST_MAX_TIMESTAMP, NULL },
+    { "started",   offsetof(struct EpisodeAction, started),   JSON_BIND_INT,    0,                     NULL },
+    { "position",  offsetof(struct EpisodeAction, position),  JSON_BIND_INT,    0,                     NULL },
+    { "total",     offsetof(struct EpisodeAction, total),     JSON_BIND_INT,    0,                     NULL },
+};
+
+// Episodes in local podcast files, see struct EpisodeWriter
+static const struct JSONBindField episode_fields[] = {
+    { "title",     offsetof(struct Episode, title),     JSON_BIND_STRING, PODCAST_MAX_TITLE, NULL },
+    { "guid",      offsetof(struct Episode, guid),      JSON_BIND_STRING, PODCAST_MAX_GUID,  NULL },
+    { "url",       offsetof(struct Episode, url),       JSON_BIND_STRING, PODCAST_MAX_URL,   NULL },
+    { "published", offsetof(struct Episode, published), JSON_BIND_LONG,   0,                 NULL },
+};
+
+struct JSONBindSchema podcast_schema = JSON_BIND_SCHEMA(struct Podcast, podcast_fields, "add");
+struct JSONBindSchema podcast_remove_schema = JSON_BIND_SCHEMA(struct Podcast, podcast_fields, "remove");
+struct JSONBindSchema podcast_subscribed_schema = JSON_BIND_SCHEMA(struct Podcast, podcast_fields, "subscriptions");
+struct JSONBindSchema episode_action_schema = JSON_BIND_SCHEMA(struct EpisodeAction, episode_action_fields, "actions");
+struct JSONBindSchema episode_schema = JSON_BIND_SCHEMA(struct Episode, episode_fields, NULL);
+
+// First element of a podcast file, see struct EpisodeWriter
+static const struct JSONBindField podcast_file_fields[] = {
+    { "podcast", offsetof(struct Podcast, url), JSON_BIND_STRING, PODCAST_MAX_URL, NULL },
+};
+static struct JSONBindSchema podcast_file_schema = JSON_BIND_SCHEMA(struct Podcast, podcast_file_fields, NULL);
 
 struct Podcast podcast_init()
 {
@@ -13,6 +61,7 @@ struct Episode episode_init()
     ep.url[0] = '\0';
     ep.guid[0] = '\0';
     ep.title[0] = '\0';
+    ep.published = 0;
     ep.started = -1;
     ep.position = -1;
     ep.total = -1;
@@ -26,48 +75,309 @@ int podcast_add_episode(struct Podcast *pod, struct Episode ep)
 
 }
 
-/*
-int podcast_serialize(struct Podcast *pod, char *buf)
+const char* podcast_action_to_str(enum PodActions action)
+{
+    if (action < POD_ACTION_DOWNLOAD || action > POD_ACTION_FLATTR)
+        return NULL;
+    return podcast_action_names[action];
+}
+
+int episode_action_serialize(struct JSONWriter *jw, struct EpisodeAction *action)
+{
+    /* Append action as a JSON object to writer, in the format that is expected
+     * by the gpoddersync episode_action/create endpoint.
+     * Position fields are only valid for play actions */
+    const char *action_str = podcast_action_to_str(action->action);
+    if (action_str == NULL) {
+        ERROR("Failed to serialize episode action, no valid action\n");
+        return -1;
+    }
+
+    if (jw_object_open(jw) < 0 ||
+        jw_key(jw, "podcast") < 0 || jw_string(jw, action->pod.url) < 0 ||
+        jw_key(jw, "episode") < 0 || jw_string(jw, action->ep.url) < 0 ||
+        jw_key(jw, "guid") < 0 || jw_string(jw, action->ep.guid) < 0 ||
+        jw_key(jw, "action") < 0 || jw_string(jw, action_str) < 0 ||
+        jw_key(jw, "timestamp") < 0 || jw_string(jw, action->timestamp) < 0)
+        return -1;
+
+    if (action->action == POD_ACTION_PLAY) {
+        if (jw_key(jw, "started") < 0 || jw_int(jw, action->started) < 0 ||
+            jw_key(jw, "position") < 0 || jw_int(jw, action->position) < 0 ||
+            jw_key(jw, "total") < 0 || jw_int(jw, action->total) < 0)
+            return -1;
+    }
+    return jw_object_close(jw);
+}
+
+int episodes_load(const char *path, struct JSONBind *bind)
+{
+    /* Podcast files hold a JSON array with one episode object per line.
+     * Every line is parsed as an element of the top-level array, lines that fail
+     * to parse are skipped. The podcast object is on the line that opens the array
+     * and is skipped with it. Files written by older versions have a comma after the
+     * last episode and no closing bracket, these load the same way.
+     * Returns amount of episodes or -1 on error */
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        ERROR("Failed to open episodes: %s\n", path);
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+
+    char *buf = malloc(size + 1);
+    if (buf == NULL) {
+        ERROR("Failed to allocate episodes buffer\n");
+        fclose(fp);
+        return -1;
+    }
+    size_t n = fread(buf, 1, size, fp);
+    buf[n] = '\0';
+    fclose(fp);
+
+    struct JSONRecords records;
+    if (json_records_init(&records) < 0 || json_ndjson_split(buf, n, &records) < 0) {
+        free(buf);
+        json_records_free(&records);
+        return -1;
+    }
+    records.parent = JSON_DTYPE_ARRAY;
+
+    struct JSON json = json_init(json_bind_handle_data_cb);
+    json.user_data = bind;
+
+    // the array is put on the stack by the records parser and never started, so tell binder
+    bind->array_pos = 0;
+
+    for (size_t i=0 ; i<records.length ; i++) {
+        struct JSONRecord *r = &records.records[i];
+        char *line = buf + r->offset;
+
+        // strip separator and skip the lines that open and close the array
+        while (r->length > 0 && strchr(" \t\r,", line[r->length-1]) != NULL)
+            r->length--;
+        while (r->length > 0 && strchr(" \t", *line) != NULL) {
+            line++;
+            r->offset++;
+            r->length--;
+        }
+        if (r->length == 0 || *line != '{')
+            continue;
+
+        if (json_parse_record(&json, buf, &records, i) < 0) {
+            DEBUG("Skipping episode on line %ld: %s\n", i+1, path);
+            bind->in_record = 0;
+        }
+    }
+
+    free(buf);
+    json_records_free(&records);
+    return bind->nrecords;
+}
+
+int episodes_load_podcast(const char *path, struct Podcast *pod)
+{
+    /* Read feed url of podcast file from the line that opens the array.
+     * Returns 1 if found, 0 if file has none, eg: it is written by an older version, or -1 on error */
+    char buf[PODCAST_MAX_URL * 6 + 32];
+    memset(pod, 0, sizeof(struct Podcast));
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        ERROR("Failed to open episodes: %s\n", path);
+        return -1;
+    }
+    // one byte of room is left behind the line for the record parser
+    char *line = fgets(buf, sizeof(buf) - 1, fp);
+    fclose(fp);
+    if (line == NULL || buf[0] != '[' || buf[1] != '{')
+        return 0;
+
+    size_t length = strcspn(buf, "\r\n");
+    buf[length] = '\0';
+
+    struct JSONRecords records;
+    struct JSONBind bind;
+    if (json_records_init(&records) < 0 || json_records_add(&records, 1, length - 1) < 0 ||
+        json_bind_init(&bind, &podcast_file_schema, pod, 1) < 0) {
+        json_records_free(&records);
+        return -1;
+    }
+    records.parent = JSON_DTYPE_ARRAY;
+    bind.array_pos = 0;
+
+    struct JSON json = json_init(json_bind_handle_data_cb);
+    json.user_data = &bind;
+    int res = json_parse_record(&json, buf, &records, 0);
+    json_records_free(&records);
+
+    return (res == 0 && bind.nrecords == 1 && strlen(pod->url) > 0) ? 1 : 0;
+}
+
+void episode_writer_init(struct EpisodeWriter *ew)
+{
+    ew->fd = -1;
+    ew->nepisodes = 0;
+    ew->error = 0;
+    ew->path[0] = '\0';
+    ew->tmp_path[0] = '\0';
+    ew->jw.buf = NULL;
+}
+
+static void episode_writer_close(struct EpisodeWriter *ew)
 {
-    const char *fmt = "{ \"podcast\" : \"%s\", \
-\"episode\" : \"%s\", \
-\"timestamp\" : \"%s\", \
-\"guid\" : \"%s\", \
-\"action\" : \"%s\", \
-\"position\" : \"%d\", \
-\"started\" : \"%d\", \
-\"total\" : \"%d\" }";
-
-    char action[16] = "";
-    switch (pod->action) {
-        case POD_ACTION_DOWNLOAD:
-            strcpy(action, "download");
-            break;
-        case POD_ACTION_DELETE:
-            strcpy(action, "delete");
-            break;
-        case POD_ACTION_PLAY:
-            strcpy(action, "play");
-            break;
-        case POD_ACTION_NEW:
-            strcpy(action, "new");
-            break;
-        case POD_ACTION_FLATTR:
-            strcpy(action, "flattr");
-            break;
-        default:
-            ERROR("Failed to serialize podcast, no valid action\n");
+    if (ew->fd >= 0)
+        close(ew->fd);
+    if (ew->jw.buf != NULL)
+        jw_free(&ew->jw);
+    episode_writer_init(ew);
+}
+
+static int episode_writer_flush(struct EpisodeWriter *ew)
+{
+    /* Write serialized episodes to temporary file and empty buffer */
+    struct JSONWriter *jw = &ew->jw;
+    size_t written = 0;
+    while (written < jw->length) {
+        ssize_t n = write(ew->fd, jw->buf + written, jw->length - written);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ERROR("Failed to write to: %s: %s\n", ew->tmp_path, strerror(errno));
+            ew->error = 1;
             return -1;
+        }
+        written += n;
+    }
+    jw_reset(jw);
+    return 0;
+}
+
+static int episode_writer_sync_dir(const char *path)
+{
+    /* Sync dir of path, so a file that was renamed into it stays after a crash */
+    char dir[EPISODE_WRITER_MAX_PATH];
+    strcpy(dir, path);
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else
+        *slash = '\0';
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    int ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+int episode_writer_open(struct EpisodeWriter *ew, const char *dir, const char *name, const char *url)
+{
+    /* Create temporary file for podcast file dir/name.json of the feed at url.
+     * Nothing happens when writer is open already */
+    if (ew->fd >= 0)
+        return 0;
+
+    episode_writer_init(ew);
+    if (strlen(dir) + strlen(name) + sizeof("/.json") > EPISODE_WRITER_MAX_PATH) {
+        ERROR("Podcast file path too long: %s/%s\n", dir, name);
+        return -1;
+    }
+    sprintf(ew->path, "%s/%s.json", dir, name);
+    sprintf(ew->tmp_path, "%s.XXXXXX", ew->path);
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        ERROR("Failed to create dir: %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    // room for a full buffer and the episode that fills it, writer grows for bigger episodes
+    if (jw_init(&ew->jw, EPISODE_WRITER_BUF_SIZE * 2) < 0)
+        return -1;
+
+    // unique name, hedged transfers of the same feed both write a file
+    ew->fd = mkstemp(ew->tmp_path);
+    if (ew->fd < 0) {
+        ERROR("Failed to create: %s: %s\n", ew->tmp_path, strerror(errno));
+        episode_writer_close(ew);
+        return -1;
     }
+    fchmod(ew->fd, 0644);
 
-    sprintf(buf, fmt, pod->podcast,
-                      pod->episode,
-                      pod->timestamp,
-                      pod->guid,
-                      action,
-                      pod->position,
-                      pod->started,
-                      pod->total);
+    // feed url is on the line that opens the array, see episodes_load_podcast()
+    struct JSONWriter *jw = &ew->jw;
+    if (jw_raw(jw, "[", 1) < 0 || jw_object_open(jw) < 0 || jw_key(jw, "podcast") < 0 ||
+        jw_string(jw, url) < 0 || jw_object_close(jw) < 0) {
+        ew->error = 1;
+        return -1;
+    }
     return 0;
 }
-*/
+
+int episode_writer_add(struct EpisodeWriter *ew, struct Episode *ep)
+{
+    /* Serialize episode on its own line, separator is written before every episode */
+    if (ew->fd < 0 || ew->error)
+        return -1;
+
+    struct JSONWriter *jw = &ew->jw;
+    if (jw_raw(jw, ",\n    ", 6) < 0 ||
+        jw_object_open(jw) < 0 ||
+        jw_key(jw, "title") < 0 || jw_string(jw, ep->title) < 0 ||
+        jw_key(jw, "guid") < 0 || jw_string(jw, ep->guid) < 0 ||
+        jw_key(jw, "url") < 0 || jw_string(jw, ep->url) < 0 ||
+        jw_key(jw, "published") < 0 || jw_int(jw, ep->published) < 0 ||
+        jw_object_close(jw) < 0) {
+        ERROR("Failed to serialize episode: %s\n", ep->url);
+        ew->error = 1;
+        return -1;
+    }
+    ew->nepisodes++;
+
+    if (jw->length >= EPISODE_WRITER_BUF_SIZE)
+        return episode_writer_flush(ew);
+    return 0;
+}
+
+int episode_writer_commit(struct EpisodeWriter *ew)
+{
+    /* Close array, write remaining data and move file into place.
+     * File is synced once, before rename, so the podcast file is always complete.
+     * Dir is synced after rename so the new file is the one found after a crash */
+    if (ew->fd < 0)
+        return 0;
+
+    int ret = 0;
+    if (ew->error || jw_raw(&ew->jw, "\n]\n", 3) < 0 || episode_writer_flush(ew) < 0) {
+        ret = -1;
+    }
+    else if (fsync(ew->fd) < 0 || rename(ew->tmp_path, ew->path) < 0) {
+        ERROR("Failed to write podcast file: %s: %s\n", ew->path, strerror(errno));
+        ret = -1;
+    }
+    else if (episode_writer_sync_dir(ew->path) < 0) {
+        // file is complete, only the rename may not survive a crash
+        ERROR("Failed to sync dir of podcast file: %s: %s\n", ew->path, strerror(errno));
+    }
+
+    if (ret < 0)
+        unlink(ew->tmp_path);
+    else
+        DEBUG("Wrote %ld episodes to %s\n", ew->nepisodes, ew->path);
+
+    episode_writer_close(ew);
+    return ret;
+}
+
+void episode_writer_abort(struct EpisodeWriter *ew)
+{
+    /* Remove temporary file, podcast file stays as it was */
+    if (ew->fd < 0)
+        return;
+    unlink(ew->tmp_path);
+    episode_writer_close(ew);
+}
@@ -7,8 +7,14 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 //#include "utils.h"
+#include "lib/json/json_writer.h"
+#include "lib/json/json_bind.h"
+#include "lib/json/json_records.h"
 
 enum PodFields {
     POD_FIELD_PODCAST,
@@ -30,7 +36,6 @@ enum PodActions {
     POD_ACTION_FLATTR
 };
 
-#define EPISODE_JSON_FMT "    {\"title\" : \"%s\", \"guid\" : \"%s\", \"url\" : \"%s\"},\n"
 
 #define PODCAST_MAX_URL       512
 #define PODCAST_MAX_EPISODES   32
@@ -39,10 +44,15 @@ enum PodActions {
 #define PODCAST_MAX_ACTION     32
 #define PODCAST_MAX_TIMESTAMP 64
 
-#define PODCAST_MAX_SERIALIZED 1024*2
-
 #define PODCAST_DL_FORMAT ""
 
+// Podcast files are written in one go when the feed is parsed, see struct EpisodeWriter
+#define EPISODE_WRITER_BUF_SIZE (64 * 1024)
+#define EPISODE_WRITER_MAX_PATH 256
+
+extern int do_debug;
+extern int do_error;
+
 struct Podcast {
     char url[PODCAST_MAX_URL];
     char title[PODCAST_MAX_TITLE];
@@ -56,6 +66,9 @@ struct Episode {
     char url[PODCAST_MAX_URL];
     char guid[PODCAST_MAX_GUID];
     char title[PODCAST_MAX_TITLE];
+
+    // unix time from pubDate, 0 if unknown
+    long published;
     int started;
     int position;
     int total;
@@ -71,10 +84,45 @@ struct EpisodeAction {
     int total;
 };
 
+// Writes the episodes of one feed to a podcast file while the feed is parsed.
+// Episodes are serialized straight into the buffer of jw, which is written to the file when it
+// holds EPISODE_WRITER_BUF_SIZE bytes. File is a JSON array with one episode per line, the first
+// element is {"podcast": <feed url>} on the line that opens the array.
+// Data goes to a temporary file that replaces the podcast file on commit, so a failed or
+// cancelled transfer leaves the previous file in place.
+// fd is -1 when writer isn't open
+struct EpisodeWriter {
+    int fd;
+    char path[EPISODE_WRITER_MAX_PATH];
+    char tmp_path[EPISODE_WRITER_MAX_PATH + 8];
+    size_t nepisodes;
+    int error;
+    struct JSONWriter jw;
+};
+
+// Descriptors to decode API responses straight into structs, see lib/json/json_bind.h
+extern struct JSONBindSchema podcast_schema;
+extern struct JSONBindSchema podcast_remove_schema;
+extern struct JSONBindSchema podcast_subscribed_schema;
+extern struct JSONBindSchema episode_action_schema;
+extern struct JSONBindSchema episode_schema;
+
 struct Podcast podcast_init();
+struct Episode episode_init();
 int podcast_add_episode(struct Podcast *pod, struct Episode ep);
 
-int podcast_serialize(struct Podcast *pod, char *buf);
+const char* podcast_action_to_str(enum PodActions action);
+int episode_action_serialize(struct JSONWriter *jw, struct EpisodeAction *action);
+
+// Load episodes from a podcast file that is written while syncing into bind
+int episodes_load(const char *path, struct JSONBind *bind);
+int episodes_load_podcast(const char *path, struct Podcast *pod);
+
+void episode_writer_init(struct EpisodeWriter *ew);
+int episode_writer_open(struct EpisodeWriter *ew, const char *dir, const char *name, const char *url);
+int episode_writer_add(struct EpisodeWriter *ew, struct Episode *ep);
+int episode_writer_commit(struct EpisodeWriter *ew);
+void episode_writer_abort(struct EpisodeWriter *ew);
 
 
 #endif
@@ -0,0 +1,154 @@
+#include "response_cache.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+int rc_init(struct ResponseCache *rc, const char *dir)
+{
+    /* Create cache dir, parent dir should exist */
+    if (strlen(dir) >= RC_MAX_PATH) {
+        ERROR("Cache path too long: %s\n", dir);
+        return -1;
+    }
+    strcpy(rc->dir, dir);
+
+    if (mkdir(rc->dir, 0755) < 0 && errno != EEXIST) {
+        ERROR("Failed to create cache dir: %s: %s\n", rc->dir, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void rc_path(struct ResponseCache *rc, uint64_t hash, char *buf, size_t size)
+{
+    snprintf(buf, size, "%s/%016lx%s", rc->dir, hash, RC_EXT);
+}
+
+void rc_tee_init(struct RCTee *tee)
+{
+    tee->fd = -1;
+    tee->tmp_path[0] = '\0';
+}
+
+int rc_tee_open(struct ResponseCache *rc, struct RCTee *tee)
+{
+    /* Create temporary file in cache dir, so it can be renamed into place */
+    snprintf(tee->tmp_path, sizeof(tee->tmp_path), "%s/tmp.XXXXXX", rc->dir);
+    tee->fd = mkstemp(tee->tmp_path);
+    if (tee->fd < 0) {
+        ERROR("Failed to create cache file: %s: %s\n", tee->tmp_path, strerror(errno));
+        tee->tmp_path[0] = '\0';
+        return -1;
+    }
+    return 0;
+}
+
+void rc_tee_write(struct RCTee *tee, const char *data, size_t size)
+{
+    /* Caching is best effort, on errors the body is not cached but the response is still parsed */
+    size_t written = 0;
+    while (tee->fd >= 0 && written < size) {
+        ssize_t n = write(tee->fd, data + written, size - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            ERROR("Failed to write cache file: %s: %s\n", tee->tmp_path, strerror(errno));
+            rc_tee_abort(tee);
+            return;
+        }
+        written += n;
+    }
+}
+
+int rc_tee_commit(struct ResponseCache *rc, struct RCTee *tee, uint64_t hash)
+{
+    /* Move complete body into place, an existing file already has the same content */
+    char path[RC_MAX_PATH + 32];
+    struct stat st;
+
+    if (tee->fd < 0)
+        return -1;
+
+    close(tee->fd);
+    tee->fd = -1;
+    rc_path(rc, hash, path, sizeof(path));
+
+    if (stat(path, &st) == 0) {
+        unlink(tee->tmp_path);
+    }
+    else if (rename(tee->tmp_path, path) < 0) {
+        ERROR("Failed to rename cache file: %s\n", path);
+        unlink(tee->tmp_path);
+        return -1;
+    }
+    DEBUG("Cached: %s\n", path);
+    return 0;
+}
+
+void rc_remove(struct ResponseCache *rc, uint64_t hash)
+{
+    char path[RC_MAX_PATH + 32];
+    rc_path(rc, hash, path, sizeof(path));
+    if (unlink(path) == 0) {
+        DEBUG("Removed from cache: %s\n", path);
+    }
+    else if (errno != ENOENT) {
+        ERROR("Failed to remove cache file: %s: %s\n", path, strerror(errno));
+    }
+}
+
+void rc_tee_abort(struct RCTee *tee)
+{
+    if (tee->fd < 0)
+        return;
+    close(tee->fd);
+    unlink(tee->tmp_path);
+    tee->fd = -1;
+}
+
+char* rc_map(struct ResponseCache *rc, uint64_t hash, size_t *size)
+{
+    /* Map file with one extra zeroed page behind it, so the data is always NUL terminated,
+     * also when file size is a multiple of the page size.
+     * Mapping is private and writable, changes are not written back to the file */
+    char path[RC_MAX_PATH + 32];
+    struct stat st;
+    rc_path(rc, hash, path, sizeof(path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        ERROR("Failed to open cache file: %s\n", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t map_size = (st.st_size / page + 1) * page;
+
+    char *data = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    if (st.st_size > 0 && mmap(data, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        ERROR("Failed to map cache file: %s: %s\n", path, strerror(errno));
+        munmap(data, map_size);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    *size = st.st_size;
+    return data;
+}
+
+void rc_unmap(char *data, size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    munmap(data, (size / page + 1) * page);
+}
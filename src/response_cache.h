@@ -0,0 +1,52 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// Content addressed cache of response bodies.
+// Bodies are written to a temporary file while they are received and parsed. When the
+// response is complete the file is renamed to <hash>.xml, where hash is the FNV-1a hash
+// of the body, see lib/hash/hash.h. Identical bodies are stored once.
+// Cached bodies are mapped into memory so they can be parsed again without network.
+
+#define RC_MAX_PATH 256
+#define RC_EXT      ".xml"
+
+extern int do_debug;
+extern int do_error;
+
+struct ResponseCache {
+    char dir[RC_MAX_PATH];
+};
+
+// Body that is being written, fd is -1 when not in use or after a write error
+struct RCTee {
+    int fd;
+    char tmp_path[RC_MAX_PATH + 32];
+};
+
+int rc_init(struct ResponseCache *rc, const char *dir);
+void rc_path(struct ResponseCache *rc, uint64_t hash, char *buf, size_t size);
+
+void rc_tee_init(struct RCTee *tee);
+int rc_tee_open(struct ResponseCache *rc, struct RCTee *tee);
+void rc_tee_write(struct RCTee *tee, const char *data, size_t size);
+int rc_tee_commit(struct ResponseCache *rc, struct RCTee *tee, uint64_t hash);
+void rc_tee_abort(struct RCTee *tee);
+
+// Remove body that is superseded, caller makes sure no other feed has the same body
+void rc_remove(struct ResponseCache *rc, uint64_t hash);
+
+// Map cached body, mapping is NUL terminated so it can be used as a string
+char* rc_map(struct ResponseCache *rc, uint64_t hash, size_t *size);
+void rc_unmap(char *data, size_t size);
+
+#endif
@@ -0,0 +1,374 @@
+#include "subscription_store.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+void subscription_set_init(struct SubscriptionSet *set)
+{
+    set->pods = NULL;
+    set->length = 0;
+    set->max = 0;
+    set->table = NULL;
+    set->table_size = 0;
+}
+
+static size_t subscription_set_slot(struct SubscriptionSet *set, const char *url)
+{
+    /* Return slot of url in table, or the empty slot where it should go */
+    size_t slot = hash_str(url) & (set->table_size-1);
+
+    while (set->table[slot] != 0 && strcmp(set->pods[set->table[slot]-1].url, url) != 0)
+        slot = (slot + 1) & (set->table_size-1);
+    return slot;
+}
+
+static int subscription_set_rehash(struct SubscriptionSet *set, size_t table_size)
+{
+    /* Build table of table_size slots for all podcasts in set */
+    size_t *table = calloc(table_size, sizeof(size_t));
+    if (table == NULL) {
+        ERROR("Failed to allocate subscription table\n");
+        return -1;
+    }
+    free(set->table);
+    set->table = table;
+    set->table_size = table_size;
+
+    for (size_t i=0 ; i<set->length ; i++)
+        set->table[subscription_set_slot(set, set->pods[i].url)] = i + 1;
+    return 0;
+}
+
+struct Podcast* subscription_set_get(struct SubscriptionSet *set, const char *url)
+{
+    if (set->length == 0)
+        return NULL;
+
+    size_t slot = subscription_set_slot(set, url);
+    return (set->table[slot] != 0) ? &set->pods[set->table[slot]-1] : NULL;
+}
+
+int subscription_set_add(struct SubscriptionSet *set, const char *url)
+{
+    /* Add podcast with url, returns 1 if it was added, 0 if it was already in set */
+    if (strlen(url) == 0 || strlen(url) >= PODCAST_MAX_URL)
+        return -1;
+    if (subscription_set_get(set, url) != NULL)
+        return 0;
+
+    if (set->length >= set->max) {
+        size_t max = (set->max > 0) ? set->max * 2 : SUBSCRIPTION_SET_INIT_TABLE / 2;
+        struct Podcast *tmp = realloc(set->pods, sizeof(struct Podcast) * max);
+        if (tmp == NULL) {
+            ERROR("Failed to grow subscription set to %ld\n", max);
+            return -1;
+        }
+        set->pods = tmp;
+        set->max = max;
+    }
+
+    if ((set->length + 1) * 2 > set->table_size) {
+        size_t table_size = (set->table_size > 0) ? set->table_size * 2 : SUBSCRIPTION_SET_INIT_TABLE;
+        if (subscription_set_rehash(set, table_size) < 0)
+            return -1;
+    }
+
+    struct Podcast *pod = &set->pods[set->length++];
+    memset(pod, 0, sizeof(struct Podcast));
+    strcpy(pod->url, url);
+    set->table[subscription_set_slot(set, url)] = set->length;
+    return 1;
+}
+
+int subscription_set_remove(struct SubscriptionSet *set, const char *url)
+{
+    /* Remove podcast with url, returns 1 if it was removed, 0 if it wasn't in set.
+     * Last podcast takes its place in pods. The slot is freed with backward shift deletion:
+     * entries behind it in the probe sequence move up when the free slot is on their way
+     * from their home slot, so lookups never stop early and no tombstones are needed */
+    if (set->length == 0)
+        return 0;
+
+    size_t mask = set->table_size - 1;
+    size_t slot = subscription_set_slot(set, url);
+    if (set->table[slot] == 0)
+        return 0;
+
+    size_t index = set->table[slot] - 1;
+    size_t last = set->length - 1;
+    if (index != last) {
+        set->table[subscription_set_slot(set, set->pods[last].url)] = index + 1;
+        set->pods[index] = set->pods[last];
+    }
+    set->length--;
+
+    set->table[slot] = 0;
+    for (size_t i=(slot+1) & mask ; set->table[i] != 0 ; i=(i+1) & mask) {
+        size_t home = hash_str(set->pods[set->table[i]-1].url) & mask;
+
+        // entry stays when its home is cyclically in (slot, i]
+        if ((slot < i) ? (home > slot && home <= i) : (home > slot || home <= i))
+            continue;
+
+        set->table[slot] = set->table[i];
+        set->table[i] = 0;
+        slot = i;
+    }
+    return 1;
+}
+
+void subscription_set_clear(struct SubscriptionSet *set)
+{
+    set->length = 0;
+    if (set->table != NULL)
+        memset(set->table, 0, sizeof(size_t) * set->table_size);
+}
+
+void subscription_set_free(struct SubscriptionSet *set)
+{
+    free(set->pods);
+    free(set->table);
+    subscription_set_init(set);
+}
+
+int subscription_set_serialize(struct JSONWriter *jw, const char *key, struct SubscriptionSet *set)
+{
+    /* Append set as an array of urls at key, in the format that is used by the
+     * gpoddersync subscription_change/create endpoint */
+    if (jw_key(jw, key) < 0 || jw_array_open(jw) < 0)
+        return -1;
+
+    for (size_t i=0 ; i<set->length ; i++) {
+        if (jw_string(jw, set->pods[i].url) < 0)
+            return -1;
+    }
+    return jw_array_close(jw);
+}
+
+int subscription_parser_init(struct SubscriptionParser *sp)
+{
+    memset(sp, 0, sizeof(struct SubscriptionParser));
+    sp->timestamp = -1;
+
+    if (json_bind_init_growable(&sp->subscribed, &podcast_subscribed_schema) < 0 ||
+        json_bind_init_growable(&sp->add, &podcast_schema) < 0 ||
+        json_bind_init_growable(&sp->remove, &podcast_remove_schema) < 0) {
+        subscription_parser_free(sp);
+        return -1;
+    }
+    return 0;
+}
+
+void subscription_parser_free(struct SubscriptionParser *sp)
+{
+    json_bind_free(&sp->subscribed);
+    json_bind_free(&sp->add);
+    json_bind_free(&sp->remove);
+}
+
+void subscription_store_handle_data_cb(struct JSON *json, enum JSONEvent ev, void *user_data)
+{
+    /* Bind all url arrays and catch the top-level timestamp: {object, key, value} */
+    struct SubscriptionParser *sp = user_data;
+    json_bind_handle_data_cb(json, ev, &sp->subscribed);
+    json_bind_handle_data_cb(json, ev, &sp->add);
+    json_bind_handle_data_cb(json, ev, &sp->remove);
+
+    if (ev == JSON_EV_NUMBER && json->stack_pos == 2 && stack_item_is_type(json, 2, JSON_DTYPE_OBJECT) == 1) {
+        struct JSONItem *key = stack_get_from_end(json, 1);
+        if (strcmp(key->data, SUBSCRIPTION_STORE_TIMESTAMP_KEY) == 0)
+            sp->timestamp = strtol(stack_get_from_end(json, 0)->data, NULL, 10);
+    }
+}
+
+static int subscription_store_take(struct SubscriptionSet *set, struct JSONBind *bind)
+{
+    /* Add bound podcasts to set */
+    struct Podcast *pods = bind->records;
+    for (size_t i=0 ; i<bind->nrecords ; i++) {
+        if (subscription_set_add(set, pods[i].url) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int subscription_store_load(struct SubscriptionStore *store, const char *path)
+{
+    /* Load state from file, a missing file results in an empty store that syncs all subscriptions */
+    subscription_set_init(&store->subscribed);
+    subscription_set_init(&store->add);
+    subscription_set_init(&store->remove);
+    store->since = -1;
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        ERROR("Failed to open subscription store: %s\n", path);
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+
+    char *buf = malloc(size + 1);
+    if (buf == NULL) {
+        ERROR("Failed to allocate subscription store buffer\n");
+        fclose(fp);
+        return -1;
+    }
+    size_t n = fread(buf, 1, size, fp);
+    buf[n] = '\0';
+    fclose(fp);
+
+    struct SubscriptionParser sp;
+    if (subscription_parser_init(&sp) < 0) {
+        free(buf);
+        return -1;
+    }
+
+    struct JSON json = json_init(subscription_store_handle_data_cb);
+    json.user_data = &sp;
+    json.is_complete = 1;
+
+    char *chunks[2] = {buf, NULL};
+    size_t nread = json_parse(&json, chunks, 2);
+    free(buf);
+
+    int ret = 0;
+    if (nread == (size_t)-1 || json.stack_pos != -1 || sp.subscribed.overflow || sp.add.overflow || sp.remove.overflow) {
+        ERROR("Failed to parse subscription store: %s\n", path);
+        ret = -1;
+    }
+    else if (subscription_store_take(&store->subscribed, &sp.subscribed) < 0 ||
+             subscription_store_take(&store->add, &sp.add) < 0 ||
+             subscription_store_take(&store->remove, &sp.remove) < 0) {
+        ret = -1;
+    }
+    store->since = sp.timestamp;
+    subscription_parser_free(&sp);
+
+    if (ret < 0) {
+        subscription_store_free(store);
+        return -1;
+    }
+
+    DEBUG("Loaded %ld subscriptions, changes: +%ld -%ld, since: %ld\n",
+          store->subscribed.length, store->add.length, store->remove.length, store->since);
+    return 0;
+}
+
+static int subscription_store_flush(struct JSONWriter *jw, FILE *fp)
+{
+    char buf[4096];
+    size_t n;
+    while ((n = jw_read(jw, buf, sizeof(buf))) > 0) {
+        if (fwrite(buf, 1, n, fp) != n)
+            return -1;
+    }
+    return 0;
+}
+
+int subscription_store_save(struct SubscriptionStore *store, const char *path)
+{
+    /* Serialize to temporary file and rename, so state and cursor are replaced together */
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    struct JSONWriter jw;
+    if (jw_init(&jw, 0) < 0)
+        return -1;
+
+    FILE *fp = fopen(tmp_path, "w");
+    if (fp == NULL) {
+        ERROR("Failed to open subscription store for writing: %s\n", tmp_path);
+        jw_free(&jw);
+        return -1;
+    }
+
+    int ret = 0;
+    jw_object_open(&jw);
+    jw_key(&jw, SUBSCRIPTION_STORE_TIMESTAMP_KEY);
+    jw_int(&jw, store->since);
+
+    if (subscription_set_serialize(&jw, podcast_subscribed_schema.array_key, &store->subscribed) < 0 ||
+        subscription_set_serialize(&jw, podcast_schema.array_key, &store->add) < 0 ||
+        subscription_set_serialize(&jw, podcast_remove_schema.array_key, &store->remove) < 0)
+        ret = -1;
+
+    jw_object_close(&jw);
+
+    if (ret == 0)
+        ret = subscription_store_flush(&jw, fp);
+
+    jw_free(&jw);
+
+    if (fclose(fp) != 0 || ret < 0 || rename(tmp_path, path) < 0) {
+        ERROR("Failed to write subscription store: %s\n", path);
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int subscription_store_subscribe(struct SubscriptionStore *store, const char *url)
+{
+    /* Subscribe locally, change is uploaded on next sync. A pending removal is cancelled */
+    if (subscription_set_remove(&store->remove, url) < 0)
+        return -1;
+
+    int res = subscription_set_add(&store->subscribed, url);
+    if (res <= 0)
+        return res;
+    return subscription_set_add(&store->add, url);
+}
+
+int subscription_store_unsubscribe(struct SubscriptionStore *store, const char *url)
+{
+    /* Unsubscribe locally, change is uploaded on next sync. A pending addition is cancelled */
+    if (subscription_set_remove(&store->add, url) < 0)
+        return -1;
+
+    int res = subscription_set_remove(&store->subscribed, url);
+    if (res <= 0)
+        return res;
+    return subscription_set_add(&store->remove, url);
+}
+
+int subscription_store_apply(struct SubscriptionStore *store, struct SubscriptionParser *sp)
+{
+    /* Merge changes from server, local changes that weren't uploaded yet take precedence.
+     * Returns amount of subscriptions that changed */
+    struct Podcast *add = sp->add.records;
+    struct Podcast *remove = sp->remove.records;
+    int nchanged = 0;
+
+    for (size_t i=0 ; i<sp->remove.nrecords ; i++) {
+        if (subscription_set_get(&store->add, remove[i].url) != NULL)
+            continue;
+
+        int res = subscription_set_remove(&store->subscribed, remove[i].url);
+        if (res < 0)
+            return -1;
+        nchanged += res;
+    }
+
+    for (size_t i=0 ; i<sp->add.nrecords ; i++) {
+        if (subscription_set_get(&store->remove, add[i].url) != NULL)
+            continue;
+
+        int res = subscription_set_add(&store->subscribed, add[i].url);
+        if (res < 0)
+            return -1;
+        nchanged += res;
+    }
+    return nchanged;
+}
+
+void subscription_store_free(struct SubscriptionStore *store)
+{
+    subscription_set_free(&store->subscribed);
+    subscription_set_free(&store->add);
+    subscription_set_free(&store->remove);
+}
@@ -0,0 +1,81 @@
+#ifndef SUBSCRIPTION_STORE_H
+#define SUBSCRIPTION_STORE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "podcast.h"
+#include "lib/json/json.h"
+#include "lib/json/json_bind.h"
+#include "lib/json/json_writer.h"
+#include "lib/hash/hash.h"
+
+// Local subscriptions, changes that were made locally and still have to be uploaded, and
+// the timestamp that the server returned on the last successful subscription sync.
+// Stored in the same format as a subscriptions response with the subscribed urls added,
+// so the same parser can be used:
+//     {"timestamp": 1666000000, "subscriptions": [...], "add": [...], "remove": [...]}
+
+#define SUBSCRIPTION_STORE_TIMESTAMP_KEY "timestamp"
+
+// Initial size of the url hash table, must be a power of 2
+#define SUBSCRIPTION_SET_INIT_TABLE 64
+
+extern int do_debug;
+extern int do_error;
+
+// Growable set of podcasts, looked up by url
+struct SubscriptionSet {
+    struct Podcast *pods;
+    size_t length;
+    size_t max;
+
+    // index+1 of podcast in pods, 0 is empty. Size is a power of 2 and at least twice length
+    size_t *table;
+    size_t table_size;
+};
+
+struct SubscriptionStore {
+    struct SubscriptionSet subscribed;
+
+    // local changes that were not uploaded yet
+    struct SubscriptionSet add;
+    struct SubscriptionSet remove;
+
+    // cursor, only changes newer than this are requested from server
+    long since;
+};
+
+// Is passed as user data to subscription_store_handle_data_cb()
+struct SubscriptionParser {
+    struct JSONBind subscribed;
+    struct JSONBind add;
+    struct JSONBind remove;
+
+    // top-level timestamp, -1 if not found
+    long timestamp;
+};
+
+void subscription_set_init(struct SubscriptionSet *set);
+struct Podcast* subscription_set_get(struct SubscriptionSet *set, const char *url);
+int subscription_set_add(struct SubscriptionSet *set, const char *url);
+int subscription_set_remove(struct SubscriptionSet *set, const char *url);
+void subscription_set_clear(struct SubscriptionSet *set);
+void subscription_set_free(struct SubscriptionSet *set);
+int subscription_set_serialize(struct JSONWriter *jw, const char *key, struct SubscriptionSet *set);
+
+int subscription_parser_init(struct SubscriptionParser *sp);
+void subscription_parser_free(struct SubscriptionParser *sp);
+void subscription_store_handle_data_cb(struct JSON *json, enum JSONEvent ev, void *user_data);
+
+int subscription_store_load(struct SubscriptionStore *store, const char *path);
+int subscription_store_save(struct SubscriptionStore *store, const char *path);
+int subscription_store_subscribe(struct SubscriptionStore *store, const char *url);
+int subscription_store_unsubscribe(struct SubscriptionStore *store, const char *url);
+int subscription_store_apply(struct SubscriptionStore *store, struct SubscriptionParser *sp);
+void subscription_store_free(struct SubscriptionStore *store);
+
+#endif
@@ -0,0 +1,876 @@
+#include "test_server.h"
+
+#define DEBUG(M, ...) if(do_debug){fprintf(stdout, "[DEBUG] " M, ##__VA_ARGS__);}
+#define INFO(M, ...) if(do_info){fprintf(stdout, M, ##__VA_ARGS__);}
+#define ERROR(M, ...) if(do_error){fprintf(stderr, "[ERROR] (%s:%d) " M, __FILE__, __LINE__, ##__VA_ARGS__);}
+
+// One client connection, requests are handled one after the other (keep-alive)
+struct TSConn {
+    struct TestServer *ts;
+    int fd;
+
+    // received data, may contain the start of the next request
+    char buf[TS_MAX_REQUEST];
+    size_t len;
+
+    // parsed request
+    char method[8];
+    char target[TS_MAX_PATH];
+    char if_none_match[TS_MAX_HEADER];
+    char authorization[TS_MAX_HEADER];
+    int accept_gzip;
+    int keep_alive;
+
+    char *body;
+    size_t body_len;
+};
+
+// Growable buffer for response bodies
+struct TSBuffer {
+    char *data;
+    size_t size;
+    size_t max_size;
+};
+
+static int ts_buf_append(struct TSBuffer *b, const void *data, size_t size)
+{
+    if (b->size + size + 1 > b->max_size) {
+        size_t max_size = (b->max_size > 0) ? b->max_size : 4096;
+        while (b->size + size + 1 > max_size)
+            max_size *= 2;
+
+        char *tmp = realloc(b->data, max_size);
+        if (tmp == NULL)
+            return -1;
+        b->data = tmp;
+        b->max_size = max_size;
+    }
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+    b->data[b->size] = '\0';
+    return 0;
+}
+
+static int ts_buf_printf(struct TSBuffer *b, const char *fmt, ...)
+{
+    char tmp[TS_MAX_PATH * 2];
+    va_list ptr;
+    va_start(ptr, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ptr);
+    va_end(ptr);
+
+    if (n < 0 || (size_t)n >= sizeof(tmp))
+        return -1;
+    return ts_buf_append(b, tmp, n);
+}
+
+static int ts_file_load(struct TSFile *f, const char *path)
+{
+    /* Read complete file into memory */
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        ERROR("Failed to open: %s\n", path);
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    f->data = malloc(size + 1);
+    if (f->data == NULL || fread(f->data, 1, size, fp) != (size_t)size) {
+        ERROR("Failed to read: %s\n", path);
+        free(f->data);
+        f->data = NULL;
+        fclose(fp);
+        return -1;
+    }
+    f->data[size] = '\0';
+    f->size = size;
+    fclose(fp);
+    return 0;
+}
+
+void ts_init(struct TestServer *ts)
+{
+    ts->mode = TS_MODE_SYNTHETIC;
+    ts->port = TS_DEFAULT_PORT;
+    ts->nfeeds = TS_DEFAULT_FEEDS;
+    ts->naliases = 0;
+    ts->latency_ms = 0;
+    ts->bandwidth = 0;
+    ts->chunk_size = TS_DEFAULT_CHUNK;
+    ts->gzip = 0;
+    ts->not_modified = 1;
+    ts->session[0] = '\0';
+
+    ts->feed.data = NULL;
+    ts->rss.data = NULL;
+    ts->json.data = NULL;
+    ts->records = NULL;
+    ts->nrecords = 0;
+
+    ts->fd = -1;
+    ts->running = 0;
+    ts->nrequests = 0;
+    ts->nbytes = 0;
+    ts->timestamp = 1;
+    ts->nconns = 0;
+}
+
+int ts_configure(struct TestServer *ts, const char *spec)
+{
+    /* Parse comma separated key=value pairs, see test_server.h */
+    char buf[TS_MAX_PATH];
+    strncpy(buf, spec, sizeof(buf)-1);
+    buf[sizeof(buf)-1] = '\0';
+
+    char *rest = buf;
+    char *item;
+    while ((item = strsep(&rest, ",")) != NULL) {
+        if (strlen(item) == 0)
+            continue;
+
+        char *value = strchr(item, '=');
+        if (value == NULL) {
+            ERROR("Test server option needs a value: %s\n", item);
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (strcmp(item, "port") == 0)
+            ts->port = atoi(value);
+        else if (strcmp(item, "feeds") == 0)
+            ts->nfeeds = atoi(value);
+        else if (strcmp(item, "aliases") == 0)
+            ts->naliases = atoi(value);
+        else if (strcmp(item, "latency") == 0)
+            ts->latency_ms = atol(value);
+        else if (strcmp(item, "bandwidth") == 0)
+            ts->bandwidth = atol(value);
+        else if (strcmp(item, "chunk") == 0)
+            ts->chunk_size = atol(value);
+        else if (strcmp(item, "gzip") == 0)
+            ts->gzip = atoi(value);
+        else if (strcmp(item, "304") == 0)
+            ts->not_modified = atoi(value);
+        else if (strcmp(item, "record") == 0 || strcmp(item, "replay") == 0) {
+            ts->mode = (strcmp(item, "record") == 0) ? TS_MODE_RECORD : TS_MODE_REPLAY;
+            strncpy(ts->session, value, sizeof(ts->session)-1);
+            ts->session[sizeof(ts->session)-1] = '\0';
+        }
+        else {
+            ERROR("Unknown test server option: %s\n", item);
+            return -1;
+        }
+    }
+
+    if (ts->chunk_size == 0 || ts->nfeeds < 0 || ts->naliases < 0 || ts->naliases > ts->nfeeds || ts->latency_ms < 0 || ts->bandwidth < 0) {
+        ERROR("Invalid test server options: %s\n", spec);
+        return -1;
+    }
+    return 0;
+}
+
+static int ts_session_load(struct TestServer *ts)
+{
+    /* Load index of recorded responses, a missing index is an empty session */
+    char path[TS_MAX_PATH + sizeof(TS_SESSION_INDEX) + 1];
+    char line[TS_MAX_PATH + TS_MAX_HEADER + 64];
+    snprintf(path, sizeof(path), "%s/%s", ts->session, TS_SESSION_INDEX);
+
+    ts->records = malloc(sizeof(struct TSRecord) * TS_MAX_RECORDS);
+    if (ts->records == NULL)
+        return -1;
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        if (ts->mode == TS_MODE_RECORD && errno == ENOENT)
+            return 0;
+        ERROR("Failed to open session: %s\n", path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL && ts->nrecords < TS_MAX_RECORDS) {
+        line[strcspn(line, "\n")] = '\0';
+
+        char *rest = line;
+        char *method = strsep(&rest, "\t");
+        char *url    = strsep(&rest, "\t");
+        char *status = strsep(&rest, "\t");
+        char *ctype  = strsep(&rest, "\t");
+        char *hash   = strsep(&rest, "\t");
+        if (hash == NULL)
+            continue;
+
+        struct TSRecord *r = &ts->records[ts->nrecords++];
+        snprintf(r->method, sizeof(r->method), "%s", method);
+        snprintf(r->url, sizeof(r->url), "%s", url);
+        snprintf(r->content_type, sizeof(r->content_type), "%s", ctype);
+        r->status = atol(status);
+        r->hash = strtoull(hash, NULL, 16);
+    }
+    fclose(fp);
+    DEBUG("Loaded %ld recorded responses\n", ts->nrecords);
+    return 0;
+}
+
+static int ts_write_all(int fd, const char *data, size_t size)
+{
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = send(fd, data + written, size - written, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        written += n;
+    }
+    return 0;
+}
+
+static int ts_gzip(const char *data, size_t size, struct TSBuffer *out)
+{
+    /* Wrap data in gzip format using stored deflate blocks.
+     * Data is not compressed, but the client has to decode it the same way */
+    static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+    if (ts_buf_append(out, header, sizeof(header)) < 0)
+        return -1;
+
+    size_t offset = 0;
+    do {
+        size_t n = (size - offset > TS_GZIP_BLOCK) ? TS_GZIP_BLOCK : size - offset;
+        unsigned char block[5];
+        block[0] = (offset + n == size) ? 1 : 0;
+        block[1] = n & 0xff;
+        block[2] = (n >> 8) & 0xff;
+        block[3] = ~n & 0xff;
+        block[4] = (~n >> 8) & 0xff;
+
+        if (ts_buf_append(out, block, sizeof(block)) < 0 || ts_buf_append(out, data + offset, n) < 0)
+            return -1;
+        offset += n;
+    } while (offset < size);
+
+    uint32_t crc = crc32_final(crc32_update(CRC32_INIT, data, size));
+    unsigned char trailer[8];
+    for (int i=0 ; i<4 ; i++) {
+        trailer[i] = (crc >> (i*8)) & 0xff;
+        trailer[i+4] = (size >> (i*8)) & 0xff;
+    }
+    return ts_buf_append(out, trailer, sizeof(trailer));
+}
+
+static const char* ts_status_text(long status)
+{
+    switch (status) {
+        case 200: return "OK";
+        case 301: return "Moved Permanently";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 502: return "Bad Gateway";
+        default:  return "Unknown";
+    }
+}
+
+static int ts_respond(struct TSConn *c, long status, const char *content_type, const char *body, size_t size)
+{
+    /* Send response with configured latency, chunk size and bandwidth */
+    struct TestServer *ts = c->ts;
+    struct TSBuffer head = { NULL, 0, 0 };
+    struct TSBuffer gz = { NULL, 0, 0 };
+    char etag[32];
+
+    if (ts->latency_ms > 0)
+        usleep(ts->latency_ms * 1000);
+
+    snprintf(etag, sizeof(etag), "\"%016lx\"", hash_data(body, size));
+    if (status == 200 && ts->not_modified && strcmp(c->if_none_match, etag) == 0) {
+        status = 304;
+        size = 0;
+    }
+
+    if (status == 200 && ts->gzip && c->accept_gzip && size > 0) {
+        if (ts_gzip(body, size, &gz) < 0) {
+            free(gz.data);
+            return -1;
+        }
+        body = gz.data;
+        size = gz.size;
+    }
+
+    ts_buf_printf(&head, "HTTP/1.1 %ld %s\r\n", status, ts_status_text(status));
+    ts_buf_printf(&head, "ETag: %s\r\n", etag);
+    if (status != 304) {
+        ts_buf_printf(&head, "Content-Type: %s\r\n", content_type);
+        ts_buf_printf(&head, "Content-Length: %ld\r\n", size);
+    }
+    if (gz.data != NULL)
+        ts_buf_printf(&head, "Content-Encoding: gzip\r\n");
+    if (!c->keep_alive)
+        ts_buf_printf(&head, "Connection: close\r\n");
+    ts_buf_printf(&head, "\r\n");
+
+    int ret = ts_write_all(c->fd, head.data, head.size);
+    free(head.data);
+
+    for (size_t offset=0 ; ret == 0 && status != 304 && offset<size ; offset+=ts->chunk_size) {
+        size_t n = (size - offset > ts->chunk_size) ? ts->chunk_size : size - offset;
+        ret = ts_write_all(c->fd, body + offset, n);
+
+        if (ts->bandwidth > 0)
+            usleep(n * 1000000 / ts->bandwidth);
+    }
+
+    pthread_mutex_lock(&ts->lock);
+    ts->nrequests++;
+    ts->nbytes += size;
+    pthread_mutex_unlock(&ts->lock);
+
+    free(gz.data);
+    return ret;
+}
+
+static int ts_redirect(struct TSConn *c, const char *location)
+{
+    /* Send permanent redirect without body */
+    struct TSBuffer head = { NULL, 0, 0 };
+
+    if (c->ts->latency_ms > 0)
+        usleep(c->ts->latency_ms * 1000);
+
+    ts_buf_printf(&head, "HTTP/1.1 301 %s\r\n", ts_status_text(301));
+    ts_buf_printf(&head, "Location: %s\r\n", location);
+    ts_buf_printf(&head, "Content-Length: 0\r\n");
+    if (!c->keep_alive)
+        ts_buf_printf(&head, "Connection: close\r\n");
+    ts_buf_printf(&head, "\r\n");
+
+    int ret = ts_write_all(c->fd, head.data, head.size);
+    free(head.data);
+
+    pthread_mutex_lock(&c->ts->lock);
+    c->ts->nrequests++;
+    pthread_mutex_unlock(&c->ts->lock);
+    return ret;
+}
+
+static int ts_feed(struct TSConn *c, int nfeed)
+{
+    /* Serve test feed with feed number in channel title, so every feed is written to its own file */
+    struct TSFile *f = &c->ts->feed;
+    struct TSBuffer b = { NULL, 0, 0 };
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "Feed %d ", nfeed);
+
+    char *title = strstr(f->data, "<title>");
+    if (title == NULL)
+        return ts_respond(c, 200, "application/rss+xml", f->data, f->size);
+
+    title += strlen("<title>");
+    if (strncmp(title, "<![CDATA[", 9) == 0)
+        title += 9;
+
+    ts_buf_append(&b, f->data, title - f->data);
+    ts_buf_append(&b, prefix, strlen(prefix));
+    ts_buf_append(&b, title, f->size - (title - f->data));
+
+    int ret = ts_respond(c, 200, "application/rss+xml", b.data, b.size);
+    free(b.data);
+    return ret;
+}
+
+static int ts_synthetic(struct TSConn *c)
+{
+    /* Serve test files and fake gpoddersync endpoints */
+    struct TestServer *ts = c->ts;
+    struct TSBuffer b = { NULL, 0, 0 };
+    int ret;
+
+    pthread_mutex_lock(&ts->lock);
+    long timestamp = ts->timestamp++;
+    pthread_mutex_unlock(&ts->lock);
+
+    if (strncmp(c->target, "/feed/", 6) == 0)
+        return ts_feed(c, atoi(c->target + 6));
+    if (strncmp(c->target, "/moved/", 7) == 0) {
+        char location[64];
+        snprintf(location, sizeof(location), "/feed/%d", atoi(c->target + 7));
+        return ts_redirect(c, location);
+    }
+    if (strcmp(c->target, "/rss") == 0)
+        return ts_respond(c, 200, "application/rss+xml", ts->rss.data, ts->rss.size);
+    if (strcmp(c->target, "/test.json") == 0)
+        return ts_respond(c, 200, "application/json", ts->json.data, ts->json.size);
+
+    if (strstr(c->target, "/gpoddersync/episode_action/create") != NULL ||
+        strstr(c->target, "/gpoddersync/subscription_change/create") != NULL) {
+        ts_buf_printf(&b, "{\"timestamp\": %ld, \"update_urls\": []}", timestamp);
+    }
+    else if (strstr(c->target, "/gpoddersync/episode_action") != NULL) {
+        ts_buf_printf(&b, "{\"actions\": [");
+        for (int i=0 ; i<ts->nfeeds ; i++) {
+            ts_buf_printf(&b, "%s{\"podcast\": \"http://127.0.0.1:%d/feed/%d\", \"episode\": \"http://127.0.0.1:%d/media/%d.mp3\", "
+                              "\"guid\": \"%d\", \"action\": \"play\", \"timestamp\": \"2023-01-01T00:00:00\", "
+                              "\"started\": 0, \"position\": %d, \"total\": 3600}",
+                          (i > 0) ? ", " : "", ts->port, i, ts->port, i, i, i * 60);
+        }
+        ts_buf_printf(&b, "], \"timestamp\": %ld}", timestamp);
+    }
+    else if (strstr(c->target, "/gpoddersync/subscriptions?since=") != NULL) {
+        // subscriptions never change, so a client that synced before gets an empty delta
+        ts_buf_printf(&b, "{\"add\": [], \"remove\": [], \"timestamp\": %ld}", timestamp);
+    }
+    else if (strstr(c->target, "/gpoddersync/subscriptions") != NULL) {
+        ts_buf_printf(&b, "{\"add\": [");
+        for (int i=0 ; i<ts->nfeeds ; i++)
+            ts_buf_printf(&b, "%s\"http://127.0.0.1:%d/feed/%d\"", (i > 0) ? ", " : "", ts->port, i);
+        for (int i=0 ; i<ts->naliases ; i++) {
+            ts_buf_printf(&b, ", \"http://127.0.0.1:%d/moved/%d\"", ts->port, i);
+            ts_buf_printf(&b, ", \"HTTP://127.0.0.1:%d/feed/%d#latest\"", ts->port, i);
+        }
+        ts_buf_printf(&b, "], \"remove\": [], \"timestamp\": %ld}", timestamp);
+    }
+    else {
+        return ts_respond(c, 404, "text/plain", "", 0);
+    }
+
+    ret = ts_respond(c, 200, "application/json", b.data, b.size);
+    free(b.data);
+    return ret;
+}
+
+static size_t ts_record_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    if (ts_buf_append(userdata, ptr, size * nmemb) < 0)
+        return 0;
+    return size * nmemb;
+}
+
+static void ts_body_path(struct TestServer *ts, uint64_t hash, char *path, size_t size)
+{
+    snprintf(path, size, "%s/%016lx.body", ts->session, hash);
+}
+
+static int ts_record(struct TSConn *c)
+{
+    /* Forward request to url in request path, save response and send it to client */
+    struct TestServer *ts = c->ts;
+    struct TSBuffer b = { NULL, 0, 0 };
+    struct curl_slist *headers = NULL;
+    const char *url = c->target + 1;
+    char path[TS_MAX_PATH * 2];
+    long status = 0;
+    char *ctype = NULL;
+
+    if (strncmp(url, "http://", 7) != 0 && strncmp(url, "https://", 8) != 0)
+        return ts_respond(c, 400, "text/plain", "", 0);
+
+    CURL *curl = curl_easy_init();
+    if (curl == NULL)
+        return -1;
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ts_record_write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &b);
+
+    if (strlen(c->authorization) > 0) {
+        snprintf(path, sizeof(path), "Authorization: %s", c->authorization);
+        headers = curl_slist_append(headers, path);
+    }
+    if (strcmp(c->method, "POST") == 0) {
+        headers = curl_slist_append(headers, "Content-Type: application/json");
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, c->body ? c->body : "");
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)c->body_len);
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+    CURLcode res = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &ctype);
+
+    if (res != CURLE_OK) {
+        ERROR("Failed to record: %s: %s\n", url, curl_easy_strerror(res));
+        curl_easy_cleanup(curl);
+        curl_slist_free_all(headers);
+        free(b.data);
+        return ts_respond(c, 502, "text/plain", "", 0);
+    }
+
+    struct TSRecord r;
+    snprintf(r.method, sizeof(r.method), "%s", c->method);
+    snprintf(r.url, sizeof(r.url), "%s", url);
+    snprintf(r.content_type, sizeof(r.content_type), "%s", ctype ? ctype : "application/octet-stream");
+    r.status = status;
+    r.hash = hash_data(b.data ? b.data : "", b.size);
+    curl_easy_cleanup(curl);
+    curl_slist_free_all(headers);
+
+    // body is content addressed, identical responses are stored once
+    ts_body_path(ts, r.hash, path, sizeof(path));
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL || fwrite(b.data ? b.data : "", 1, b.size, fp) != b.size)
+        ERROR("Failed to write: %s\n", path);
+    if (fp != NULL)
+        fclose(fp);
+
+    pthread_mutex_lock(&ts->lock);
+    snprintf(path, sizeof(path), "%s/%s", ts->session, TS_SESSION_INDEX);
+    fp = fopen(path, "a");
+    if (fp != NULL) {
+        fprintf(fp, "%s\t%s\t%ld\t%s\t%016lx\n", r.method, r.url, r.status, r.content_type, r.hash);
+        fclose(fp);
+    }
+    if (ts->nrecords < TS_MAX_RECORDS)
+        ts->records[ts->nrecords++] = r;
+    pthread_mutex_unlock(&ts->lock);
+
+    DEBUG("Recorded: %s %s %ld\n", r.method, r.url, r.status);
+    int ret = ts_respond(c, r.status, r.content_type, b.data ? b.data : "", b.size);
+    free(b.data);
+    return ret;
+}
+
+static struct TSRecord* ts_replay_find(struct TestServer *ts, const char *method, const char *url)
+{
+    /* Find last recorded response for url. Query strings differ between runs, eg: since=,
+     * so when there is no exact match the url is compared without query string */
+    struct TSRecord *found = NULL;
+    size_t len = strcspn(url, "?");
+
+    for (size_t i=0 ; i<ts->nrecords ; i++) {
+        struct TSRecord *r = &ts->records[i];
+        if (strcmp(r->method, method) != 0)
+            continue;
+        if (strcmp(r->url, url) == 0)
+            return r;
+        if (strcspn(r->url, "?") == len && strncmp(r->url, url, len) == 0)
+            found = r;
+    }
+    return found;
+}
+
+static int ts_replay(struct TSConn *c)
+{
+    /* Serve recorded response */
+    struct TestServer *ts = c->ts;
+    struct TSFile f = { NULL, 0 };
+    char path[TS_MAX_PATH * 2];
+
+    struct TSRecord *r = ts_replay_find(ts, c->method, c->target + 1);
+    if (r == NULL) {
+        DEBUG("Not recorded: %s %s\n", c->method, c->target + 1);
+        return ts_respond(c, 404, "text/plain", "", 0);
+    }
+
+    ts_body_path(ts, r->hash, path, sizeof(path));
+    if (ts_file_load(&f, path) < 0)
+        return ts_respond(c, 404, "text/plain", "", 0);
+
+    int ret = ts_respond(c, r->status, r->content_type, f.data, f.size);
+    free(f.data);
+    return ret;
+}
+
+static int ts_read_more(struct TSConn *c)
+{
+    /* Receive more data into buffer, returns -1 on error or closed connection */
+    if (c->len >= sizeof(c->buf) - 1)
+        return -1;
+
+    ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0);
+    if (n <= 0)
+        return -1;
+    c->len += n;
+    c->buf[c->len] = '\0';
+    return 0;
+}
+
+static void ts_consume(struct TSConn *c, size_t size)
+{
+    /* Remove handled data from start of buffer */
+    memmove(c->buf, c->buf + size, c->len - size);
+    c->len -= size;
+    c->buf[c->len] = '\0';
+}
+
+static int ts_read_body(struct TSConn *c, long content_length, int chunked)
+{
+    /* Read request body, either with a known length or in chunked transfer encoding.
+     * Body data is moved out of the request buffer as it arrives, so a chunk can be
+     * bigger than the request buffer */
+    struct TSBuffer b = { NULL, 0, 0 };
+
+    if (content_length >= 0) {
+        while ((long)b.size < content_length) {
+            if (c->len == 0 && ts_read_more(c) < 0)
+                break;
+            size_t n = ((long)c->len > content_length - (long)b.size) ? (size_t)(content_length - b.size) : c->len;
+            if (ts_buf_append(&b, c->buf, n) < 0) {
+                free(b.data);
+                return -1;
+            }
+            ts_consume(c, n);
+        }
+    }
+    else if (chunked) {
+        while (1) {
+            char *eol;
+            while ((eol = strstr(c->buf, "\r\n")) == NULL) {
+                if (ts_read_more(c) < 0) {
+                    free(b.data);
+                    return -1;
+                }
+            }
+            size_t chunk = strtoul(c->buf, NULL, 16);
+            ts_consume(c, eol - c->buf + 2);
+
+            for (size_t left=chunk ; left > 0 ;) {
+                if (c->len == 0 && ts_read_more(c) < 0) {
+                    free(b.data);
+                    return -1;
+                }
+                size_t n = (c->len > left) ? left : c->len;
+                if (ts_buf_append(&b, c->buf, n) < 0) {
+                    free(b.data);
+                    return -1;
+                }
+                ts_consume(c, n);
+                left -= n;
+            }
+
+            // trailing CRLF of chunk
+            while (c->len < 2) {
+                if (ts_read_more(c) < 0) {
+                    free(b.data);
+                    return -1;
+                }
+            }
+            ts_consume(c, 2);
+            if (chunk == 0)
+                break;
+        }
+    }
+    c->body = b.data;
+    c->body_len = b.size;
+    return 0;
+}
+
+static void ts_header_value(char *dest, const char *value, size_t size)
+{
+    while (*value == ' ')
+        value++;
+    snprintf(dest, size, "%.*s", (int)strcspn(value, "\r\n"), value);
+}
+
+static int ts_handle_request(struct TSConn *c)
+{
+    /* Read and answer one request, returns -1 when connection should be closed */
+    char *end;
+    while ((end = strstr(c->buf, "\r\n\r\n")) == NULL) {
+        if (ts_read_more(c) < 0)
+            return -1;
+    }
+
+    long content_length = -1;
+    int chunked = 0;
+    int expect_continue = 0;
+    c->if_none_match[0] = '\0';
+    c->authorization[0] = '\0';
+    c->accept_gzip = 0;
+    c->keep_alive = 1;
+    c->body = NULL;
+    c->body_len = 0;
+
+    *end = '\0';
+    if (sscanf(c->buf, "%7s %511s", c->method, c->target) != 2)
+        return -1;
+
+    for (char *line=strstr(c->buf, "\r\n") ; line != NULL ; line=strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, "If-None-Match:", 14) == 0)
+            ts_header_value(c->if_none_match, line+14, sizeof(c->if_none_match));
+        else if (strncasecmp(line, "Authorization:", 14) == 0)
+            ts_header_value(c->authorization, line+14, sizeof(c->authorization));
+        else if (strncasecmp(line, "Accept-Encoding:", 16) == 0)
+            c->accept_gzip = strstr(line, "gzip") != NULL;
+        else if (strncasecmp(line, "Content-Length:", 15) == 0)
+            content_length = atol(line+15);
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+            chunked = strstr(line, "chunked") != NULL;
+        else if (strncasecmp(line, "Expect:", 7) == 0)
+            expect_continue = strstr(line, "100-continue") != NULL;
+        else if (strncasecmp(line, "Connection:", 11) == 0)
+            c->keep_alive = strstr(line, "close") == NULL;
+    }
+    ts_consume(c, end - c->buf + 4);
+
+    if (expect_continue && ts_write_all(c->fd, "HTTP/1.1 100 Continue\r\n\r\n", 25) < 0)
+        return -1;
+    if (ts_read_body(c, content_length, chunked) < 0)
+        return -1;
+
+    DEBUG("Test server: %s %s\n", c->method, c->target);
+
+    int ret;
+    if (c->ts->mode == TS_MODE_RECORD)
+        ret = ts_record(c);
+    else if (c->ts->mode == TS_MODE_REPLAY)
+        ret = ts_replay(c);
+    else
+        ret = ts_synthetic(c);
+
+    free(c->body);
+    c->body = NULL;
+    return (ret < 0 || !c->keep_alive) ? -1 : 0;
+}
+
+static void* ts_conn_thread(void *arg)
+{
+    struct TSConn *c = arg;
+
+    int flag = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    while (ts_handle_request(c) == 0)
+        ;
+
+    pthread_mutex_lock(&c->ts->lock);
+    c->ts->nconns--;
+    pthread_mutex_unlock(&c->ts->lock);
+
+    close(c->fd);
+    free(c);
+    return NULL;
+}
+
+static void* ts_accept_thread(void *arg)
+{
+    /* Accept connections until server is stopped */
+    struct TestServer *ts = arg;
+
+    while (ts->running) {
+        int fd = accept(ts->fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        struct TSConn *c = malloc(sizeof(struct TSConn));
+        pthread_t thread;
+        if (c == NULL) {
+            close(fd);
+            continue;
+        }
+        c->ts = ts;
+        c->fd = fd;
+        c->len = 0;
+        c->buf[0] = '\0';
+
+        pthread_mutex_lock(&ts->lock);
+        ts->nconns++;
+        pthread_mutex_unlock(&ts->lock);
+
+        if (pthread_create(&thread, NULL, ts_conn_thread, c) != 0) {
+            ERROR("Failed to start connection thread\n");
+            pthread_mutex_lock(&ts->lock);
+            ts->nconns--;
+            pthread_mutex_unlock(&ts->lock);
+            close(fd);
+            free(c);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+int ts_start(struct TestServer *ts)
+{
+    /* Load content and start listening on loopback in a background thread */
+    if (ts->mode == TS_MODE_SYNTHETIC) {
+        if (ts_file_load(&ts->feed, TS_FEED_PATH) < 0 || ts_file_load(&ts->rss, TS_RSS_PATH) < 0 || ts_file_load(&ts->json, TS_JSON_PATH) < 0)
+            return -1;
+    }
+    else if (ts_session_load(ts) < 0) {
+        return -1;
+    }
+
+    ts->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (ts->fd < 0)
+        return -1;
+
+    int flag = 1;
+    setsockopt(ts->fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(ts->port);
+
+    if (bind(ts->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(ts->fd, 64) < 0 ||
+        getsockname(ts->fd, (struct sockaddr*)&addr, &addr_len) < 0) {
+        ERROR("Failed to listen on port %d: %s\n", ts->port, strerror(errno));
+        close(ts->fd);
+        ts->fd = -1;
+        return -1;
+    }
+    ts->port = ntohs(addr.sin_port);
+
+    pthread_mutex_init(&ts->lock, NULL);
+    ts->running = 1;
+    if (pthread_create(&ts->thread, NULL, ts_accept_thread, ts) != 0) {
+        ERROR("Failed to start test server thread\n");
+        close(ts->fd);
+        ts->fd = -1;
+        ts->running = 0;
+        return -1;
+    }
+
+    DEBUG("Test server listening on port %d\n", ts->port);
+    return 0;
+}
+
+void ts_stop(struct TestServer *ts)
+{
+    /* Stop accepting connections and wait a while for connection threads to end,
+     * they end when their client disconnects */
+    if (ts->running) {
+        ts->running = 0;
+        shutdown(ts->fd, SHUT_RDWR);
+        close(ts->fd);
+        pthread_join(ts->thread, NULL);
+
+        for (int i=0 ; i<100 ; i++) {
+            pthread_mutex_lock(&ts->lock);
+            int nconns = ts->nconns;
+            pthread_mutex_unlock(&ts->lock);
+            if (nconns == 0)
+                break;
+            usleep(10000);
+        }
+        INFO("Test server: %ld requests, %ld bytes sent\n", ts->nrequests, ts->nbytes);
+    }
+    ts->fd = -1;
+
+    free(ts->feed.data);
+    free(ts->rss.data);
+    free(ts->json.data);
+    free(ts->records);
+    ts->feed.data = NULL;
+    ts->rss.data = NULL;
+    ts->json.data = NULL;
+    ts->records = NULL;
+}
+
+void ts_url(struct TestServer *ts, char *buf, size_t size)
+{
+    snprintf(buf, size, "http://127.0.0.1:%d", ts->port);
+}
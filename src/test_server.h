@@ -0,0 +1,131 @@
+#ifndef TEST_SERVER_H
+#define TEST_SERVER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <curl/curl.h>
+
+#include "lib/hash/hash.h"
+#include "lib/hash/crc32.h"
+
+// Loopback HTTP server to run the client without network, eg: for benchmarks.
+// Runs in its own thread, every connection gets a thread.
+// Not part of the client, it is only built into the test binary with TEST_SERVER defined:
+//     make loopback
+//
+// Synthetic mode serves gpoddersync endpoints, feeds made from data/test.xml at /feed/<n>,
+// data/test2.xml at /rss and data/test.json at /test.json.
+// Responses can be delayed, throttled, written in small chunks and gzipped. Every response
+// has an ETag so conditional requests can be answered with 304.
+//
+// Record mode forwards requests to the url in the request path, eg: /https://example.com/feed,
+// and saves the responses in a session directory. Replay mode serves the saved responses so
+// a recorded session can be repeated without network. Client must prefix urls with the server
+// url, see APIClient.url_prefix.
+//
+// Configured with a comma separated string, eg: "latency=50,bandwidth=100000,chunk=512,gzip=1"
+//   port=<n>        listen port, 0 is a random free port. Feed urls contain the port so
+//                   a fixed port keeps them the same between runs
+//   feeds=<n>       amount of subscriptions in synthetic mode
+//   aliases=<n>     also subscribe to the first n feeds as /moved/<n>, that redirects
+//                   permanently to /feed/<n>, and with an uppercase scheme and a fragment
+//   latency=<ms>    delay before every response
+//   bandwidth=<n>   max bytes per second per response, 0 is unlimited
+//   chunk=<n>       bytes per write
+//   gzip=<0|1>      compress when client accepts it
+//   304=<0|1>       answer matching If-None-Match with 304
+//   record=<dir>    record session in dir
+//   replay=<dir>    replay session from dir
+
+#define TS_MAX_PATH       512
+#define TS_MAX_REQUEST    8192
+#define TS_MAX_HEADER     256
+#define TS_MAX_RECORDS    1024
+#define TS_DEFAULT_PORT   8765
+#define TS_DEFAULT_FEEDS  10
+#define TS_DEFAULT_CHUNK  16384
+
+#define TS_FEED_PATH     "data/test.xml"
+#define TS_RSS_PATH      "data/test2.xml"
+#define TS_JSON_PATH     "data/test.json"
+#define TS_SESSION_INDEX "index.tsv"
+
+// deflate stored blocks hold at most 65535 bytes
+#define TS_GZIP_BLOCK 65535
+
+extern int do_debug;
+extern int do_info;
+extern int do_error;
+
+enum TSMode {
+    TS_MODE_SYNTHETIC,
+    TS_MODE_RECORD,
+    TS_MODE_REPLAY
+};
+
+// Recorded response, body is stored in session dir as <hash>.body
+struct TSRecord {
+    char method[8];
+    char url[TS_MAX_PATH];
+    long status;
+    char content_type[TS_MAX_HEADER];
+    uint64_t hash;
+};
+
+// Static content, loaded once when server starts
+struct TSFile {
+    char *data;
+    size_t size;
+};
+
+struct TestServer {
+    enum TSMode mode;
+    int port;
+    int nfeeds;
+    int naliases;
+    long latency_ms;
+    long bandwidth;
+    size_t chunk_size;
+    int gzip;
+    int not_modified;
+    char session[TS_MAX_PATH];
+
+    struct TSFile feed;
+    struct TSFile rss;
+    struct TSFile json;
+
+    struct TSRecord *records;
+    size_t nrecords;
+
+    int fd;
+    int running;
+    pthread_t thread;
+
+    // protects records and counters
+    pthread_mutex_t lock;
+    long nrequests;
+    long nbytes;
+    long timestamp;
+    int nconns;
+};
+
+void ts_init(struct TestServer *ts);
+int ts_configure(struct TestServer *ts, const char *spec);
+int ts_start(struct TestServer *ts);
+void ts_stop(struct TestServer *ts);
+void ts_url(struct TestServer *ts, char *buf, size_t size);
+
+#endif